@@ -0,0 +1,22 @@
+#pragma once
+
+#include "VectorClock.h"
+
+#include <string>
+#include <unordered_map>
+
+/// A value together with the clock of the write that produced it. An empty value means the key
+/// was deleted.
+struct DataVersion
+{
+    DataVersion(const std::string &val, const VectorClock &clock)
+        : value(val)
+        , clock(clock)
+    {
+    }
+
+    std::string value;
+    VectorClock clock;
+};
+
+using DataStore = std::unordered_map<std::string, DataVersion>;
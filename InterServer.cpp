@@ -0,0 +1,256 @@
+#include "InterServer.h"
+
+#include "ParsingHelpers.h"
+#include "ShardSchemeUtility.h"
+
+#include <pistache/async.h>
+#include <pistache/http.h>
+#include <sstream>
+
+using namespace std;
+
+namespace
+{
+// Switches and moves are sent until they are accepted, and the receiver may be busy with a
+// reshard of its own, so they get a long timeout and are not tracked (see PeerTransport).
+const chrono::milliseconds RESHARD_TIMEOUT(30000);
+
+/// Called with the status and body of an RPC reply, or with nothing if there was no reply.
+using RpcReplyFunction = function<void(optional<RpcStatus> status, RpcReader &reply)>;
+
+/// Called with the HTTP response, or with nothing if there was none.
+using HttpReplyFunction = function<void(optional<Pistache::Http::Response> response)>;
+
+/// Sends the request as an RPC, or to inter_server/$resource over HTTP if the node doesn't accept
+/// RPC connections. The HTTP body is only built if it is needed.
+void
+send(const PeerTransport &transport, const string &address, RpcOp op, const RpcWriter &request,
+     const string &resource, function<string()> makeHttpBody, RpcReplyFunction onRpcReply,
+     HttpReplyFunction onHttpReply, optional<chrono::milliseconds> timeout = {},
+     bool tracked = true)
+{
+    auto onReply = [onRpcReply](RpcClient::Outcome outcome, RpcStatus status, string_view body) {
+        RpcReader reply(body);
+        if (outcome == RpcClient::Outcome::Replied)
+            onRpcReply(status, reply);
+        else
+            onRpcReply(nullopt, reply);
+    };
+
+    if (transport.sendRpc(address, op, request.buffer(), onReply, timeout, tracked))
+        return;
+
+    auto rsp = transport.sendMsg(address, resource, makeHttpBody(), timeout, tracked);
+    rsp.then([onHttpReply](Pistache::Http::Response response) { onHttpReply(response); },
+             [onHttpReply](exception_ptr) { onHttpReply(nullopt); });
+}
+
+/// Like send(), for messages whose only answer is whether they were accepted.
+void
+sendForDone(const PeerTransport &transport, const string &address, RpcOp op,
+            const RpcWriter &request, const string &resource, function<string()> makeHttpBody,
+            InterServer::DoneFunction onDone, optional<chrono::milliseconds> timeout = {},
+            bool tracked = true)
+{
+    send(transport, address, op, request, resource, makeHttpBody,
+         [onDone](optional<RpcStatus> status, RpcReader &) {
+             onDone(status == RpcStatus::Ok);
+         },
+         [onDone](optional<Pistache::Http::Response> response) {
+             onDone(response && response->code() == Pistache::Http::Code::Ok);
+         },
+         timeout, tracked);
+}
+} // namespace
+
+namespace InterServer
+{
+
+void
+getData(const PeerTransport &transport, const string &address, const string &key,
+        DataReplyFunction onReply)
+{
+    RpcWriter request;
+    request.string(key);
+
+    send(transport, address, RpcOp::DataGet, request, "dataStore/" + key,
+         []() { return string(); },
+         [onReply](optional<RpcStatus> status, RpcReader &reply) {
+             if (status != RpcStatus::Ok) {
+                 onReply(nullopt);
+                 return;
+             }
+
+             try {
+                 DataReply data;
+                 bool found = reply.u8() != 0;
+                 data.schemeVersion = reply.i32();
+                 if (found)
+                     data.version = reply.dataVersion();
+                 onReply(data);
+             } catch (const RpcDecodeError &) {
+                 onReply(nullopt);
+             }
+         },
+         [onReply](optional<Pistache::Http::Response> response) {
+             if (!response) {
+                 onReply(nullopt);
+                 return;
+             }
+
+             DataReply data;
+             string body = response->body();
+             if (!body.empty()) {
+                 auto versionAndScheme = stringTodataVersionAndSchemeVersion(body);
+                 data.version = versionAndScheme.first;
+                 data.schemeVersion = versionAndScheme.second;
+             }
+             onReply(data);
+         });
+}
+
+void
+pushData(const PeerTransport &transport, const string &address, const DataStore &data,
+         DoneFunction onDone, optional<chrono::milliseconds> timeout)
+{
+    RpcWriter request;
+    request.u32((uint32_t)data.size());
+    for (const auto &entry : data) {
+        request.string(entry.first);
+        request.dataVersion(entry.second);
+    }
+
+    sendForDone(transport, address, RpcOp::DataPush, request, "dataSync/push",
+                [&data]() { return mapToDataString(data); }, onDone, timeout);
+}
+
+void
+prepareScheme(const PeerTransport &transport, const string &address, const ShardScheme &scheme,
+              DoneFunction onDone)
+{
+    RpcWriter request;
+    request.scheme(scheme);
+
+    sendForDone(transport, address, RpcOp::ShardPrepare, request, "shards/prepare",
+                [&scheme]() { return ShardSchemeUtility::serializeScheme(scheme); }, onDone);
+}
+
+void
+switchScheme(const PeerTransport &transport, const string &address, int schemeVersion,
+             DoneFunction onDone)
+{
+    RpcWriter request;
+    request.i32(schemeVersion);
+
+    sendForDone(transport, address, RpcOp::ShardSwitch, request, "shards/switch",
+                [schemeVersion]() { return to_string(schemeVersion); }, onDone, RESHARD_TIMEOUT,
+                false);
+}
+
+void
+moveData(const PeerTransport &transport, const string &address, int schemeVersion,
+         const string &key, const DataVersion &data, DoneFunction onDone)
+{
+    RpcWriter request;
+    request.i32(schemeVersion);
+    request.string(key);
+    request.dataVersion(data);
+
+    // The HTTP message is version&key&value. Ampersands in key and value are escaped by
+    // backslashes.
+    auto makeHttpBody = [&]() {
+        return to_string(schemeVersion) + "&" + escapeChars(key, "&") + "&" +
+               escapeChars(dataVersionToString(data), "&");
+    };
+
+    sendForDone(transport, address, RpcOp::ShardMove, request, "shards/move", makeHttpBody,
+                onDone, RESHARD_TIMEOUT, false);
+}
+
+void
+moveDataBatch(const PeerTransport &transport, const string &address, int schemeVersion,
+              const DataStore &data, DoneFunction onDone)
+{
+    RpcWriter request;
+    request.i32(schemeVersion);
+    request.u32((uint32_t)data.size());
+    for (const auto &entry : data) {
+        request.string(entry.first);
+        request.dataVersion(entry.second);
+    }
+
+    // The HTTP message is the version, an ampersand, and the data as dataSync/push sends it.
+    auto makeHttpBody = [&]() { return to_string(schemeVersion) + "&" + mapToDataString(data); };
+
+    sendForDone(transport, address, RpcOp::ShardMoveBatch, request, "shards/moveBatch",
+                makeHttpBody, onDone, RESHARD_TIMEOUT, false);
+}
+
+void
+countKeys(const PeerTransport &transport, const string &address,
+          function<void(optional<size_t> count)> onReply)
+{
+    send(transport, address, RpcOp::Count, RpcWriter(), "count", []() { return string(); },
+         [onReply](optional<RpcStatus> status, RpcReader &reply) {
+             if (status != RpcStatus::Ok) {
+                 onReply(nullopt);
+                 return;
+             }
+
+             try {
+                 onReply((size_t)reply.u64());
+             } catch (const RpcDecodeError &) {
+                 onReply(nullopt);
+             }
+         },
+         [onReply](optional<Pistache::Http::Response> response) {
+             if (response && response->code() == Pistache::Http::Code::Ok)
+                 onReply((size_t)strtoull(response->body().c_str(), nullptr, 10));
+             else
+                 onReply(nullopt);
+         });
+}
+
+void
+planScheme(const PeerTransport &transport, const string &address, const ShardScheme &scheme,
+           function<void(optional<vector<ShardLoad>> loads)> onReply)
+{
+    RpcWriter request;
+    request.scheme(scheme);
+
+    send(transport, address, RpcOp::ShardPlan, request, "shards/plan",
+         [&scheme]() { return ShardSchemeUtility::serializeScheme(scheme); },
+         [onReply](optional<RpcStatus> status, RpcReader &reply) {
+             if (status != RpcStatus::Ok) {
+                 onReply(nullopt);
+                 return;
+             }
+
+             try {
+                 vector<ShardLoad> loads(reply.count(2 * sizeof(uint64_t)));
+                 for (ShardLoad &load : loads) {
+                     load.numKeys = reply.u64();
+                     load.numBytes = reply.u64();
+                 }
+                 onReply(move(loads));
+             } catch (const RpcDecodeError &) {
+                 onReply(nullopt);
+             }
+         },
+         [onReply](optional<Pistache::Http::Response> response) {
+             if (!response || response->code() != Pistache::Http::Code::Ok) {
+                 onReply(nullopt);
+                 return;
+             }
+
+             // The HTTP reply is the number of keys and bytes of each shard, separated by spaces.
+             istringstream stream(response->body());
+             vector<ShardLoad> loads;
+             ShardLoad load;
+             while (stream >> load.numKeys >> load.numBytes)
+                 loads.push_back(load);
+             onReply(move(loads));
+         });
+}
+
+} // namespace InterServer
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "DataVersion.h"
+#include "PeerTransport.h"
+#include "ShardScheme.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+/// Typed inter-server messages. Each one is sent as an RPC (see RpcProtocol.h) when the receiver
+/// accepts RPC connections, and over the matching PATCH /inter_server/ route otherwise, so nodes
+/// that only speak HTTP still work. Either way, the message goes through PeerTransport::sendRpc()
+/// or PeerTransport::sendMsg() and gets the same timeouts and failure tracking. Switches and
+/// moves get a long timeout instead, and are not tracked.
+///
+/// Callbacks run on a network thread and must not block.
+namespace InterServer
+{
+
+/// Called with true if the receiver accepted the message.
+using DoneFunction = std::function<void(bool success)>;
+
+/// A node's answer to getData().
+struct DataReply
+{
+    /// The node's version of the key, if it has one.
+    std::optional<DataVersion> version;
+
+    /// The node's scheme version, or -1 if it doesn't have the key and answered over HTTP.
+    int schemeVersion = -1;
+};
+
+/// Number of keys, and bytes of keys and values, in part of a node's store.
+struct ShardLoad
+{
+    uint64_t numKeys = 0;
+    uint64_t numBytes = 0;
+};
+
+/// Called with the reply, or with nothing if the node didn't answer.
+using DataReplyFunction = std::function<void(std::optional<DataReply> reply)>;
+
+/// Asks the node for its version of the key (dataStore/$key).
+void getData(const PeerTransport &transport, const std::string &address, const std::string &key,
+             DataReplyFunction onReply);
+
+/// Sends the data to the node, which merges it into its own (dataSync/push).
+void pushData(const PeerTransport &transport, const std::string &address, const DataStore &data,
+              DoneFunction onDone, std::optional<std::chrono::milliseconds> timeout = {});
+
+/// Asks the node to prepare for the scheme (shards/prepare).
+void prepareScheme(const PeerTransport &transport, const std::string &address,
+                   const ShardScheme &scheme, DoneFunction onDone);
+
+/// Asks the node to switch to the prepared scheme version (shards/switch). The node starts
+/// switching and answers right away; it accepts the message once it has switched, so the message
+/// is sent until it is accepted.
+void switchScheme(const PeerTransport &transport, const std::string &address, int schemeVersion,
+                  DoneFunction onDone);
+
+/// Hands a key that the node is responsible for under the scheme version to it (shards/move).
+void moveData(const PeerTransport &transport, const std::string &address, int schemeVersion,
+              const std::string &key, const DataVersion &data, DoneFunction onDone);
+
+/// Hands a batch of keys that the node is responsible for under the scheme version to it
+/// (shards/moveBatch). The node applies the whole batch at once.
+void moveDataBatch(const PeerTransport &transport, const std::string &address, int schemeVersion,
+                   const DataStore &data, DoneFunction onDone);
+
+/// Asks the node how many keys it has (count). Called with nothing if it didn't answer.
+void countKeys(const PeerTransport &transport, const std::string &address,
+               std::function<void(std::optional<size_t> count)> onReply);
+
+/// Asks the node how its keys would be spread over the shards of the scheme, which it doesn't
+/// prepare for (shards/plan). Called with the load of each shard, by ID, or with nothing if the
+/// node didn't answer.
+void planScheme(const PeerTransport &transport, const std::string &address,
+                const ShardScheme &scheme,
+                std::function<void(std::optional<std::vector<ShardLoad>> loads)> onReply);
+
+} // namespace InterServer
@@ -0,0 +1,332 @@
+#include "IoUring.h"
+
+#include <sys/uio.h>
+
+// Kernel headers from before io_uring could probe for operations (5.6) are treated like kernels
+// without io_uring: every instance is invalid and callers use their fallback.
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#ifdef IO_URING_OP_SUPPORTED
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+#endif
+
+using namespace std;
+
+#ifdef IO_URING_OP_SUPPORTED
+
+struct IoUring::Rings
+{
+    int fd = -1;
+    bool valid = false;
+
+    void *sqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    void *cqRing = MAP_FAILED;
+    size_t cqRingSize = 0;
+    io_uring_sqe *sqes = (io_uring_sqe *)MAP_FAILED;
+    size_t sqesSize = 0;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned *sqArray;
+
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    io_uring_cqe *cqes;
+
+    /// Entries queued since the last enter().
+    unsigned numToSubmit = 0;
+
+    /// The period of the queued timer. The kernel reads it when the timer is submitted.
+    __kernel_timespec timeout = {};
+};
+
+namespace
+{
+template <class T>
+T *
+at(void *base, unsigned offset)
+{
+    return (T *)((char *)base + offset);
+}
+
+/// Returns true if the kernel supports every operation the prepare functions queue.
+bool
+supportsOperations(int ringFd)
+{
+    const unsigned MAX_OPS = 256;
+    vector<char> storage(sizeof(io_uring_probe) + MAX_OPS * sizeof(io_uring_probe_op));
+    io_uring_probe *probe = (io_uring_probe *)storage.data();
+
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, MAX_OPS) < 0)
+        return false;
+
+    for (unsigned op : {IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_SEND, IORING_OP_TIMEOUT}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            return false;
+    }
+
+    return true;
+}
+} // namespace
+
+IoUring::IoUring(unsigned numEntries)
+    : mRings(make_unique<Rings>())
+{
+    Rings &r = *mRings;
+
+    io_uring_params params = {};
+    r.fd = (int)syscall(__NR_io_uring_setup, numEntries, &params);
+    if (r.fd < 0 || !supportsOperations(r.fd))
+        return;
+
+    r.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    // Since 5.4 both rings share one mapping.
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap)
+        r.sqRingSize = r.cqRingSize = max(r.sqRingSize, r.cqRingSize);
+
+    r.sqRing = mmap(nullptr, r.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd,
+                    IORING_OFF_SQ_RING);
+    if (r.sqRing == MAP_FAILED)
+        return;
+
+    if (singleMap)
+        r.cqRing = r.sqRing;
+    else
+        r.cqRing = mmap(nullptr, r.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        r.fd, IORING_OFF_CQ_RING);
+    if (r.cqRing == MAP_FAILED)
+        return;
+
+    r.sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    r.sqes = (io_uring_sqe *)mmap(nullptr, r.sqesSize, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQES);
+    if (r.sqes == MAP_FAILED)
+        return;
+
+    r.sqHead = at<unsigned>(r.sqRing, params.sq_off.head);
+    r.sqTail = at<unsigned>(r.sqRing, params.sq_off.tail);
+    r.sqMask = *at<unsigned>(r.sqRing, params.sq_off.ring_mask);
+    r.sqEntries = params.sq_entries;
+    r.sqArray = at<unsigned>(r.sqRing, params.sq_off.array);
+
+    r.cqHead = at<unsigned>(r.cqRing, params.cq_off.head);
+    r.cqTail = at<unsigned>(r.cqRing, params.cq_off.tail);
+    r.cqMask = *at<unsigned>(r.cqRing, params.cq_off.ring_mask);
+    r.cqes = at<io_uring_cqe>(r.cqRing, params.cq_off.cqes);
+
+    r.valid = true;
+}
+
+IoUring::~IoUring()
+{
+    Rings &r = *mRings;
+
+    if (r.sqes != MAP_FAILED)
+        munmap(r.sqes, r.sqesSize);
+    if (r.cqRing != MAP_FAILED && r.cqRing != r.sqRing)
+        munmap(r.cqRing, r.cqRingSize);
+    if (r.sqRing != MAP_FAILED)
+        munmap(r.sqRing, r.sqRingSize);
+    if (r.fd >= 0)
+        close(r.fd);
+}
+
+bool
+IoUring::isValid() const
+{
+    return mRings->valid;
+}
+
+bool
+IoUring::registerBuffers(const iovec *buffers, unsigned numBuffers)
+{
+    return syscall(__NR_io_uring_register, mRings->fd, IORING_REGISTER_BUFFERS, buffers,
+                   numBuffers) == 0;
+}
+
+void *
+IoUring::nextEntry()
+{
+    Rings &r = *mRings;
+
+    unsigned tail = *r.sqTail;
+    while (tail - __atomic_load_n(r.sqHead, __ATOMIC_ACQUIRE) >= r.sqEntries)
+        enter(0);
+
+    unsigned index = tail & r.sqMask;
+    io_uring_sqe *entry = &r.sqes[index];
+    *entry = {};
+    r.sqArray[index] = index;
+
+    // The entry is filled in by the caller before the kernel looks at it in the next enter().
+    __atomic_store_n(r.sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++r.numToSubmit;
+
+    return entry;
+}
+
+void
+IoUring::prepareRead(int fd, void *buffer, unsigned length, uint64_t userData)
+{
+    io_uring_sqe *entry = (io_uring_sqe *)nextEntry();
+    entry->opcode = IORING_OP_READ;
+    entry->fd = fd;
+    entry->addr = (uint64_t)buffer;
+    entry->len = length;
+    entry->user_data = userData;
+}
+
+void
+IoUring::prepareReadFixed(int fd, void *buffer, unsigned length, unsigned bufferIndex,
+                          uint64_t userData)
+{
+    io_uring_sqe *entry = (io_uring_sqe *)nextEntry();
+    entry->opcode = IORING_OP_READ_FIXED;
+    entry->fd = fd;
+    entry->addr = (uint64_t)buffer;
+    entry->len = length;
+    entry->buf_index = (uint16_t)bufferIndex;
+    entry->user_data = userData;
+}
+
+void
+IoUring::prepareSend(int fd, const void *data, unsigned length, uint64_t userData)
+{
+    io_uring_sqe *entry = (io_uring_sqe *)nextEntry();
+    entry->opcode = IORING_OP_SEND;
+    entry->fd = fd;
+    entry->addr = (uint64_t)data;
+    entry->len = length;
+    entry->msg_flags = MSG_NOSIGNAL;
+    entry->user_data = userData;
+}
+
+void
+IoUring::prepareTimeout(chrono::milliseconds period, uint64_t userData)
+{
+    Rings &r = *mRings;
+    r.timeout.tv_sec = period.count() / 1000;
+    r.timeout.tv_nsec = (period.count() % 1000) * 1000000;
+
+    io_uring_sqe *entry = (io_uring_sqe *)nextEntry();
+    entry->opcode = IORING_OP_TIMEOUT;
+    entry->fd = -1;
+    entry->addr = (uint64_t)&r.timeout;
+    entry->len = 1;
+    entry->user_data = userData;
+}
+
+void
+IoUring::enter(unsigned minComplete)
+{
+    Rings &r = *mRings;
+
+    // On failure (interrupted, or the completion queue is full) nothing was taken; the caller
+    // reaps completions and the entries go with the next call.
+    int rc = (int)syscall(__NR_io_uring_enter, r.fd, r.numToSubmit, minComplete,
+                          minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    if (rc > 0)
+        r.numToSubmit -= (unsigned)rc;
+}
+
+void
+IoUring::submitAndWait()
+{
+    enter(1);
+}
+
+void
+IoUring::forEachCompletion(const function<void(uint64_t userData, int result)> &onCompletion)
+{
+    Rings &r = *mRings;
+
+    unsigned head = *r.cqHead;
+    while (head != __atomic_load_n(r.cqTail, __ATOMIC_ACQUIRE)) {
+        io_uring_cqe *entry = &r.cqes[head & r.cqMask];
+        uint64_t userData = entry->user_data;
+        int result = entry->res;
+
+        // Release the entry before the callback, which may queue more operations.
+        __atomic_store_n(r.cqHead, ++head, __ATOMIC_RELEASE);
+        onCompletion(userData, result);
+    }
+}
+
+#else
+
+struct IoUring::Rings
+{
+};
+
+IoUring::IoUring(unsigned) {}
+
+IoUring::~IoUring() {}
+
+bool
+IoUring::isValid() const
+{
+    return false;
+}
+
+bool
+IoUring::registerBuffers(const iovec *, unsigned)
+{
+    return false;
+}
+
+void *
+IoUring::nextEntry()
+{
+    return nullptr;
+}
+
+void
+IoUring::prepareRead(int, void *, unsigned, uint64_t)
+{
+}
+
+void
+IoUring::prepareReadFixed(int, void *, unsigned, unsigned, uint64_t)
+{
+}
+
+void
+IoUring::prepareSend(int, const void *, unsigned, uint64_t)
+{
+}
+
+void
+IoUring::prepareTimeout(chrono::milliseconds, uint64_t)
+{
+}
+
+void
+IoUring::enter(unsigned)
+{
+}
+
+void
+IoUring::submitAndWait()
+{
+}
+
+void
+IoUring::forEachCompletion(const function<void(uint64_t userData, int result)> &)
+{
+}
+
+#endif
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+struct iovec;
+
+/// A minimal io_uring instance, talking to the kernel through the raw system calls so it needs
+/// no library. Operations are queued with the prepare functions and handed to the kernel together
+/// by submitAndWait(), so queuing several costs one system call.
+///
+/// Only one thread may use an instance.
+class IoUring
+{
+public:
+    /// Sets up a ring with room for at least numEntries queued operations; there should be no
+    /// more operations in flight than that. Check isValid(): setup fails on kernels without
+    /// io_uring, or where it is disabled (as in some containers).
+    IoUring(unsigned numEntries);
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    ~IoUring();
+
+    /// Returns true if the ring was set up and supports every operation the prepare functions
+    /// queue.
+    bool isValid() const;
+
+    /// Registers buffers with the kernel, so reads into them with readFixed() skip mapping the
+    /// memory on every call. Returns false if the kernel refused (usually because of the locked
+    /// memory limit); plain reads still work.
+    bool registerBuffers(const iovec *buffers, unsigned numBuffers);
+
+    /// Queues a read of up to length bytes into buffer, which must stay valid until it completes.
+    void prepareRead(int fd, void *buffer, unsigned length, uint64_t userData);
+
+    /// Like prepareRead(), into a part of the registered buffer at bufferIndex.
+    void prepareReadFixed(int fd, void *buffer, unsigned length, unsigned bufferIndex,
+                          uint64_t userData);
+
+    /// Queues a send on a socket. The data must stay valid until it completes.
+    void prepareSend(int fd, const void *data, unsigned length, uint64_t userData);
+
+    /// Queues a timer that completes with -ETIME after the period. Only one timer can be queued
+    /// at a time.
+    void prepareTimeout(std::chrono::milliseconds period, uint64_t userData);
+
+    /// Hands every queued operation to the kernel and waits until at least one has completed, or
+    /// until the wait is interrupted.
+    void submitAndWait();
+
+    /// Calls onCompletion with the user data and result (as returned by the equivalent system
+    /// call, or -errno) of every completed operation.
+    void forEachCompletion(const std::function<void(uint64_t userData, int result)> &onCompletion);
+
+private:
+    struct Rings;
+
+    /// Returns a free submission entry, handing the queued ones to the kernel first if the queue is
+    /// full.
+    void *nextEntry();
+
+    /// Hands the queued operations to the kernel, waiting for minComplete completions.
+    void enter(unsigned minComplete);
+
+    std::unique_ptr<Rings> mRings;
+};
@@ -0,0 +1,205 @@
+#include "KvsClient.h"
+
+#include "ParsingHelpers.h"
+#include "ShardRouting.h"
+#include "ShardSchemeUtility.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <memory>
+#include <ostream>
+
+using namespace Pistache;
+using namespace std;
+
+namespace
+{
+// How long to wait for a node before trying another.
+const chrono::milliseconds REQUEST_TIMEOUT(2000);
+
+// Requests sent for one call: redirects and nodes that don't answer each use one up.
+const int MAX_ATTEMPTS = 4;
+
+// Encodes the key as a path segment: unreserved characters are kept and everything else becomes
+// %XX. Nodes don't decode the path, so the encoded key is the one they store and hash.
+string
+encodeKey(const string &key)
+{
+    const char *HEX_DIGITS = "0123456789ABCDEF";
+
+    string out;
+    for (unsigned char c : key) {
+        if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            out += (char)c;
+        } else {
+            out += '%';
+            out += HEX_DIGITS[c >> 4];
+            out += HEX_DIGITS[c & 15];
+        }
+    }
+
+    return out;
+}
+} // namespace
+
+KvsClient::KvsClient(const vector<string> &addresses)
+    : mAddresses(addresses)
+{
+    // clang-format off
+    auto opts = Http::Client::options()
+                    .threads(1)
+                    .keepAlive(true)
+                    .maxConnectionsPerHost(8);
+    // clang-format on
+
+    mClient.init(opts);
+
+    refreshScheme();
+}
+
+KvsClient::~KvsClient() { mClient.shutdown(); }
+
+KvsClient::Reply
+KvsClient::get(const string &key, const string &payload)
+{
+    return send(Http::Method::Get, key, "payload=" + HTTPify(payload));
+}
+
+KvsClient::Reply
+KvsClient::put(const string &key, const string &value, const string &payload)
+{
+    return send(Http::Method::Put, key, "val=" + HTTPify(value) + "&payload=" + HTTPify(payload));
+}
+
+KvsClient::Reply
+KvsClient::del(const string &key, const string &payload)
+{
+    return send(Http::Method::Delete, key, "payload=" + HTTPify(payload));
+}
+
+int
+KvsClient::schemeVersion() const
+{
+    lock_guard<mutex> lock(mMut);
+    return mScheme ? mScheme->version() : -1;
+}
+
+KvsClient::Reply
+KvsClient::send(Http::Method method, const string &key, const string &body)
+{
+    const string storedKey = encodeKey(key);
+    const string resource = "/keyValue-store/" + storedKey;
+
+    vector<string> candidates = ownersOf(storedKey);
+
+    for (int attempt = 0; attempt < MAX_ATTEMPTS && !candidates.empty(); ++attempt) {
+        string address = candidates[rand() % candidates.size()];
+        optional<Http::Response> rsp = sendTo(address, method, resource, body);
+
+        if (!rsp) {
+            // The node may be down or gone from the scheme. Don't pick it again for this call
+            // unless it's the only one left.
+            refreshScheme();
+            candidates = ownersOf(storedKey);
+            if (candidates.size() > 1)
+                candidates.erase(remove(candidates.begin(), candidates.end(), address),
+                                 candidates.end());
+            continue;
+        }
+
+        if (rsp->code() != Http::Code::Temporary_Redirect)
+            return {rsp->code(), rsp->body()};
+
+        // The cached scheme sent us to the wrong shard. The redirect says which shard is right.
+        auto members = rsp->headers().tryGetRaw(ShardRouting::MEMBERS_HEADER);
+        auto version = rsp->headers().tryGetRaw(ShardRouting::SCHEME_VERSION_HEADER);
+
+        if (!version.isEmpty() && atoi(version.get().value().c_str()) > schemeVersion())
+            refreshScheme(address);
+
+        if (!members.isEmpty())
+            candidates = splitByCommas(members.get().value());
+        else
+            candidates = ownersOf(storedKey);
+    }
+
+    return {Http::Code::Gateway_Timeout, ""};
+}
+
+optional<Http::Response>
+KvsClient::sendTo(const string &address, Http::Method method, const string &resource,
+                  const string &body)
+{
+    Http::RequestBuilder requestBuilder = mClient.get("");
+
+    // clang-format off
+    requestBuilder
+        .method(method)
+        .resource(address + resource)
+        .header<ShardRouting::RouteHeader>()
+        .body(body)
+        .timeout(REQUEST_TIMEOUT);
+    // clang-format on
+
+    auto answer = make_shared<promise<optional<Http::Response>>>();
+
+    auto rsp = requestBuilder.send();
+    rsp.then([answer](Http::Response response) { answer->set_value(response); },
+             [answer](exception_ptr) { answer->set_value(nullopt); });
+
+    return answer->get_future().get();
+}
+
+void
+KvsClient::refreshScheme(const string &preferred)
+{
+    vector<string> addresses;
+    if (!preferred.empty())
+        addresses.push_back(preferred);
+
+    {
+        lock_guard<mutex> lock(mMut);
+        addresses.insert(addresses.end(), mAddresses.begin(), mAddresses.end());
+    }
+
+    for (const string &address : addresses) {
+        optional<Http::Response> rsp =
+            sendTo(address, Http::Method::Get, ShardRouting::SCHEME_RESOURCE, "");
+        if (!rsp || rsp->code() != Http::Code::Ok)
+            continue;
+
+        ShardScheme scheme = ShardSchemeUtility::deserializeScheme(rsp->body());
+
+        lock_guard<mutex> lock(mMut);
+        if (mScheme && mScheme->version() >= scheme.version())
+            return;
+
+        mScheme = scheme;
+
+        // Remembers every node, so the scheme can still be fetched after the nodes the client
+        // started with have left.
+        for (size_t shardId = 0; shardId < scheme.getNumShards(); ++shardId) {
+            for (const string &node : scheme.getShardInfo(shardId).getNodeSet()) {
+                if (find(mAddresses.begin(), mAddresses.end(), node) == mAddresses.end())
+                    mAddresses.push_back(node);
+            }
+        }
+
+        return;
+    }
+}
+
+vector<string>
+KvsClient::ownersOf(const string &key) const
+{
+    lock_guard<mutex> lock(mMut);
+
+    if (!mScheme || mScheme->getNumShards() == 0)
+        return mAddresses;
+
+    const set<string> &nodes = mScheme->getResponsibleShardInfo(hash<string>{}(key)).getNodeSet();
+    return vector<string>(nodes.begin(), nodes.end());
+}
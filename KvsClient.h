@@ -0,0 +1,81 @@
+#pragma once
+
+#include "ShardScheme.h"
+
+#include <mutex>
+#include <optional>
+#include <pistache/client.h>
+#include <pistache/http.h>
+#include <string>
+#include <vector>
+
+/// A client library for programs that use the key-value store. It keeps a copy of the shard
+/// scheme, hashes keys the way nodes do, and sends each request straight to a node of the shard
+/// that owns the key, which saves the hop through a node that would forward it.
+///
+/// Requests ask for redirects (see ShardRouting.h). If the cached scheme is out of date, the node
+/// answers with the owning shard's members instead of forwarding the request; the client resends
+/// it to one of them, and fetches the scheme again if the node's is newer.
+///
+/// Keys are sent percent-encoded in the path. Nodes don't decode it, so they store and hash the
+/// encoded key, and so does the client; plain HTTP clients reach the same entries by sending the
+/// same encoding.
+///
+/// Keys are hashed with std::hash<std::string>, so the client must be built with the same standard
+/// library as the nodes. Build it with KvsClient.cpp, ShardScheme.cpp, ShardSchemeUtility.cpp,
+/// ShardSchemeUtilitySerialization.cpp, ParsingHelpers.cpp and VectorClock.cpp, and link
+/// Pistache, as ./build.sh clientsmoke does for the smoke test in KvsClientSmoke.cpp.
+///
+/// Thread-safe. Calls block until they have an answer.
+class KvsClient
+{
+public:
+    struct Reply
+    {
+        /// Gateway_Timeout if no node answered.
+        Pistache::Http::Code code;
+
+        /// The body of the node's answer, as documented for the HTTP API.
+        std::string body;
+    };
+
+    /// Fetches the scheme from the first of the addresses (IP:port of nodes) that answers. The
+    /// addresses are used again whenever the scheme has to be fetched, along with every node in
+    /// the schemes seen since.
+    KvsClient(const std::vector<std::string> &addresses);
+
+    ~KvsClient();
+
+    /// payload is the causal payload from the client's last reply, or empty for none.
+    Reply get(const std::string &key, const std::string &payload = "");
+    Reply put(const std::string &key, const std::string &value, const std::string &payload = "");
+    Reply del(const std::string &key, const std::string &payload = "");
+
+    /// Returns the version of the cached scheme, or -1 if no node has answered yet.
+    int schemeVersion() const;
+
+private:
+    /// Sends the request to a node that owns the key, following redirects.
+    Reply send(Pistache::Http::Method method, const std::string &key, const std::string &body);
+
+    /// Sends the request to the node and waits for its answer. Returns nothing if there was none.
+    std::optional<Pistache::Http::Response> sendTo(const std::string &address,
+                                                   Pistache::Http::Method method,
+                                                   const std::string &resource,
+                                                   const std::string &body);
+
+    /// Fetches the scheme from the first node that answers, trying preferred first, and keeps it
+    /// if it is newer than the cached one.
+    void refreshScheme(const std::string &preferred = "");
+
+    /// Returns the members of the shard that owns the (encoded) key under the cached scheme, or
+    /// every known address if there is no scheme yet.
+    std::vector<std::string> ownersOf(const std::string &key) const;
+
+    Pistache::Http::Client mClient;
+
+    /// Protects mAddresses and mScheme.
+    mutable std::mutex mMut;
+    std::vector<std::string> mAddresses;
+    std::optional<ShardScheme> mScheme;
+};
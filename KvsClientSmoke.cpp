@@ -0,0 +1,94 @@
+// Smoke test of KvsClient against running nodes: puts, gets and deletes a few keys, including ones
+// that need encoding in the URL, and checks each answer.
+//
+// Built and run by ./build.sh clientsmoke; arguments are the addresses (IP:port) of nodes, by
+// default the one ./build.sh main starts.
+
+#include "KvsClient.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace Pistache;
+using namespace std;
+
+namespace
+{
+const char *DEFAULT_ADDRESS = "localhost:8083";
+
+// Returns the causal payload of a reply, to pass with the next request.
+string
+payloadOf(const KvsClient::Reply &reply)
+{
+    const string field = "\"payload\":\"";
+
+    size_t start = reply.body.find(field);
+    if (start == string::npos)
+        return "";
+
+    start += field.size();
+    return reply.body.substr(start, reply.body.find('"', start) - start);
+}
+
+bool
+check(const char *what, const string &key, const KvsClient::Reply &reply,
+      const vector<Http::Code> &expected)
+{
+    for (Http::Code code : expected) {
+        if (reply.code == code)
+            return true;
+    }
+
+    printf("FAIL %s of \"%s\": code %d, body %s\n", what, key.c_str(), (int)reply.code,
+           reply.body.c_str());
+    return false;
+}
+} // namespace
+
+int
+main(int argc, char **argv)
+{
+    vector<string> addresses(argv + 1, argv + argc);
+    if (addresses.empty())
+        addresses.push_back(DEFAULT_ADDRESS);
+
+    KvsClient client(addresses);
+    if (client.schemeVersion() < 0) {
+        printf("FAIL no node answered\n");
+        return 1;
+    }
+
+    const vector<string> keys = {"smoke", "smoke key", "smoke/key?a=b&c", "smoke%2Fkey+"};
+
+    bool passed = true;
+    string payload;
+
+    for (const string &key : keys) {
+        const string value = "value of " + key;
+
+        KvsClient::Reply reply = client.put(key, value, payload);
+        passed &= check("put", key, reply,
+                        {Http::Code::Ok, Http::Code::Created, Http::Code::Accepted});
+        payload = payloadOf(reply);
+
+        reply = client.get(key, payload);
+        passed &= check("get", key, reply, {Http::Code::Ok});
+        if (reply.code == Http::Code::Ok && reply.body.find(value) == string::npos) {
+            printf("FAIL get of \"%s\": body %s\n", key.c_str(), reply.body.c_str());
+            passed = false;
+        }
+        payload = payloadOf(reply);
+
+        reply = client.del(key, payload);
+        passed &= check("delete", key, reply, {Http::Code::Ok, Http::Code::Accepted});
+        payload = payloadOf(reply);
+
+        reply = client.get(key, payload);
+        passed &= check("get after delete", key, reply, {Http::Code::Not_Found});
+        payload = payloadOf(reply);
+    }
+
+    printf("%s, scheme version %d\n", passed ? "PASS" : "FAIL", client.schemeVersion());
+    return passed ? 0 : 1;
+}
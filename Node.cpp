@@ -1,10 +1,13 @@
 #include "Node.h"
 
 #include "ExtraUtils.h"
+#include "InterServer.h"
 #include "ParsingHelpers.h"
 #include "ShardSchemeUtility.h"
 
+#include <algorithm>
 #include <chrono>
+#include <ctime>
 #include <pistache/async.h>
 #include <set>
 #include <thread>
@@ -14,90 +17,182 @@
 #define SYNC_PERIOD 150
 // small time period to mix things up (maybe prevents a live lock one day?)
 #define SYNC_SALT 7
+// a sync carries the whole store, so it gets a fixed timeout instead of the adaptive one
+#define SYNC_TIMEOUT 5000
+// how long a write waits for the replicas its write mode requires, in milliseconds
+#define REPLICATION_TIMEOUT 1000
+// how long a replication batch that failed is resent before it is left to the sync thread, in
+// milliseconds
+#define REPLICATION_RETRY_PERIOD 5000
+// most replication batches being resent at once, over all nodes. They have a scheduler of their
+// own, so they never hold up scheme changes and moves
+#define REPLICATION_RETRY_IN_FLIGHT 64
+// time between read repair batches in milliseconds
+#define READ_REPAIR_PERIOD 50
+// most repairs sent per batch, over all nodes. Limits repair traffic to
+// READ_REPAIR_BATCH * 1000 / READ_REPAIR_PERIOD keys per second.
+#define READ_REPAIR_BATCH 256
+// repairs past this many are dropped; the sync thread will get to them eventually
+#define READ_REPAIR_MAX_QUEUED 100000
+// buckets of the local store a reshard copies per lock of mLocalDataMut
+#define RESHARD_COPY_BUCKETS 1024
+// a reshard replays writes made during its copy until fewer than this many are left, then switches
+#define RESHARD_SWITCH_DELTA 256
+// most replay rounds before a reshard switches anyway
+#define RESHARD_MAX_DELTA_ROUNDS 8
+// keys and bytes per reshard batch, and batches waiting to be acknowledged per target shard
+#define RESHARD_BATCH_KEYS 1024
+#define RESHARD_BATCH_BYTES (1 << 20)
+#define RESHARD_BATCHES_IN_FLIGHT 4
+// how long after a switch reads fall back to a key's previous owner, and the previous owner keeps
+// the keys it handed off, in milliseconds
+#define HANDOFF_GRACE_PERIOD 30000
+// number of threads that resume the requests parked until a scheme switch
+#define SCHEME_RESUME_THREADS 4
+// how long the grace period waits for the keys handed off to land, in milliseconds; keys that
+// haven't landed by then are kept until the next prepare sends them again
+#define HANDOFF_LAND_TIMEOUT 60000
 #define N_RETURN(type, value) return Node::ClientOpReturnValue<type>(value, mNodeClock)
 
 using namespace std;
 
 namespace
 {
-bool
-parsePrepareSuccess(Pistache::Http::Response response)
+/// CPU time used by the calling thread.
+chrono::nanoseconds
+threadCpuTime()
 {
-    if (response.code() == Pistache::Http::Code::Ok)
-        return true;
-    else
-        return false;
-}
-
-bool
-parseSwitchSuccess(Pistache::Http::Response response)
-{
-    if (response.code() == Pistache::Http::Code::Ok)
-        return true;
-    else
-        return false;
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return chrono::seconds(time.tv_sec) + chrono::nanoseconds(time.tv_nsec);
 }
-
 } // namespace
 
-Node::Node(shared_ptr<View> view)
+Node::Node(shared_ptr<View> view, shared_ptr<PeerTransport> transport, WriteMode defaultWriteMode,
+           size_t migrationBytesPerSecond, int migrationCpuPercent)
     : mView(view)
+    , mTransport(transport)
     , mViewsReadSema(1)
     , mReshardSwitchingSema(1)
     , mPreparedView(nullptr)
     , mPreparedDatastore(nullptr)
+    , mDefaultWriteMode(defaultWriteMode)
+    , mMigrationBytesPerSecond(migrationBytesPerSecond)
+    , mMigrationCpuPercent(min(max(migrationCpuPercent, 1), 100))
+    , mWriteReplicator(
+          [this](const string &address, const DataStore &batch, function<void(bool)> done) {
+              InterServer::pushData(*mTransport, address, batch, done);
+          },
+          [this](const string &address, shared_ptr<const DataStore> batch,
+                 function<void(bool)> done) {
+              // Not while the peer is known to be down; the sync thread gets the writes there.
+              if (mTransport->peerBreakers()->isOpen(address)) {
+                  done(false);
+                  return;
+              }
+
+              // Whichever comes first, the batch getting through or the retry period ending,
+              // calls done().
+              auto settled = make_shared<atomic<bool>>(false);
+              auto attempt = [this, batch, done, settled](const string &address,
+                                                          function<void(bool)> attemptDone) {
+                  InterServer::pushData(*mTransport, address, *batch,
+                                        [done, settled, attemptDone](bool success) {
+                                            if (success && !settled->exchange(true))
+                                                done(true);
+                                            attemptDone(success);
+                                        });
+              };
+
+              AtomicBoolPtr shouldStop = make_shared<atomic<bool>>(false);
+              mReplicationRetryScheduler.runAfter(chrono::milliseconds(REPLICATION_RETRY_PERIOD),
+                                                  [shouldStop, done, settled]() {
+                                                      *shouldStop = true;
+                                                      if (!settled->exchange(true))
+                                                          done(false);
+                                                  });
+              mReplicationRetryScheduler.submit({address}, attempt, shouldStop);
+          })
+    , mRetryScheduler(
+          [this](const string &address) { return mTransport->peerBreakers()->isOpen(address); })
+    , mReplicationRetryScheduler(
+          [this](const string &address) { return mTransport->peerBreakers()->isOpen(address); }, 1,
+          REPLICATION_RETRY_IN_FLIGHT)
 {
     thread(&Node::syncThread, this).detach();
+    thread(&Node::readRepairThread, this).detach();
+    for (int i = 0; i < SCHEME_RESUME_THREADS; ++i)
+        thread(&Node::resumeThread, this).detach();
 }
 
 Node::ClientOpReturnValue<Node::PutSuccessType>
-Node::putElement(const string &key, const string &value, const VectorClock &payload)
+Node::putElement(const string &key, const string &value, const VectorClock &payload,
+                 optional<WriteMode> writeMode)
 {
-    // Prevent mView and mPreparedView from changing during this method.
-    mViewsReadChangeMut.lock();
-    SemaphoreDecrementGuard semaGuard(mViewsReadSema);
-    mViewsReadChangeMut.unlock();
+    PutSuccessType pst = PutSuccessType::CreatedNewValue;
+    VectorClock clock;
+    WriteReplicator::AckPtr ack;
 
-    lock_guard<mutex> lk(mClientOperationMut);
+    {
+        // Prevent mView and mPreparedView from changing during this block.
+        mViewsReadChangeMut.lock();
+        SemaphoreDecrementGuard semaGuard(mViewsReadSema);
+        mViewsReadChangeMut.unlock();
 
-    if (key.empty())
-        N_RETURN(PutSuccessType, PutSuccessType::KeyNotValid);
+        lock_guard<mutex> lk(mClientOperationMut);
 
-    lock_guard<mutex> lkd(mLocalDataMut);
+        if (key.empty())
+            N_RETURN(PutSuccessType, PutSuccessType::KeyNotValid);
 
-    mergeAndIncrementClock(payload);
+        lock_guard<mutex> lkd(mLocalDataMut);
 
-    PutSuccessType pst = PutSuccessType::CreatedNewValue;
-    auto it = mLocalData.find(key);
-    if (it != mLocalData.end() && !it->second.value.empty())
-        pst = PutSuccessType::UpdatedExistingValue;
+        mergeAndIncrementClock(payload);
+
+        auto it = mLocalData.find(key);
+        if (it != mLocalData.end() && !it->second.value.empty())
+            pst = PutSuccessType::UpdatedExistingValue;
+
+        DataVersion version(value, mNodeClock);
+        writeLocalData(key, version);
+
+        clock = mNodeClock;
+        ack = replicateWrite(key, version, writeMode);
+    }
 
-    insertOrReplace(mLocalData, key, DataVersion(value, mNodeClock));
+    ClientOpReturnValue<PutSuccessType> result(pst, clock);
 
-    N_RETURN(PutSuccessType, pst);
+    // Other client operations can go ahead while we wait for the replicas. The value is written
+    // here either way, so the client isn't told the write failed.
+    if (!ack->wait(chrono::milliseconds(REPLICATION_TIMEOUT))) {
+        ++mMetrics.writeQuorumTimeouts;
+        result.unconfirmed = true;
+    }
+
+    return result;
 }
 
 Node::ClientOpReturnValue<optional<string>>
 Node::getElement(const string &key, const VectorClock &payload)
 {
-    // 1000 ms timeout on interactions with other nodes
-    const chrono::milliseconds TIMEOUT = 1000ms;
-
     // Prevent mView and mPreparedView from changing during this method.
     mViewsReadChangeMut.lock();
     SemaphoreDecrementGuard semaGuard(mViewsReadSema);
     mViewsReadChangeMut.unlock();
 
-    lock_guard<mutex> lk(mClientOperationMut);
+    unique_lock<mutex> lk(mClientOperationMut);
 
     mergeAndIncrementClock(payload);
 
     vector<DataVersion> versions;
 
+    // Clock of this node's version, if it has one. Used to decide whether it needs a repair.
+    optional<VectorClock> localClock;
+
     mLocalDataMut.lock();
     auto myIt = mLocalData.find(key);
     if (myIt != mLocalData.end()) {
         versions.push_back(myIt->second);
+        localClock = myIt->second.clock;
         mLocalDataMut.unlock();
 
         VectorClock::CompareValue cv = payload.compare(versions.back().clock);
@@ -111,94 +206,83 @@ Node::getElement(const string &key, const VectorClock &payload)
         mLocalDataMut.unlock();
     }
 
-    // collecting other versions
-    // TODO right now we don't check shardScheme version. This should be fine, as direct get doesn't
-    // care about version. So if we are outdated, the returned value might be a little off, but I'll
-    // at least still give a valid data version (though possibly not causaly consistent)
-    // To save this, maybe we assume the shard version is correct  (it would be confirmed prior to
-    // calling this function)
-    const set<string> &myShard = mView->getAddressesInShard();
-
-    if (!myShard.empty()) {
-        const string &me = mView->getAddress();
-        unordered_map<string, int> nodeIndex;
-        int i = 0;
-        for (const string &s : myShard) {
-            if (s == me)
-                continue;
-            nodeIndex[s] = i++;
-        }
-
-        if (!nodeIndex.empty()) {
-            // Helps protect against segfaults.
-            shared_ptr<bool> guard = make_shared<bool>();
-
-            string responseRawText[nodeIndex.size()];
-
-            vector<Pistache::Async::Promise<Pistache::Http::Response>> responses;
-            for (auto it = nodeIndex.begin(); it != nodeIndex.end(); ++it) {
+    // Other client operations may run while we wait on the other nodes.
+    lk.unlock();
 
-                // Protects against segfaults.
-                weak_ptr<bool> guard_weakptr(guard);
+    // Right after a switch, a key this node doesn't have may still be on its way here.
+    if (!localClock) {
+        if (optional<DataVersion> handedOff = fetchFromPreviousOwner(key)) {
+            versions.push_back(*handedOff);
+            localClock = handedOff->clock;
 
-                int idx = it->second;
+            if (payload.compare(handedOff->clock) != VectorClock::GreaterThan) {
+                lk.lock();
+                if (handedOff->value.empty())
+                    N_RETURN(optional<string>, optional<string>());
+                N_RETURN(optional<string>, optional<string>(handedOff->value));
+            }
+        }
+    }
 
-                auto rsp = mView->sendMsg(it->first, "dataStore/" + key, "");
-                rsp.then(
-                    [guard_weakptr, idx, &responseRawText](Pistache::Http::Response r) {
-                        // Avoid accessing invalid memory. If the guard has expired,
-                        // that means we are out of scope. TODO: This is just a quickfix
-                        // to the issue mentioned below at barrier.wait_for().
-                        if (guard_weakptr.expired())
-                            return;
+    // If another read of this key is already asking the other nodes, and its payload covers ours,
+    // wait for its answer instead of asking again.
+    ReadFanOutPtr fanOut;
+    bool startedFanOut = false;
+    {
+        lock_guard<mutex> inFlightLock(mInFlightReadsMut);
+
+        auto flightIt = mInFlightReads.find(key);
+        if (flightIt != mInFlightReads.end() &&
+            VectorClock::covers(flightIt->second->payload, payload)) {
+            fanOut = flightIt->second;
+            ++mMetrics.coalescedReads;
+        } else {
+            // Replaces an older fan-out that didn't cover us; later readers will most likely be
+            // covered by this one.
+            fanOut = make_shared<ReadFanOut>(payload);
+            insertOrReplace(mInFlightReads, key, fanOut);
+            startedFanOut = true;
+        }
+    }
 
-                        // we collect the raw bodies
-                        responseRawText[idx] = r.body();
-                    },
-                    Pistache::Async::IgnoreException);
+    if (startedFanOut) {
+        ++mMetrics.fanOutReads;
+        fanOutRead(key, *fanOut);
 
-                responses.push_back(move(rsp));
-            }
+        {
+            lock_guard<mutex> inFlightLock(mInFlightReadsMut);
+            auto flightIt = mInFlightReads.find(key);
+            if (flightIt != mInFlightReads.end() && flightIt->second == fanOut)
+                mInFlightReads.erase(flightIt);
+        }
 
-            // TODO could start processing right away, maybe using condition
-            // Variables
-            auto sync = Pistache::Async::whenAll(responses.begin(), responses.end());
-            Pistache::Async::Barrier<vector<Pistache::Http::Response>> barrier(sync);
+        lock_guard<mutex> fanOutLock(fanOut->mut);
+        fanOut->done = true;
+        fanOut->cv.notify_all();
+    } else {
+        unique_lock<mutex> fanOutLock(fanOut->mut);
+        while (!fanOut->done)
+            fanOut->cv.wait(fanOutLock);
+    }
 
-            bool gotTimeout = false;
-            {
-                // TODO: The issue with this approach is that the message-sends that were
-                // started earlier are not killed. This is a memory leak, and also if
-                // code in those lambdas ever runs this could be a segfault.
-                cv_status result = barrier.wait_for(TIMEOUT);
-                if (result == cv_status::timeout)
-                    gotTimeout = true;
-            }
+    // The fan-out is done, so its fields no longer change.
+    if (fanOut->newSchemeVersion != -1)
+        return ClientOpReturnValue<optional<string>>(fanOut->newSchemeVersion);
 
-            // Have all responses, unless some messages failed to get through
+    versions.insert(versions.end(), fanOut->versions.begin(), fanOut->versions.end());
 
-            for (int i = 0; i < nodeIndex.size(); ++i) {
-                // We parse the raw text to get a data-version
-                if (!responseRawText[i].empty()) {
-                    auto _ver = stringTodataVersionAndSchemeVersion(responseRawText[i]);
-                    if (_ver.second > mView->scheme().version())
-                        return ClientOpReturnValue<optional<string>>(_ver.second);
-                    versions.push_back(_ver.first);
-                }
-            }
+    // If we didn't find a causally consistent version of the data and at least one node
+    // didn't respond, it's possible that that node has a causally consistent version.
+    // Therefore we must fail out.
+    if (fanOut->gotTimeout)
+        return {}; // Bad_Request
 
-            // If we didn't find a causally consistent version of the data and at least one node
-            // didn't respond, it's possible that that node has a causally consistent version.
-            // Therefore we must fail out.
-            if (gotTimeout)
-                return {}; // Bad_Request
-        }
-    }
+    lk.lock();
 
     if (versions.empty())
         N_RETURN(optional<string>, optional<string>());
 
-    DataVersion &max = versions[0];
+    DataVersion max = versions[0];
     mergeClock(max.clock);
     for (int i = 1; i < versions.size(); ++i) {
         mergeClock(versions[i].clock);
@@ -206,15 +290,106 @@ Node::getElement(const string &key, const VectorClock &payload)
             max = versions[i];
     }
 
-    mLocalDataMut.lock();
-    insertOrReplace(mLocalData, key, max);
-    mLocalDataMut.unlock();
+    // Push the winner to every node (including this one) that had an older version. Only the
+    // read that started the fan-out does this, so coalesced reads don't queue duplicates.
+    if (startedFanOut) {
+        vector<string> staleNodes;
+
+        if (!localClock || localClock->compare(max.clock) != VectorClock::Equal)
+            staleNodes.push_back(mView->getAddress());
+
+        for (const auto &nodeVersion : fanOut->nodeVersions) {
+            if (!nodeVersion.second ||
+                nodeVersion.second->clock.compare(max.clock) != VectorClock::Equal)
+                staleNodes.push_back(nodeVersion.first);
+        }
+
+        queueReadRepair(key, max, staleNodes);
+    }
 
     if (max.value.empty())
         N_RETURN(optional<string>, optional<string>());
     N_RETURN(optional<string>, optional<string>(max.value));
 }
 
+void
+Node::fanOutRead(const string &key, ReadFanOut &fanOut)
+{
+    // TODO right now we don't check shardScheme version. This should be fine, as direct get doesn't
+    // care about version. So if we are outdated, the returned value might be a little off, but I'll
+    // at least still give a valid data version (though possibly not causaly consistent)
+    // To save this, maybe we assume the shard version is correct  (it would be confirmed prior to
+    // calling this function)
+    const set<string> &myShard = mView->getAddressesInShard();
+
+    vector<string> others;
+    for (const string &s : myShard) {
+        if (s != mView->getAddress())
+            others.push_back(s);
+    }
+
+    if (others.empty())
+        return;
+
+    // The replica expected to answer first gets its message first.
+    others = mTransport->replicaSelector()->order(move(others));
+
+    // Shared with the response callbacks, which can run after this function has returned.
+    struct Responses
+    {
+        mutex mut;
+        condition_variable cv;
+        size_t pending;
+
+        /// Reply from each node, or nothing if it hasn't answered (or failed).
+        vector<optional<InterServer::DataReply>> replies;
+    };
+    shared_ptr<Responses> responses = make_shared<Responses>();
+    responses->pending = others.size();
+    responses->replies.resize(others.size());
+
+    // Every message has its own adaptive timeout; waiting for the longest one is just a backstop.
+    chrono::milliseconds timeout = chrono::milliseconds::zero();
+
+    for (size_t idx = 0; idx < others.size(); ++idx) {
+        timeout = max(timeout, mTransport->peerLatencies()->timeoutFor(others[idx]));
+
+        // Nodes whose breaker is open fail right away and count as having no version.
+        InterServer::getData(*mTransport, others[idx], key,
+                             [responses, idx](optional<InterServer::DataReply> reply) {
+                                 lock_guard<mutex> lk(responses->mut);
+                                 responses->replies[idx] = move(reply);
+                                 --responses->pending;
+                                 responses->cv.notify_all();
+                             });
+    }
+
+    vector<optional<InterServer::DataReply>> replies;
+    {
+        unique_lock<mutex> lk(responses->mut);
+        if (!responses->cv.wait_for(lk, timeout, [&]() { return responses->pending == 0; }))
+            fanOut.gotTimeout = true;
+
+        replies = responses->replies;
+    }
+
+    // Have all responses, unless some messages failed to get through
+
+    for (size_t idx = 0; idx < others.size(); ++idx) {
+        if (!replies[idx])
+            continue;
+
+        if (replies[idx]->schemeVersion > mView->scheme().version()) {
+            fanOut.newSchemeVersion = replies[idx]->schemeVersion;
+            return;
+        }
+
+        if (replies[idx]->version)
+            fanOut.versions.push_back(*replies[idx]->version);
+        fanOut.nodeVersions.emplace_back(others[idx], replies[idx]->version);
+    }
+}
+
 Node::ClientOpReturnValue<bool>
 Node::hasElement(const string &key, const VectorClock &payload)
 {
@@ -223,6 +398,8 @@ Node::hasElement(const string &key, const VectorClock &payload)
     SemaphoreDecrementGuard semaGuard(mViewsReadSema);
     mViewsReadChangeMut.unlock();
 
+    fetchIfHandedOff(key);
+
     lock_guard<mutex> lk(mClientOperationMut);
     lock_guard<mutex> lkd(mLocalDataMut);
 
@@ -233,25 +410,149 @@ Node::hasElement(const string &key, const VectorClock &payload)
 }
 
 Node::ClientOpReturnValue<bool>
-Node::delElement(const string &key, const VectorClock &payload)
+Node::delElement(const string &key, const VectorClock &payload, optional<WriteMode> writeMode)
 {
-    // Prevent mView and mPreparedView from changing during this method.
-    mViewsReadChangeMut.lock();
-    SemaphoreDecrementGuard semaGuard(mViewsReadSema);
-    mViewsReadChangeMut.unlock();
+    VectorClock clock;
+    WriteReplicator::AckPtr ack;
 
-    lock_guard<mutex> lk(mClientOperationMut);
-    lock_guard<mutex> lkd(mLocalDataMut);
+    {
+        // Prevent mView and mPreparedView from changing during this block.
+        mViewsReadChangeMut.lock();
+        SemaphoreDecrementGuard semaGuard(mViewsReadSema);
+        mViewsReadChangeMut.unlock();
 
-    mergeAndIncrementClock(payload);
+        // A key that hasn't landed yet would come back when it does.
+        fetchIfHandedOff(key);
 
-    auto it = mLocalData.find(key);
-    if (it == mLocalData.end() || it->second.value.empty())
-        N_RETURN(bool, false);
+        lock_guard<mutex> lk(mClientOperationMut);
+        lock_guard<mutex> lkd(mLocalDataMut);
+
+        mergeAndIncrementClock(payload);
+
+        auto it = mLocalData.find(key);
+        if (it == mLocalData.end() || it->second.value.empty())
+            N_RETURN(bool, false);
+
+        // A tombstone, which a running reshard copy has to hand on like any other write.
+        DataVersion tombstone("", mNodeClock);
+        writeLocalData(key, tombstone);
+
+        clock = mNodeClock;
+        ack = replicateWrite(key, tombstone, writeMode);
+    }
+
+    ClientOpReturnValue<bool> result(true, clock);
+    if (!ack->wait(chrono::milliseconds(REPLICATION_TIMEOUT))) {
+        ++mMetrics.writeQuorumTimeouts;
+        result.unconfirmed = true;
+    }
+
+    return result;
+}
+
+Node::ClientOpReturnValue<vector<Node::PutSuccessType>>
+Node::putElements(const vector<pair<string, string>> &entries, const VectorClock &payload,
+                  optional<WriteMode> writeMode)
+{
+    vector<PutSuccessType> results;
+    results.reserve(entries.size());
+    VectorClock clock;
+    vector<WriteReplicator::AckPtr> acks;
+
+    {
+        // Prevent mView and mPreparedView from changing during this block.
+        mViewsReadChangeMut.lock();
+        SemaphoreDecrementGuard semaGuard(mViewsReadSema);
+        mViewsReadChangeMut.unlock();
+
+        lock_guard<mutex> lk(mClientOperationMut);
+        lock_guard<mutex> lkd(mLocalDataMut);
+
+        mergeAndIncrementClock(payload);
+
+        // Every key gets the same clock; they are different keys, so the versions never meet.
+        for (const auto &entry : entries) {
+            if (entry.first.empty()) {
+                results.push_back(PutSuccessType::KeyNotValid);
+                continue;
+            }
+
+            auto it = mLocalData.find(entry.first);
+            if (it != mLocalData.end() && !it->second.value.empty())
+                results.push_back(PutSuccessType::UpdatedExistingValue);
+            else
+                results.push_back(PutSuccessType::CreatedNewValue);
+
+            DataVersion version(entry.second, mNodeClock);
+            writeLocalData(entry.first, version);
+            acks.push_back(replicateWrite(entry.first, version, writeMode));
+        }
+
+        clock = mNodeClock;
+    }
+
+    // The replicator sends the writes in a few large messages, so they are waited for together.
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(REPLICATION_TIMEOUT);
+    for (const WriteReplicator::AckPtr &ack : acks) {
+        auto left = chrono::duration_cast<chrono::milliseconds>(deadline -
+                                                                chrono::steady_clock::now());
+        if (!ack->wait(max(left, chrono::milliseconds::zero()))) {
+            ++mMetrics.writeQuorumTimeouts;
+
+            // The keys are written here either way, so the client isn't told the batch failed.
+            ClientOpReturnValue<vector<PutSuccessType>> unconfirmed(results, clock);
+            unconfirmed.unconfirmed = true;
+            return unconfirmed;
+        }
+    }
+
+    return ClientOpReturnValue<vector<PutSuccessType>>(results, clock);
+}
+
+Node::ClientOpReturnValue<vector<optional<string>>>
+Node::getElements(const vector<string> &keys, const VectorClock &payload)
+{
+    vector<optional<string>> values(keys.size());
+
+    // Indexes of the keys this node can't answer by itself.
+    vector<size_t> fanOuts;
+
+    {
+        // Prevent mView and mPreparedView from changing during this block.
+        mViewsReadChangeMut.lock();
+        SemaphoreDecrementGuard semaGuard(mViewsReadSema);
+        mViewsReadChangeMut.unlock();
+
+        lock_guard<mutex> lk(mClientOperationMut);
+        lock_guard<mutex> lkd(mLocalDataMut);
+
+        mergeAndIncrementClock(payload);
+
+        for (size_t idx = 0; idx < keys.size(); ++idx) {
+            auto it = mLocalData.find(keys[idx]);
+            if (it == mLocalData.end() ||
+                payload.compare(it->second.clock) == VectorClock::GreaterThan) {
+                fanOuts.push_back(idx);
+                continue;
+            }
+
+            if (!it->second.value.empty())
+                values[idx] = it->second.value;
+        }
+    }
 
-    it->second = DataVersion("", mNodeClock);
+    for (size_t idx : fanOuts) {
+        auto getResult = getElement(keys[idx], payload);
+        if (getResult.isBadRequest())
+            return {};
+        if (getResult.hasWrongSchemeVersion())
+            return ClientOpReturnValue<vector<optional<string>>>(getResult.newSchemeVersion);
 
-    N_RETURN(bool, true);
+        values[idx] = move(getResult.value);
+    }
+
+    lock_guard<mutex> lk(mClientOperationMut);
+    N_RETURN(vector<optional<string>>, values);
 }
 
 size_t
@@ -267,46 +568,160 @@ Node::count()
     return cnt;
 }
 
-bool
+Node::ViewChange
 Node::addNode(const string &ipPort)
+{
+    return changeView({ipPort}, {});
+}
+
+Node::ViewChange
+Node::delNode(const string &ipPort)
+{
+    return changeView({}, {ipPort});
+}
+
+Node::ViewChange
+Node::changeView(const vector<string> &added, const vector<string> &removed)
 {
     lock_guard<mutex> lk(mClientOperationMut);
 
-    if (mView->hasAddress(ipPort))
-        return false;
+    set<string> changed;
+    for (const string &ipPort : added) {
+        if (mView->hasAddress(ipPort) || !changed.insert(ipPort).second)
+            return ViewChange::Invalid;
+    }
+    for (const string &ipPort : removed) {
+        if (!mView->hasAddress(ipPort) || !changed.insert(ipPort).second)
+            return ViewChange::Invalid;
+    }
 
-    ShardScheme newScheme = ShardSchemeUtility::addNodeToScheme(mView->scheme(), ipPort);
-    updateShardScheme(newScheme);
+    if (changed.empty())
+        return ViewChange::Invalid;
 
-    return true;
+    ShardScheme newScheme = ShardSchemeUtility::changeMembership(mView->scheme(), added, removed);
+
+    // changeMembership() keeps the shards within one node of each other, so this also means no
+    // shard is left empty. Checked on the result anyway, since a shard without nodes can't be
+    // routed to.
+    if (newScheme.getNumShards() * 2 > newScheme.getNumNodes())
+        return ViewChange::TooFewNodes;
+    for (size_t shardId = 0; shardId < newScheme.getNumShards(); ++shardId) {
+        if (newScheme.getShardInfo(shardId).getNumNodes() == 0)
+            return ViewChange::TooFewNodes;
+    }
+
+    return updateShardScheme(newScheme) ? ViewChange::Done : ViewChange::Superseded;
 }
 
-bool
-Node::delNode(const string &ipPort)
+optional<Node::ReshardPlan>
+Node::planReshard(size_t numShards)
 {
-    lock_guard<mutex> lk(mClientOperationMut);
+    // Give up on a shard that doesn't answer after this long.
+    const chrono::milliseconds PLAN_TIMEOUT = 5s;
 
-    if (!mView->hasAddress(ipPort))
-        return false;
+    shared_ptr<View> view = mView;
+    const ShardScheme &oldScheme = view->scheme();
+    if (numShards == 0 || numShards * 2 > oldScheme.getNumNodes())
+        return {};
 
-    ShardScheme newScheme = ShardSchemeUtility::delNodeFromScheme(mView->scheme(), ipPort);
-    updateShardScheme(newScheme);
+    auto newScheme = make_shared<const ShardScheme>(
+        ShardSchemeUtility::createNewShardScheme(oldScheme, numShards));
 
-    return true;
+    ReshardPlan plan;
+    plan.schemeVersion = newScheme->version();
+    plan.loads.resize(oldScheme.getNumShards());
+
+    // Shared with the callbacks, which can run after this function has returned.
+    struct Answers
+    {
+        mutex mut;
+        condition_variable cv;
+        size_t pending = 0;
+        vector<vector<InterServer::ShardLoad>> loads;
+    };
+    shared_ptr<Answers> answers = make_shared<Answers>();
+    answers->loads.resize(oldScheme.getNumShards());
+    AtomicBoolPtr shouldStop = make_shared<atomic<bool>>(false);
+
+    for (size_t from = 0; from < oldScheme.getNumShards(); ++from) {
+        if (view->getShardId() == from) {
+            answers->loads[from] = loadByShard(*newScheme);
+            continue;
+        }
+
+        ++answers->pending;
+        shared_ptr<PeerTransport> transport = mTransport;
+        auto attempt = [transport, newScheme, answers, from](const string &address,
+                                                             function<void(bool)> done) {
+            InterServer::planScheme(
+                *transport, address, *newScheme,
+                [answers, from, done](optional<vector<InterServer::ShardLoad>> loads) {
+                    if (loads) {
+                        lock_guard<mutex> lk(answers->mut);
+                        answers->loads[from] = move(*loads);
+                        --answers->pending;
+                        answers->cv.notify_all();
+                    }
+                    done(loads.has_value());
+                });
+        };
+
+        sendToRandomNodeUntilSuccess(oldScheme.getShardInfo(from).getNodeSet(), attempt,
+                                     shouldStop);
+    }
+
+    {
+        unique_lock<mutex> lk(answers->mut);
+        answers->cv.wait_for(lk, PLAN_TIMEOUT, [&]() { return answers->pending == 0; });
+        *shouldStop = true;
+        plan.loads = answers->loads;
+    }
+
+    uint64_t measured = mMetrics.migrationBytesPerSec;
+    if (measured != 0 && mMigrationBytesPerSecond != 0)
+        plan.bytesPerSecond = min(measured, (uint64_t)mMigrationBytesPerSecond);
+    else if (measured != 0 || mMigrationBytesPerSecond != 0)
+        plan.bytesPerSecond = max(measured, (uint64_t)mMigrationBytesPerSecond);
+
+    uint64_t mostBytesSent = 0;
+    bool everyShardAnswered = true;
+    plan.moved.resize(oldScheme.getNumShards());
+
+    for (size_t from = 0; from < oldScheme.getNumShards(); ++from) {
+        const set<string> &fromNodes = oldScheme.getShardInfo(from).getNodeSet();
+        uint64_t bytesSent = 0;
+
+        for (size_t to = 0; to < newScheme->getNumShards(); ++to) {
+            const set<string> &toNodes = newScheme->getShardInfo(to).getNodeSet();
+            bool moved = !includes(toNodes.begin(), toNodes.end(), fromNodes.begin(),
+                                   fromNodes.end());
+            plan.moved[from].push_back(moved);
+
+            if (moved && to < plan.loads[from].size())
+                bytesSent += plan.loads[from][to].numBytes;
+        }
+
+        if (plan.loads[from].empty())
+            everyShardAnswered = false;
+        mostBytesSent = max(mostBytesSent, bytesSent);
+    }
+
+    if (plan.bytesPerSecond > 0 && everyShardAnswered)
+        plan.etaSeconds = mostBytesSent / plan.bytesPerSecond;
+
+    return plan;
 }
 
-bool
+Node::ViewChange
 Node::reshard(size_t numShards)
 {
     lock_guard<mutex> lk(mClientOperationMut);
 
     if (numShards * 2 > mView->scheme().getNumNodes())
-        return false;
+        return ViewChange::TooFewNodes;
 
     ShardScheme newScheme = ShardSchemeUtility::createNewShardScheme(mView->scheme(), numShards);
-    updateShardScheme(newScheme);
-
-    return true;
+    return updateShardScheme(newScheme) ? ViewChange::Done : ViewChange::Superseded;
 }
 
 optional<std::pair<Node::DataVersion, int>>
@@ -316,61 +731,260 @@ Node::directGet(const string &key)
     auto it = mLocalData.find(key);
     if (it != mLocalData.end())
         return make_pair(it->second, mView->scheme().version());
+
+    // The new owner may ask for a key this node handed off before it has landed there.
+    it = mHandedOffData.find(key);
+    if (it != mHandedOffData.end())
+        return make_pair(it->second, mView->scheme().version());
     return {};
 }
 
 bool
 Node::syncData(const string &data)
+{
+    return syncData(dataStringToMap(data));
+}
+
+bool
+Node::syncData(const DataStore &data)
 {
     mLocalDataMut.lock();
-    unordered_map<string, DataVersion> map = dataStringToMap(data);
+    mergeIntoLocalData(data);
+    mLocalDataMut.unlock();
+    return true;
+}
 
-    for (auto it = map.begin(); it != map.end(); ++it) {
+void
+Node::mergeIntoLocalData(const DataStore &data)
+{
+    for (auto it = data.begin(); it != data.end(); ++it) {
         auto myVal = mLocalData.find(it->first);
         if (myVal == mLocalData.end() ||
             !VectorClock::isMax(myVal->second.clock, it->second.clock)) {
-            insertOrReplace(mLocalData, it->first, it->second);
+            writeLocalData(it->first, it->second);
         }
     }
-    mLocalDataMut.unlock();
+}
+
+void
+Node::mergeIntoPreparedDatastore(const string &key, const DataVersion &version)
+{
+    // A batch that is retried, or that a stale replica sent, may be older than what is there.
+    auto it = mPreparedDatastore->find(key);
+    if (it == mPreparedDatastore->end())
+        mPreparedDatastore->emplace(key, version);
+    else if (!VectorClock::isMax(it->second.clock, version.clock))
+        it->second = version;
+}
+
+void
+Node::writeLocalData(const string &key, const DataVersion &version)
+{
+    insertOrReplace(mLocalData, key, version);
+
+    if (mMigrationDelta)
+        insertOrReplace(*mMigrationDelta, key, version);
+}
+
+shared_ptr<const ShardInfo>
+Node::keyOwnersElsewhere(const string &key) const
+{
+    shared_ptr<View> view = mView;
+    auto myId = view->getShardId();
+    size_t keyHash = hash<string>{}(key);
+    size_t keyId = view->scheme().getResponsibleShardId(keyHash);
+    if (myId && *myId == keyId)
+        return nullptr;
+
+    // A newer scheme learned from another node knows better where the key went, unless it says
+    // the key is coming here: until this node switches too, its view decides that.
+    shared_ptr<const ShardScheme> routing = newerRoutingScheme();
+    if (routing) {
+        const ShardInfo &shard = routing->getResponsibleShardInfo(keyHash);
+        if (shard.getNumNodes() != 0 && !shard.getNodeSet().count(view->getAddress()))
+            return shared_ptr<const ShardInfo>(routing, &shard);
+    }
+
+    // Shares ownership of the view, which owns the scheme.
+    return shared_ptr<const ShardInfo>(view, &view->scheme().getShardInfo(keyId));
+}
+
+string
+Node::keyToNode(const string &key) const
+{
+    shared_ptr<const ShardInfo> shard = keyOwnersElsewhere(key);
+    if (!shard)
+        return "";
+
+    assert(shard->getNumNodes() != 0);
+    return mTransport->replicaSelector()->pick(shard->getNodes());
+}
+
+string
+Node::keyToOtherNode(const string &key, const string &exclude) const
+{
+    shared_ptr<const ShardInfo> shard = keyOwnersElsewhere(key);
+    if (!shard)
+        return "";
+
+    return mTransport->replicaSelector()->pick(shard->getNodes(), exclude);
+}
+
+void
+Node::learnRoutingScheme(const ShardScheme &scheme)
+{
+    lock_guard<mutex> lock(mRoutingSchemeMut);
+    if (scheme.getNumShards() == 0 || scheme.version() <= mView->scheme().version())
+        return;
+    if (mRoutingScheme && scheme.version() <= mRoutingScheme->version())
+        return;
+
+    mRoutingScheme = make_shared<const ShardScheme>(scheme);
+}
+
+ShardScheme
+Node::routingScheme() const
+{
+    shared_ptr<const ShardScheme> routing = newerRoutingScheme();
+    return routing ? *routing : mView->scheme();
+}
+
+int
+Node::routingSchemeVersion() const
+{
+    shared_ptr<const ShardScheme> routing = newerRoutingScheme();
+    return routing ? routing->version() : mView->scheme().version();
+}
+
+shared_ptr<const ShardScheme>
+Node::newerRoutingScheme() const
+{
+    lock_guard<mutex> lock(mRoutingSchemeMut);
+    if (mRoutingScheme && mRoutingScheme->version() > mView->scheme().version())
+        return mRoutingScheme;
+    return nullptr;
+}
+
+bool
+Node::reshardPrepare(const ShardScheme &newScheme)
+{
+    if (!mReshardSwitchingSema.tryDown())
+        return false;
+
+    // A change that is still being sent after the node has switched to it, or to a newer one, has
+    // nothing left to do here.
+    if (newScheme.version() <= mView->scheme().version()) {
+        mReshardSwitchingSema.up();
+        return true;
+    }
+
+    // A prepare that is sent again leaves the copy it started running.
+    if (mPreparedView && mPreparedView->scheme().version() == newScheme.version()) {
+        mReshardSwitchingSema.up();
+        return true;
+    }
+
+    stopReshardCopy();
+
+    {
+        SemaphoreDownGuard viewGuard(mViewsReadSema);
+
+        mPreparedView = make_unique<View>(mView->getAddress(), newScheme);
+        mPreparedDatastore = make_unique<DataStore>();
+    }
+
+    startReshardCopy();
+
+    mReshardSwitchingSema.up();
+
     return true;
 }
 
-string
-Node::keyToNode(const string &key) const
+void
+Node::startReshardCopy()
 {
-    auto myId = mView->getShardId();
-    size_t keyId = mView->scheme().getResponsibleShardId(hash<string>{}(key));
-    if (myId && *myId == keyId)
-        return "";
+    auto copy = make_shared<ReshardCopy>();
+    AtomicBoolPtr shouldStop = copy->shouldStop;
+
+    shared_ptr<PeerTransport> transport = mTransport;
+    int newVersion = mPreparedView->scheme().version();
+    copy->schemeVersion = newVersion;
+
+    // Keys that move are streamed to their new shard in batches. The last ones may still be in
+    // flight after the switch, so the batches keep their own copy of the scheme.
+    auto newScheme = make_shared<const ShardScheme>(mPreparedView->scheme());
+    copy->migration = make_unique<ShardMigration>(
+        [this, transport, newVersion, newScheme, shouldStop](
+            size_t shardId, shared_ptr<const DataStore> batch, function<void()> done) {
+            auto attempt = [transport, newVersion, batch, done](
+                               const string &address, function<void(bool)> attemptDone) {
+                InterServer::moveDataBatch(*transport, address, newVersion, *batch,
+                                           [done, attemptDone](bool success) {
+                                               if (success)
+                                                   done();
+                                               attemptDone(success);
+                                           });
+            };
+
+            sendToRandomNodeUntilSuccess(newScheme->getShardInfo(shardId).getNodeSet(), attempt,
+                                         shouldStop);
+        },
+        RESHARD_BATCHES_IN_FLIGHT, RESHARD_BATCH_KEYS, RESHARD_BATCH_BYTES,
+        mMigrationBytesPerSecond);
 
-    const ShardInfo &shardInfo = mView->scheme().getShardInfo(keyId);
-    assert(shardInfo.getNumNodes() != 0);
-    int n = rand() % shardInfo.getNumNodes();
+    {
+        lock_guard<mutex> dataLock(mLocalDataMut);
+        mMigrationDelta = make_unique<DataStore>();
+
+        // If the keys handed off at the last switch haven't all landed, they go back into
+        // mLocalData, and this copy sends them to their owners under the new scheme. Until then
+        // this node keeps answering for them.
+        lock_guard<mutex> handoffLock(mHandoffMut);
+        if (mHandoffCopy && !mHandoffCopy->landed) {
+            *mHandoffCopy->shouldStop = true;
+            mHandoffCopy->migration->cancel();
+            mHandoffCopy = nullptr;
+
+            while (!mHandedOffData.empty()) {
+                auto node = mHandedOffData.extract(mHandedOffData.begin());
+                auto it = mLocalData.find(node.key());
+                if (it == mLocalData.end())
+                    mLocalData.insert(move(node));
+                else if (!VectorClock::isMax(it->second.clock, node.mapped().clock))
+                    it->second = move(node.mapped());
+            }
+        }
+    }
 
-    auto it = shardInfo.getNodeSet().cbegin();
-    while (n > 0) {
-        ++it;
-        --n;
+    mReshardCopy = copy;
+    {
+        lock_guard<mutex> lock(mLastReshardCopyMut);
+        mLastReshardCopy = copy;
     }
 
-    return *it;
+    thread([this, copy]() {
+        copyLocalDataForReshard(*copy);
+        copy->migration->flush();
+        if (!*copy->shouldStop)
+            copy->phase = MigrationPhase::Copied;
+        copy->done.up();
+    }).detach();
 }
 
-bool
-Node::reshardPrepare(const ShardScheme &newScheme)
+void
+Node::stopReshardCopy()
 {
-    if (!mReshardSwitchingSema.tryDown())
-        return false;
-
-    SemaphoreDownGuard viewGuard(mViewsReadSema);
-
-    mPreparedView = make_unique<View>(mView->getAddress(), newScheme);
-    mPreparedDatastore = make_unique<DataStore>();
+    if (!mReshardCopy)
+        return;
 
-    mReshardSwitchingSema.up();
+    *mReshardCopy->shouldStop = true;
+    mReshardCopy->migration->cancel();
+    mReshardCopy->done.wait();
+    mReshardCopy->phase = MigrationPhase::Stopped;
+    mReshardCopy = nullptr;
 
-    return true;
+    lock_guard<mutex> dataLock(mLocalDataMut);
+    mMigrationDelta = nullptr;
 }
 
 bool
@@ -381,282 +995,562 @@ Node::reshardSwitch(int version)
     {
         SemaphoreDecrementGuard viewGuard(mViewsReadSema);
 
-        if (mView->scheme().version() == version)
+        if (mView->scheme().version() >= version)
             return true;
 
         if (!mPreparedView || mPreparedView->scheme().version() != version)
             return false;
     }
 
-    // If a switch is curently happening, wait for it to finish and return success. This
-    // assumes that a reshardSwitch will always succeed if it lowered the semaphore.
-    if (!mReshardSwitchingSema.tryDown()) {
-        mReshardSwitchingSema.wait();
-        return true;
-    }
+    // The switch waits for the copy and for the receivers, so it runs on a thread of its own and
+    // the sender asks again until it is done. Whoever holds the semaphore is already switching,
+    // or is a prepare that the sender will be told about when it asks again.
+    if (!mReshardSwitchingSema.tryDown())
+        return false;
 
+    // A prepare of a newer version may have come in between.
+    bool prepared;
     {
-        // Prevent mView and mPreparedView from changing during this operation.
         SemaphoreDecrementGuard viewGuard(mViewsReadSema);
+        prepared = mPreparedView && mPreparedView->scheme().version() == version;
+    }
 
-        // Lock the local data for the for-loop.
-        lock_guard<mutex> dataLock(mLocalDataMut);
+    if (!prepared) {
+        mReshardSwitchingSema.up();
+        return false;
+    }
 
-        // Semaphores for data that are being moved.
-        vector<SemaphorePtr> moveSemas;
+    thread(&Node::runReshardSwitch, this, version).detach();
+    return false;
+}
 
-        // For each data item, either place it into the new datastore or move it to a dif node.
-        for (const auto &entry : mLocalData) {
-            size_t keyHash = hash<string>()(entry.first);
+void
+Node::runReshardSwitch(int version)
+{
+    // Set by the prepare of this version.
+    shared_ptr<ReshardCopy> copy = mReshardCopy;
+    assert(copy);
 
-            if (mPreparedView->isResponsibleFor(keyHash)) {
-                lock_guard<mutex> prepDataLock(mPreparedDatastoreMut);
-                mPreparedDatastore->insert(entry);
-            } else {
-                // The message is version&key&value. Ampersands in key and value are escaped by
-                // backslashes.
-                string messageBody = to_string(mPreparedView->scheme().version()) + "&" +
-                                     escapeChars(entry.first, "&") + "&" +
-                                     escapeChars(dataVersionToString(entry.second), "&");
-
-                // This semaphore will be raised when this piece of data has been successfully
-                // moved.
-                SemaphorePtr sema = make_shared<Semaphore>(0);
-                moveSemas.push_back(sema);
-
-                auto onResult = [sema](Pistache::Http::Response response) {
-                    if (response.code() == Pistache::Http::Code::Ok) {
-                        sema->up();
-                        return true;
-                    } else {
-                        return false;
-                    }
-                };
+    {
+        // Prevent mView and mPreparedView from changing during this operation.
+        SemaphoreDecrementGuard viewGuard(mViewsReadSema);
 
-                const ShardInfo &targetShard =
-                    mPreparedView->scheme().getResponsibleShardInfo(keyHash);
-                const set<string> &targetAddresses = targetShard.getNodeSet();
+        // The prepare started copying the store in the background, and the node has kept serving
+        // from it. Writes made since are replayed in rounds, each shorter than the one before,
+        // until few are left. Nothing waits for the batches to land: until the grace period
+        // ends, new owners fall back to this node for keys they don't have yet.
+        copy->done.wait();
+        copy->phase = MigrationPhase::Switching;
 
-                sendToRandomNodeUntilSuccess(targetAddresses, "shards/move", messageBody, onResult);
+        for (int round = 0; round < RESHARD_MAX_DELTA_ROUNDS; ++round) {
+            DataStore delta;
+            {
+                lock_guard<mutex> dataLock(mLocalDataMut);
+                if (mMigrationDelta->size() < RESHARD_SWITCH_DELTA)
+                    break;
+                swap(delta, *mMigrationDelta);
             }
-        }
 
-        // Wait for all data to be moved.
-        for (SemaphorePtr sema : moveSemas)
-            sema->down();
+            for (const auto &entry : delta)
+                stageForReshard(entry.first, entry.second, *copy);
+            copy->migration->flush();
+        }
     }
 
+    // The writes made since the last round that move away, by the shard they move to. They are
+    // sent once client operations run again.
+    unordered_map<size_t, DataStore> finalDelta;
+    auto graceEnd = chrono::steady_clock::now();
+
     {
+        // Client operations wait from here until the switch, which only has the last few writes
+        // to set aside. Nothing is sent here: sending waits for the receivers, which may be
+        // switching too and need their view to take the batch.
+        auto stallStart = chrono::steady_clock::now();
+
         // Down the mViewsReadSema while we change mView and mPreparedView.
         mViewsReadChangeMut.lock();
         SemaphoreDownGuard viewGuard(mViewsReadSema);
         mViewsReadChangeMut.unlock();
 
-        // Start using the new view and datastore.
+        lock_guard<mutex> dataLock(mLocalDataMut);
+
+        for (auto &entry : *mMigrationDelta) {
+            size_t keyHash = hash<string>()(entry.first);
+            if (mPreparedView->isResponsibleFor(keyHash))
+                continue;
+
+            size_t shardId = mPreparedView->scheme().getResponsibleShardId(keyHash);
+            finalDelta[shardId].emplace(entry.first, move(entry.second));
+            copy->movedKeys.push_back(entry.first);
+        }
+        mMigrationDelta = nullptr;
+
+        // Keys that stay never left mLocalData, so the new store is the old one without the keys
+        // that moved away, plus the keys moved here. Those are spliced in by their nodes, so
+        // nothing is copied and memory doesn't double. The keys that moved away are kept aside
+        // for the grace period.
+        mHandedOffData = DataStore();
+        for (const string &key : copy->movedKeys) {
+            auto node = mLocalData.extract(key);
+            if (!node.empty())
+                mHandedOffData.insert(move(node));
+        }
+
         lock_guard<mutex> prepDataLock(mPreparedDatastoreMut);
 
+        while (!mPreparedDatastore->empty()) {
+            auto node = mPreparedDatastore->extract(mPreparedDatastore->begin());
+
+            // Another node of the old shard may have had an older version of a key this node kept.
+            auto it = mLocalData.find(node.key());
+            if (it == mLocalData.end())
+                mLocalData.insert(move(node));
+            else if (!VectorClock::isMax(it->second.clock, node.mapped().clock))
+                it->second = move(node.mapped());
+        }
+
+        {
+            lock_guard<mutex> handoffLock(mHandoffMut);
+            mHandoffScheme = make_shared<const ShardScheme>(mView->scheme());
+            mHandoffFetchedKeys.clear();
+
+            // The keys of the last switch have landed, or the prepare put them back into mLocalData
+            // for this copy. Batches still being retried are not needed anymore.
+            if (mHandoffCopy) {
+                *mHandoffCopy->shouldStop = true;
+                mHandoffCopy->migration->cancel();
+            }
+            mHandoffCopy = copy;
+        }
+
+        // Start using the new view.
         mView = move(mPreparedView);
-        mLocalData = move(*mPreparedDatastore);
 
         mPreparedView = nullptr;
         mPreparedDatastore = nullptr;
+        mReshardCopy = nullptr;
+
+        copy->phase = MigrationPhase::Switched;
+        vector<string>().swap(copy->movedKeys);
+
+        graceEnd = chrono::steady_clock::now() + chrono::milliseconds(HANDOFF_GRACE_PERIOD);
+
+        mMetrics.reshardStallUs = chrono::duration_cast<chrono::microseconds>(
+                                      chrono::steady_clock::now() - stallStart)
+                                      .count();
     }
 
-    // Semaphore was lowered in tryDown().
-    mReshardSwitchingSema.up();
+    // The new owners fall back to this node until these land, so they aren't paced.
+    copy->migration->stopPacing();
+    for (const auto &shardDelta : finalDelta) {
+        for (const auto &entry : shardDelta.second)
+            copy->migration->add(shardDelta.first, entry.first, entry.second);
+    }
+    copy->migration->flush();
 
-    return true;
+    mMetrics.migratedKeys += copy->migration->numKeys();
+    mMetrics.migrationBatches += copy->migration->numBatches();
+
+    // The grace period lasts until the batches have landed, and at least HANDOFF_GRACE_PERIOD. If
+    // they don't land in time, it lasts until the next prepare.
+    thread([this, copy, version, graceEnd]() {
+        if (!copy->migration->finish(chrono::milliseconds(HANDOFF_LAND_TIMEOUT)))
+            return;
+
+        copy->landed = true;
+
+        double seconds =
+            chrono::duration<double>(chrono::steady_clock::now() - copy->startTime).count();
+        uint64_t numBytes = copy->migration->numBytesAcknowledged();
+        if (numBytes != 0)
+            mMetrics.migrationBytesPerSec = (uint64_t)(numBytes / seconds);
+
+        this_thread::sleep_until(graceEnd);
+        endHandoff(version);
+    }).detach();
+
+    triggerSchemeChangeEnd();
+
+    // Semaphore was lowered in reshardSwitch().
+    mReshardSwitchingSema.up();
 }
 
-bool
-Node::reshardMove(int schemeVersion, const std::string &key, const DataVersion &data)
+void
+Node::copyLocalDataForReshard(ReshardCopy &copy)
 {
-    // Prevent mView and mPreparedView from changing during this method.
-    mViewsReadChangeMut.lock();
-    SemaphoreDecrementGuard semaGuard(mViewsReadSema);
-    mViewsReadChangeMut.unlock();
+    // Buckets stay put unless the store is rehashed, which starts the copy over: the keys that
+    // were already copied may have moved to buckets that haven't been. Keys copied twice are only
+    // replaced by themselves.
+    size_t numBuckets = 0;
+    size_t bucket = 0;
+
+    while (!*copy.shouldStop) {
+        auto cpuStart = threadCpuTime();
+        vector<pair<string, DataVersion>> chunk;
+
+        {
+            lock_guard<mutex> dataLock(mLocalDataMut);
+
+            if (mLocalData.bucket_count() != numBuckets) {
+                numBuckets = mLocalData.bucket_count();
+                bucket = 0;
+                copy.numBuckets = numBuckets;
+            }
 
-    if (mView->scheme().version() == schemeVersion) {
-        lock_guard<mutex> localDataLock(mLocalDataMut);
-        insertOrReplace(mLocalData, key, data);
-        return true;
-    } else if (mPreparedView->scheme().version() == schemeVersion) {
-        lock_guard<mutex> prepDataLock(mPreparedDatastoreMut);
-        insertOrReplace(*mPreparedDatastore, key, data);
-        return true;
-    } else {
-        return false;
+            if (bucket >= numBuckets)
+                return;
+
+            // Only keys that leave are copied; the rest stay where they are.
+            size_t end = min(numBuckets, bucket + RESHARD_COPY_BUCKETS);
+            for (; bucket < end; ++bucket) {
+                for (auto it = mLocalData.begin(bucket); it != mLocalData.end(bucket); ++it) {
+                    if (!mPreparedView->isResponsibleFor(hash<string>()(it->first)))
+                        chunk.push_back(*it);
+                }
+            }
+        }
+
+        // The migration may wait for a shard to catch up, so this is done without the lock.
+        for (const auto &entry : chunk)
+            stageForReshard(entry.first, entry.second, copy);
+        copy.bucketsCopied = bucket;
+
+        // Time spent waiting on the migration isn't counted, only the CPU this thread used.
+        if (mMigrationCpuPercent < 100) {
+            auto busy = threadCpuTime() - cpuStart;
+            this_thread::sleep_for(busy * (100 - mMigrationCpuPercent) / mMigrationCpuPercent);
+        }
     }
 }
 
 void
-Node::updateShardScheme(const ShardScheme &newScheme)
+Node::stageForReshard(const string &key, const DataVersion &data, ReshardCopy &copy)
 {
-    const size_t GRACE_PERIOD = 100;
+    size_t keyHash = hash<string>()(key);
+    if (mPreparedView->isResponsibleFor(keyHash))
+        return;
 
-    shared_ptr<atomic<bool>> shouldStopPrepare = make_shared<atomic<bool>>(false);
-    AtomicVectorPtr<pair<size_t, string>> readyNodes =
-        make_shared<AtomicVector<pair<size_t, string>>>();
+    copy.migration->add(mPreparedView->scheme().getResponsibleShardId(keyHash), key, data);
+    copy.movedKeys.push_back(key);
+}
+
+void
+Node::fetchIfHandedOff(const string &key)
+{
+    {
+        lock_guard<mutex> dataLock(mLocalDataMut);
+        if (mLocalData.count(key))
+            return;
+    }
+
+    fetchFromPreviousOwner(key);
+}
+
+optional<Node::DataVersion>
+Node::fetchFromPreviousOwner(const string &key)
+{
+    size_t keyHash = hash<string>()(key);
+    vector<string> previousOwners;
+
+    {
+        lock_guard<mutex> handoffLock(mHandoffMut);
+        if (!mHandoffScheme)
+            return {};
+
+        // If this node was an owner already, the key didn't move.
+        const set<string> &owners = mHandoffScheme->getResponsibleShardInfo(keyHash).getNodeSet();
+        if (owners.count(mView->getAddress()) || mHandoffFetchedKeys.count(key))
+            return {};
+
+        previousOwners.assign(owners.begin(), owners.end());
+    }
 
-    SemaphoreList shardPrepareSemas =
-        updateShardSchemePrepare(newScheme, shouldStopPrepare, readyNodes);
+    // Only the replica expected to answer first is asked.
+    string address = mTransport->replicaSelector()->order(move(previousOwners)).front();
 
-    // Wait a little to give nodes time to respond.
-    this_thread::sleep_for(chrono::milliseconds(GRACE_PERIOD));
+    // Shared with the callback, which can run after this function has returned.
+    struct Response
+    {
+        mutex mut;
+        condition_variable cv;
+        bool answered = false;
+        bool fetched = false;
+        optional<DataVersion> version;
+    };
+    shared_ptr<Response> response = make_shared<Response>();
+
+    InterServer::getData(*mTransport, address, key,
+                         [response](optional<InterServer::DataReply> reply) {
+                             lock_guard<mutex> lk(response->mut);
+                             if (reply) {
+                                 response->version = move(reply->version);
+                                 response->fetched = true;
+                             }
+                             response->answered = true;
+                             response->cv.notify_all();
+                         });
+
+    optional<DataVersion> version;
+    bool fetched;
+    {
+        unique_lock<mutex> lk(response->mut);
+        response->cv.wait_for(lk, mTransport->peerLatencies()->timeoutFor(address),
+                              [&]() { return response->answered; });
+        version = response->version;
+        fetched = response->fetched;
+    }
+
+    // A key the previous owner didn't answer for is asked for again next time.
+    if (fetched) {
+        lock_guard<mutex> handoffLock(mHandoffMut);
+        mHandoffFetchedKeys.insert(key);
+    }
+
+    if (!version)
+        return {};
 
-    // Wait for some node from every shard to prepare.
-    for (int idx = 0; idx < shardPrepareSemas.size(); ++idx)
-        shardPrepareSemas[idx]->down();
+    lock_guard<mutex> dataLock(mLocalDataMut);
+    auto it = mLocalData.find(key);
+    if (it == mLocalData.end() || !VectorClock::isMax(it->second.clock, version->clock))
+        writeLocalData(key, *version);
 
-    shared_ptr<atomic<bool>> shouldStopSwitch = make_shared<atomic<bool>>(false);
+    return mLocalData.find(key)->second;
+}
 
-    SemaphoreList shardSwitchSemas =
-        updateShardSchemeSwitch(newScheme.version(), shouldStopSwitch, readyNodes);
+void
+Node::endHandoff(int schemeVersion)
+{
+    // mView is only read for its version, which another switch may be changing right now; then
+    // that switch has started a grace period of its own.
+    mViewsReadChangeMut.lock();
+    SemaphoreDecrementGuard viewGuard(mViewsReadSema);
+    mViewsReadChangeMut.unlock();
 
-    // Wait a little to give nodes time to respond.
-    this_thread::sleep_for(chrono::milliseconds(GRACE_PERIOD));
+    if (mView->scheme().version() != schemeVersion)
+        return;
 
-    // Wait for some node from every shard to switch.
-    for (int idx = 0; idx < shardSwitchSemas.size(); ++idx)
-        shardSwitchSemas[idx]->down();
+    {
+        lock_guard<mutex> handoffLock(mHandoffMut);
+        mHandoffScheme = nullptr;
+        mHandoffFetchedKeys.clear();
+        mHandoffCopy = nullptr;
+    }
 
-    *shouldStopPrepare = true;
-    *shouldStopSwitch = true;
+    lock_guard<mutex> dataLock(mLocalDataMut);
+    mHandedOffData = DataStore();
 }
 
-Node::SemaphoreList
-Node::updateShardSchemePrepare(const ShardScheme &newScheme, AtomicBoolPtr shouldStopPrepare,
-                               AtomicVectorPtr<pair<size_t, string>> readyNodes)
+vector<InterServer::ShardLoad>
+Node::loadByShard(const ShardScheme &scheme)
 {
-    const string prepareString = ShardSchemeUtility::serializeScheme(newScheme);
+    vector<InterServer::ShardLoad> loads(scheme.getNumShards());
 
-    SemaphoreList shardPrepareSemas;
+    // Counted a few buckets at a time like a reshard copy, so writes only wait for one chunk. A
+    // rehash starts the count over.
+    size_t numBuckets = 0;
+    size_t bucket = 0;
 
-    for (size_t id = 0; id < newScheme.getNumShards(); ++id) {
-        SemaphorePtr shardSema = make_shared<Semaphore>(0);
-        shardPrepareSemas.push_back(shardSema);
+    while (true) {
+        lock_guard<mutex> dataLock(mLocalDataMut);
 
-        const ShardInfo &shardInfo = newScheme.getShardInfo(id);
+        if (mLocalData.bucket_count() != numBuckets) {
+            numBuckets = mLocalData.bucket_count();
+            bucket = 0;
+            loads.assign(scheme.getNumShards(), InterServer::ShardLoad());
+        }
 
-        const auto &shardNodes = shardInfo.getNodeSet();
+        if (bucket >= numBuckets)
+            return loads;
 
-        for (const string &nodeAddr : shardNodes) {
-            // Begin sending out PREPARE requests.
-            sendUntilSuccess(nodeAddr, "shards/prepare", prepareString,
-                             [=](Pistache::Http::Response response) {
-                                 if (parsePrepareSuccess(response)) {
-                                     readyNodes->emplace_back(id, nodeAddr);
-                                     shardSema->up();
-                                     return true;
-                                 } else {
-                                     return false;
-                                 }
-                             },
-                             shouldStopPrepare);
+        size_t end = min(numBuckets, bucket + RESHARD_COPY_BUCKETS);
+        for (; bucket < end; ++bucket) {
+            for (auto it = mLocalData.begin(bucket); it != mLocalData.end(bucket); ++it) {
+                InterServer::ShardLoad &load =
+                    loads[scheme.getResponsibleShardId(hash<string>()(it->first))];
+                ++load.numKeys;
+                load.numBytes += it->first.size() + it->second.value.size();
+            }
         }
     }
-
-    return shardPrepareSemas;
 }
 
-Node::SemaphoreList
-Node::updateShardSchemeSwitch(int newVersion, AtomicBoolPtr shouldStopSwitch,
-                              AtomicVectorPtr<pair<size_t, string>> readyNodes)
+Node::MigrationStatus
+Node::migrationStatus() const
 {
-    const string switchString = to_string(newVersion);
+    shared_ptr<const ReshardCopy> copy;
+    {
+        lock_guard<mutex> lock(mLastReshardCopyMut);
+        copy = mLastReshardCopy;
+    }
 
-    SemaphoreList shardSwitchSemas;
+    MigrationStatus status;
+    if (!copy)
+        return status;
 
-    // Figure out how many shards there are.
-    size_t numShards = 0;
-    for (int readyIdx = 0; readyIdx < readyNodes->size(); ++readyIdx) {
-        const auto &readyPair = (*readyNodes)[readyIdx];
-        if (readyPair.first >= numShards)
-            numShards = readyPair.first + 1;
-    }
+    status.phase = copy->phase;
+    status.schemeVersion = copy->schemeVersion;
+    status.keysMoved = copy->migration->numKeysAcknowledged();
+    status.bytesMoved = copy->migration->numBytesAcknowledged();
 
-    // Initialize all semaphores to 0.
-    for (size_t id = 0; id < numShards; ++id)
-        shardSwitchSemas.emplace_back(make_shared<Semaphore>(0));
+    if (status.phase != MigrationPhase::Copying) {
+        status.progress = 1;
+        status.etaSeconds = status.phase == MigrationPhase::Stopped ? -1 : 0;
+        return status;
+    }
 
-    for (int readyIdx = 0; readyIdx < readyNodes->size(); ++readyIdx) {
-        size_t id = (*readyNodes)[readyIdx].first;
-        const std::string &address = (*readyNodes)[readyIdx].second;
+    // The walk goes at a steady pace, unless the store is rehashed and it starts over.
+    size_t numBuckets = copy->numBuckets;
+    if (numBuckets != 0)
+        status.progress = min(1.0, (double)copy->bucketsCopied / numBuckets);
 
-        sendUntilSuccess(address, "shards/switch", switchString,
-                         [=](Pistache::Http::Response response) {
-                             if (parseSwitchSuccess(response)) {
-                                 shardSwitchSemas[id]->up();
-                                 return true;
-                             } else {
-                                 return false;
-                             }
-                         },
-                         shouldStopSwitch);
+    if (status.progress > 0) {
+        double elapsed =
+            chrono::duration<double>(chrono::steady_clock::now() - copy->startTime).count();
+        status.etaSeconds = elapsed * (1 - status.progress) / status.progress;
     }
 
-    return shardSwitchSemas;
+    return status;
 }
 
-void
-Node::sendUntilSuccess(const string &address, const string &resource, const string &body,
-                       function<bool(Pistache::Http::Response)> onResult, AtomicBoolPtr shouldStop)
+const char *
+Node::migrationPhaseToString(MigrationPhase phase)
 {
-    thread t = thread([=]() {
-        bool gotSuccess = false;
+    switch (phase) {
+    case MigrationPhase::Copying:
+        return "copying";
+    case MigrationPhase::Copied:
+        return "copied";
+    case MigrationPhase::Switching:
+        return "switching";
+    case MigrationPhase::Switched:
+        return "switched";
+    case MigrationPhase::Stopped:
+        return "stopped";
+    case MigrationPhase::Idle:
+    default:
+        return "idle";
+    }
+}
 
-        auto responseLambda = [onResult, &gotSuccess](Pistache::Http::Response response) {
-            gotSuccess = onResult(response);
-        };
+bool
+Node::reshardMove(int schemeVersion, const std::string &key, const DataVersion &data)
+{
+    // Prevent mView and mPreparedView from changing during this method.
+    mViewsReadChangeMut.lock();
+    SemaphoreDecrementGuard semaGuard(mViewsReadSema);
+    mViewsReadChangeMut.unlock();
 
-        while (!gotSuccess && (shouldStop == nullptr || !(*shouldStop))) {
-            auto rsp = mView->sendMsg(address, resource, body, chrono::milliseconds(1000));
-            rsp.then(responseLambda, Pistache::Async::IgnoreException);
+    if (mView->scheme().version() == schemeVersion) {
+        // The key landed after the switch, so the node may have a newer version by now.
+        lock_guard<mutex> localDataLock(mLocalDataMut);
+        auto it = mLocalData.find(key);
+        if (it == mLocalData.end() || !VectorClock::isMax(it->second.clock, data.clock))
+            writeLocalData(key, data);
+        return true;
+    } else if (mPreparedView && mPreparedView->scheme().version() == schemeVersion) {
+        lock_guard<mutex> prepDataLock(mPreparedDatastoreMut);
+        mergeIntoPreparedDatastore(key, data);
+        return true;
+    } else {
+        return false;
+    }
+}
 
-            Pistache::Async::Barrier barrier(rsp);
-            barrier.wait();
-        }
-    });
+bool
+Node::reshardMoveBatch(int schemeVersion, const DataStore &data)
+{
+    // Prevent mView and mPreparedView from changing during this method.
+    mViewsReadChangeMut.lock();
+    SemaphoreDecrementGuard semaGuard(mViewsReadSema);
+    mViewsReadChangeMut.unlock();
 
-    // For some reason clang-format was doing a weird thing if you just wrote thread(...).detach();
-    t.detach();
+    if (mView->scheme().version() == schemeVersion) {
+        // The batch landed after the switch, so the node may have newer versions by now.
+        lock_guard<mutex> localDataLock(mLocalDataMut);
+        mLocalData.reserve(mLocalData.size() + data.size());
+        mergeIntoLocalData(data);
+        return true;
+    } else if (mPreparedView && mPreparedView->scheme().version() == schemeVersion) {
+        lock_guard<mutex> prepDataLock(mPreparedDatastoreMut);
+        mPreparedDatastore->reserve(mPreparedDatastore->size() + data.size());
+        for (const auto &entry : data)
+            mergeIntoPreparedDatastore(entry.first, entry.second);
+        return true;
+    } else {
+        return false;
+    }
 }
 
-void
-Node::sendToRandomNodeUntilSuccess(const set<string> &addresses, const string &resource,
-                                   const string &body,
-                                   function<bool(Pistache::Http::Response)> onResult,
-                                   AtomicBoolPtr shouldStop)
+bool
+Node::updateShardScheme(const ShardScheme &newScheme)
 {
-    // TODO: This is almost identical to sendUntilSuccess(), but calling this in sendUntilSuccess
-    // feels wrong.
-
-    thread t = thread([=]() {
-        bool gotSuccess = false;
+    shared_ptr<PeerTransport> transport = mTransport;
+    auto scheme = make_shared<const ShardScheme>(newScheme);
+
+    auto sendPrepare = [this, transport, scheme](const string &address, AtomicBoolPtr shouldStop,
+                                                 function<void()> accepted) {
+        auto attempt = [transport, scheme, accepted](const string &address,
+                                                     function<void(bool)> done) {
+            InterServer::prepareScheme(*transport, address, *scheme,
+                                       [accepted, done](bool success) {
+                                           if (success)
+                                               accepted();
+                                           done(success);
+                                       });
+        };
 
-        auto responseLambda = [onResult, &gotSuccess](Pistache::Http::Response response) {
-            gotSuccess = onResult(response);
+        sendUntilSuccess(address, attempt, shouldStop);
+    };
+
+    auto sendSwitch = [this, transport, scheme](const string &address, AtomicBoolPtr shouldStop,
+                                                function<void()> accepted) {
+        int version = scheme->version();
+        auto attempt = [transport, version, accepted](const string &address,
+                                                      function<void(bool)> done) {
+            InterServer::switchScheme(*transport, address, version, [accepted, done](bool success) {
+                if (success)
+                    accepted();
+                done(success);
+            });
         };
 
-        auto addressItr = addresses.begin();
-        assert(addressItr != addresses.end());
+        sendUntilSuccess(address, attempt, shouldStop);
+    };
 
-        while (!gotSuccess && (shouldStop == nullptr || !(*shouldStop))) {
-            const string &address = *addressItr;
+    auto change = make_shared<SchemeChange>(newScheme, sendPrepare, sendSwitch);
+    {
+        lock_guard<mutex> lk(mSchemeChangeMut);
+        if (mSchemeChange)
+            mSchemeChange->stop();
+        mSchemeChange = change;
+    }
 
-            ++addressItr;
-            if (addressItr == addresses.end())
-                addressItr = addresses.begin();
+    change->start();
+    return change->wait();
+}
 
-            auto rsp = mView->sendMsg(address, resource, body, chrono::milliseconds(1000));
-            rsp.then(responseLambda, Pistache::Async::IgnoreException);
+void
+Node::sendUntilSuccess(const string &address, RetryScheduler::AttemptFunction attempt,
+                       AtomicBoolPtr shouldStop)
+{
+    mRetryScheduler.submit({address}, attempt, shouldStop);
+}
 
-            Pistache::Async::Barrier barrier(rsp);
-            barrier.wait();
-        }
-    });
+void
+Node::sendToRandomNodeUntilSuccess(const set<string> &addresses,
+                                   RetryScheduler::AttemptFunction attempt,
+                                   AtomicBoolPtr shouldStop)
+{
+    vector<string> ordered = mTransport->replicaSelector()->order(
+        vector<string>(addresses.begin(), addresses.end()));
+    mRetryScheduler.submit(ordered, attempt, shouldStop);
+}
 
-    t.detach();
+void
+Node::runAfter(chrono::microseconds delay, function<void()> run)
+{
+    mRetryScheduler.runAfter(delay, move(run));
 }
 
 void
@@ -698,14 +1592,120 @@ Node::syncThread()
         }
 
         mLocalDataMut.lock();
-        string dataString = mapToDataString(mLocalData);
+        DataStore data = mLocalData;
         mLocalDataMut.unlock();
 
-        mView->sendMsg(*it, "dataSync/push", dataString);
+        InterServer::pushData(*mTransport, *it, data, [](bool) {},
+                              chrono::milliseconds(SYNC_TIMEOUT));
         // we don't care about the results, just loop back around
     }
 }
 
+WriteReplicator::AckPtr
+Node::replicateWrite(const string &key, const DataVersion &version, optional<WriteMode> writeMode)
+{
+    vector<string> others;
+    for (const string &address : mView->getAddressesInShard()) {
+        if (address != mView->getAddress())
+            others.push_back(address);
+    }
+
+    // Number of replicas that need the write, counting this one.
+    size_t numReplicas = others.size() + 1;
+    size_t required;
+    switch (writeMode.value_or(mDefaultWriteMode)) {
+    case WriteMode::One:
+        required = 1;
+        break;
+    case WriteMode::Quorum:
+        required = numReplicas / 2 + 1;
+        break;
+    case WriteMode::All:
+    default:
+        required = numReplicas;
+        break;
+    }
+
+    // This node already has it.
+    return mWriteReplicator.replicate(others, key, version, required - 1);
+}
+
+void
+Node::queueReadRepair(const string &key, const DataVersion &winner,
+                      const vector<string> &staleNodes)
+{
+    lock_guard<mutex> lk(mReadRepairsMut);
+
+    for (const string &node : staleNodes) {
+        if (mNumReadRepairs >= READ_REPAIR_MAX_QUEUED) {
+            ++mMetrics.readRepairsDropped;
+            continue;
+        }
+
+        DataStore &repairs = mReadRepairs[node];
+        auto it = repairs.find(key);
+        if (it == repairs.end()) {
+            repairs.emplace(key, winner);
+            ++mNumReadRepairs;
+            ++mMetrics.readRepairsQueued;
+        } else if (VectorClock::isMax(winner.clock, it->second.clock)) {
+            it->second = winner;
+        }
+    }
+}
+
+void
+Node::readRepairThread()
+{
+    while (true) {
+        this_thread::sleep_for(chrono::milliseconds(READ_REPAIR_PERIOD));
+
+        // Take at most READ_REPAIR_BATCH repairs off the queue, grouped by node.
+        unordered_map<string, DataStore> batch;
+        {
+            lock_guard<mutex> lk(mReadRepairsMut);
+
+            size_t budget = READ_REPAIR_BATCH;
+            for (auto nodeIt = mReadRepairs.begin(); nodeIt != mReadRepairs.end() && budget > 0;) {
+                DataStore &repairs = nodeIt->second;
+                DataStore &nodeBatch = batch[nodeIt->first];
+
+                while (!repairs.empty() && budget > 0) {
+                    nodeBatch.insert(*repairs.begin());
+                    repairs.erase(repairs.begin());
+                    --mNumReadRepairs;
+                    --budget;
+                }
+
+                if (repairs.empty())
+                    nodeIt = mReadRepairs.erase(nodeIt);
+                else
+                    ++nodeIt;
+            }
+        }
+
+        if (batch.empty())
+            continue;
+
+        mViewsReadChangeMut.lock();
+        SemaphoreDecrementGuard viewsReadGuard(mViewsReadSema);
+        mViewsReadChangeMut.unlock();
+
+        for (const auto &nodeBatch : batch) {
+            if (nodeBatch.first == mView->getAddress()) {
+                lock_guard<mutex> dataLock(mLocalDataMut);
+                mergeIntoLocalData(nodeBatch.second);
+            } else {
+                // Same message and merge rules as the sync thread, so the receiver needs nothing
+                // new. We don't care about the results; the sync thread is the fallback.
+                InterServer::pushData(*mTransport, nodeBatch.first, nodeBatch.second, [](bool) {});
+            }
+
+            mMetrics.readRepairsSent += nodeBatch.second.size();
+        }
+    }
+}
+
 void
 Node::incrementClock()
 {
@@ -725,16 +1725,83 @@ Node::mergeClock(const VectorClock &other)
 }
 
 void
-Node::waitForNewSchemeVersion(int newVersion)
+Node::whenSchemeVersion(int newVersion, chrono::milliseconds deadline,
+                        function<void(bool switched)> resume)
 {
-    unique_lock<mutex> lk(mSchemeChangeMut);
-    while (mView->scheme().version() < newVersion)
-        mSchemeChangeCV.wait(lk);
+    SchemeWaiterPtr waiter = make_shared<SchemeWaiter>(SchemeWaiter{newVersion, move(resume)});
+
+    {
+        lock_guard<mutex> lk(mSchemeChangeMut);
+        if (mView->scheme().version() < newVersion) {
+            mSchemeWaiters.push_back(waiter);
+
+            // Whoever takes the waiter out of the list resumes it: the switch or the deadline.
+            runAfter(deadline, [this, waiter]() {
+                {
+                    lock_guard<mutex> lk(mSchemeChangeMut);
+                    auto it = find(mSchemeWaiters.begin(), mSchemeWaiters.end(), waiter);
+                    if (it == mSchemeWaiters.end())
+                        return;
+                    mSchemeWaiters.erase(it);
+                }
+
+                queueResume(waiter, false);
+            });
+            return;
+        }
+    }
+
+    queueResume(waiter, true);
 }
 
 void
 Node::triggerSchemeChangeEnd()
 {
-    unique_lock<mutex> lk(mSchemeChangeMut);
-    mSchemeChangeCV.notify_all();
+    vector<SchemeWaiterPtr> ready;
+    {
+        lock_guard<mutex> lk(mSchemeChangeMut);
+        int version = mView->scheme().version();
+
+        // The nodes still being sent an older change will be sent this scheme instead.
+        if (mSchemeChange && mSchemeChange->version() < version) {
+            mSchemeChange->stop();
+            mSchemeChange = nullptr;
+        }
+
+        auto stillWaiting = [version](const SchemeWaiterPtr &waiter) {
+            return waiter->version > version;
+        };
+        auto waiting = partition(mSchemeWaiters.begin(), mSchemeWaiters.end(), stillWaiting);
+        ready.assign(waiting, mSchemeWaiters.end());
+        mSchemeWaiters.erase(waiting, mSchemeWaiters.end());
+    }
+
+    for (const SchemeWaiterPtr &waiter : ready)
+        queueResume(waiter, true);
+}
+
+void
+Node::queueResume(SchemeWaiterPtr waiter, bool switched)
+{
+    lock_guard<mutex> lk(mResumeMut);
+    mResumeQueue.emplace_back(move(waiter), switched);
+    mResumeReady.notify_one();
+}
+
+void
+Node::resumeThread()
+{
+    // A resumed request runs the whole operation again, which may wait on other nodes, so it
+    // runs here rather than on the scheduler's threads.
+    while (true) {
+        pair<SchemeWaiterPtr, bool> next;
+        {
+            unique_lock<mutex> lk(mResumeMut);
+            mResumeReady.wait(lk, [this]() { return !mResumeQueue.empty(); });
+            next = move(mResumeQueue.front());
+            mResumeQueue.pop_front();
+        }
+
+        next.first->resume(next.second);
+    }
 }
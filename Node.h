@@ -1,17 +1,27 @@
 #pragma once
 
-#include "AtomicVector.h"
+#include "DataVersion.h"
+#include "InterServer.h"
+#include "PeerTransport.h"
+#include "RetryScheduler.h"
+#include "SchemeChange.h"
 #include "Semaphore.h"
+#include "ShardMigration.h"
 #include "VectorClock.h"
 #include "View.h"
+#include "WriteReplicator.h"
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <mutex>
 #include <pistache/http_headers.h>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 class Node
@@ -53,29 +63,68 @@ public:
         bool hasWrongSchemeVersion() const { return newSchemeVersion != -1; }
         bool isBadRequest() const { return mIsBadRequest; }
 
+        /// The write was applied on this node, but not acknowledged by enough replicas in time.
+        bool isUnconfirmed() const { return unconfirmed; }
+
         // TODO: Encapsulate.
         T value;
         VectorClock clock;
         int newSchemeVersion;
+        bool unconfirmed = false;
 
     private:
         bool mIsBadRequest;
     };
 
-    struct DataVersion
-    {
-        DataVersion(const std::string &val, const VectorClock &clock)
-            : value(val)
-            , clock(clock)
-        {
-        }
+    using DataVersion = ::DataVersion;
+    using DataStore = ::DataStore;
 
-        std::string value;
-        VectorClock clock;
+    /// Counters exposed through the /metrics endpoint.
+    struct Metrics
+    {
+        /// Number of getElement calls that had to ask the other nodes in the shard.
+        std::atomic<uint64_t> fanOutReads{0};
+
+        /// Number of getElement calls that shared another call's fan-out instead of starting one.
+        std::atomic<uint64_t> coalescedReads{0};
+
+        /// Number of (replica, key) repairs queued, pushed to replicas and dropped because the
+        /// queue was full.
+        std::atomic<uint64_t> readRepairsQueued{0};
+        std::atomic<uint64_t> readRepairsSent{0};
+        std::atomic<uint64_t> readRepairsDropped{0};
+
+        /// Number of writes that were not acknowledged by enough replicas in time. They are kept,
+        /// and answered as unconfirmed.
+        std::atomic<uint64_t> writeQuorumTimeouts{0};
+
+        /// Number of forwarded requests that were also sent to a second replica because the first
+        /// was slow, and how many of those the second replica answered first.
+        std::atomic<uint64_t> hedgedForwards{0};
+        std::atomic<uint64_t> hedgeWins{0};
+
+        /// Number of requests for keys owned by another shard that were answered with a redirect
+        /// instead of being forwarded.
+        std::atomic<uint64_t> redirects{0};
+
+        /// Number of forwarded requests that took a second hop: passed on by a node with a newer
+        /// scheme than the sender's, or resent by the sender after the first node refused them.
+        std::atomic<uint64_t> extraHops{0};
+
+        /// Number of keys this node has moved to other shards when resharding, and number of
+        /// batches they were sent in.
+        std::atomic<uint64_t> migratedKeys{0};
+        std::atomic<uint64_t> migrationBatches{0};
+
+        /// How long the last reshard switch blocked client operations on this node, in
+        /// microseconds.
+        std::atomic<uint64_t> reshardStallUs{0};
+
+        /// Bytes per second this node's last reshard copy sent, from the prepare until every
+        /// batch was acknowledged. 0 until a copy has finished.
+        std::atomic<uint64_t> migrationBytesPerSec{0};
     };
 
-    using DataStore = std::unordered_map<std::string, DataVersion>;
-
     enum class PutSuccessType
     {
         CreatedNewValue,
@@ -84,113 +133,399 @@ public:
         ObjectTooLarge
     };
 
-    Node(std::shared_ptr<View> view);
+    /// How many replicas of a shard (counting the one the client talks to) must have a write
+    /// before the client gets a response. Writes are always sent to every replica in the shard;
+    /// this only decides how many acknowledgements to wait for.
+    enum class WriteMode
+    {
+        One,
+        Quorum,
+        All
+    };
+
+    /// The outcome of a view change.
+    enum class ViewChange
+    {
+        Done,
+
+        /// An added node is already in the view, a removed node isn't, a node is given twice, or
+        /// there is nothing to change.
+        Invalid,
+
+        /// Some shard would be left with fewer than two nodes.
+        TooFewNodes,
+
+        /// A newer scheme change replaced this one before it was committed. The nodes that
+        /// switched to it go on to the newer one.
+        Superseded
+    };
+
+    /// Where this node is in the copy started by the last reshard prepare.
+    enum class MigrationPhase
+    {
+        Idle,
+        Copying,
+        Copied,
+        Switching,
+        Switched,
+        Stopped
+    };
+
+    /// What /shard/migration reports about the copy started by the last reshard prepare.
+    struct MigrationStatus
+    {
+        MigrationPhase phase = MigrationPhase::Idle;
+        int schemeVersion = -1;
+
+        /// Keys moved to other shards, and bytes of their keys and values, counting only batches
+        /// that have been acknowledged.
+        uint64_t keysMoved = 0;
+        uint64_t bytesMoved = 0;
+
+        /// Fraction of the store the copy has walked, and the seconds it should take to walk the
+        /// rest; -1 if not known yet.
+        double progress = 0;
+        double etaSeconds = -1;
+    };
+
+    /// Messages to other nodes go through transport, which the node keeps for its whole life.
+    /// The background copy of a reshard sends at most migrationBytesPerSecond bytes per second
+    /// (0 for no limit), and keeps its thread busy at most migrationCpuPercent percent of the
+    /// time.
+    Node(std::shared_ptr<View> view, std::shared_ptr<PeerTransport> transport,
+         WriteMode defaultWriteMode = WriteMode::One, size_t migrationBytesPerSecond = 0,
+         int migrationCpuPercent = 100);
 
     // CLIENT: Key-Value Store operations:
+    /// If writeMode is not given, the node's default write mode is used.
     ClientOpReturnValue<PutSuccessType>
-    putElement(const std::string &key, const std::string &value, const VectorClock &payload);
+    putElement(const std::string &key, const std::string &value, const VectorClock &payload,
+               std::optional<WriteMode> writeMode = {});
 
     ClientOpReturnValue<std::optional<std::string>>
     getElement(const std::string &key, const VectorClock &payload);
 
     ClientOpReturnValue<bool> hasElement(const std::string &key, const VectorClock &payload);
 
-    ClientOpReturnValue<bool> delElement(const std::string &key, const VectorClock &payload);
+    ClientOpReturnValue<bool> delElement(const std::string &key, const VectorClock &payload,
+                                         std::optional<WriteMode> writeMode = {});
+
+    /// Puts every (key, value) pair with one acquisition of the locks and one clock tick. The keys
+    /// must belong to this node's shard. The value has a PutSuccessType per pair, in order; the
+    /// whole batch is unconfirmed if any write isn't acknowledged by enough replicas in time.
+    ClientOpReturnValue<std::vector<PutSuccessType>>
+    putElements(const std::vector<std::pair<std::string, std::string>> &entries,
+                const VectorClock &payload, std::optional<WriteMode> writeMode = {});
+
+    /// Reads every key with one acquisition of the locks. Keys whose local version doesn't cover
+    /// the payload are then read one at a time, as getElement() does.
+    ClientOpReturnValue<std::vector<std::optional<std::string>>>
+    getElements(const std::vector<std::string> &keys, const VectorClock &payload);
 
     size_t count();
 
+    Metrics &metrics() { return mMetrics; }
+
+    const RetryScheduler &retryScheduler() const { return mRetryScheduler; }
+
+    const RetryScheduler &replicationRetryScheduler() const { return mReplicationRetryScheduler; }
+
+    const WriteReplicator &writeReplicator() const { return mWriteReplicator; }
+
     // CLIENT: View operations:
-    bool addNode(const std::string &ipPort);
+    ViewChange addNode(const std::string &ipPort);
 
-    bool delNode(const std::string &ipPort);
+    ViewChange delNode(const std::string &ipPort);
+
+    /// Adds and removes nodes in a single scheme change, built by changeMembership() in
+    /// ShardSchemeUtility. Changes nothing unless it returns Done: every shard must keep at least
+    /// two nodes, as reshard() requires.
+    ViewChange changeView(const std::vector<std::string> &added,
+                          const std::vector<std::string> &removed);
 
     std::shared_ptr<View> getView() const { return mView; }
 
+    PeerTransport &transport() const { return *mTransport; }
+
+    /// What reshard() would do, as computed by planReshard().
+    struct ReshardPlan
+    {
+        int schemeVersion;
+
+        /// Keys and bytes of each shard of the current scheme, by the shard of the new scheme
+        /// that would own them: loads[from][to]. Empty for shards that didn't answer.
+        std::vector<std::vector<InterServer::ShardLoad>> loads;
+
+        /// moved[from][to] is true if nodes of shard from would have to send those keys, because
+        /// they aren't all in shard to.
+        std::vector<std::vector<bool>> moved;
+
+        /// How fast one node sends a reshard's keys, in bytes per second: the last copy's
+        /// measured rate, capped by the configured limit. -1 if neither is known.
+        double bytesPerSecond = -1;
+
+        /// Seconds the copy would take, or -1 if bytesPerSecond isn't known. The nodes of every
+        /// shard send at the same time, so this is for the shard with the most to send.
+        double etaSeconds = -1;
+    };
+
+    /// Works out what reshard(numShards) would move without changing anything. Each shard is
+    /// asked how its keys would be spread over the new scheme. Returns nothing if reshard() would
+    /// refuse.
+    std::optional<ReshardPlan> planReshard(size_t numShards);
+
     /// Attempts to create a new shard scheme with the given number of shards and to propagate
-    /// it to other nodes. Returns false if there are too many shards, and otherwise returns
-    /// true once it is likely that most nodes have updated their scheme.
-    bool reshard(size_t numShards);
+    /// it to other nodes. Returns TooFewNodes if there are too many shards, and otherwise returns
+    /// once the change is committed or superseded.
+    ViewChange reshard(size_t numShards);
 
     // INTERSERVER: key-value store operations:
     // returns the data version, and the scheme version
     std::optional<std::pair<DataVersion, int>> directGet(const std::string &key);
 
     bool syncData(const std::string &data);
+    bool syncData(const DataStore &data);
 
     /// Prepares for a view change. Returns true on success, false on failure.
     bool reshardPrepare(const ShardScheme &scheme);
 
-    /// Attempts to switch to the new scheme version. Returns true on success, false on failure.
+    /// Switches to the prepared scheme version in the background, if that hasn't started yet.
+    /// Does not block. Returns true once the node has switched to the version or a newer one, and
+    /// false until then or if the version isn't prepared, so senders ask again until it returns
+    /// true.
     bool reshardSwitch(int schemeVersion);
 
     /// Attempts to move the data to this node. Returns true on success, false on failure.
     bool reshardMove(int schemeVersion, const std::string &key, const DataVersion &data);
 
+    /// Like reshardMove(), for a batch of keys, which are applied under a single lock.
+    bool reshardMoveBatch(int schemeVersion, const DataStore &data);
+
+    /// Returns how this node's keys would be spread over the shards of the scheme, by shard ID.
+    /// Changes nothing.
+    std::vector<InterServer::ShardLoad> loadByShard(const ShardScheme &scheme);
+
+    /// Progress of the copy started by the last reshard prepare. Thread-safe.
+    MigrationStatus migrationStatus() const;
+
+    static const char *migrationPhaseToString(MigrationPhase phase);
+
     // Forwarding
-    Pistache::Http::RequestBuilder requestBuilder() { return mView->requestBuilder(); }
+    Pistache::Http::RequestBuilder requestBuilder() { return mTransport->requestBuilder(); }
     std::string keyToNode(const std::string &key) const;
 
-    void waitForNewSchemeVersion(int newVersion);
+    /// Returns a node other than `exclude` in the shard responsible for the key, or an empty
+    /// string if there is none or if this node's shard is responsible.
+    std::string keyToOtherNode(const std::string &key, const std::string &exclude) const;
+
+    /// Remembers a scheme newer than this node's, sent back by a node that has already switched to
+    /// it. Until this node switches too, keyToNode() and keyToOtherNode() go by it, so requests
+    /// are forwarded to the nodes that own the keys now instead of through their old owners.
+    void learnRoutingScheme(const ShardScheme &scheme);
+
+    /// Returns the scheme requests are forwarded by: the learned one if it is newer than the
+    /// view's, otherwise the view's.
+    ShardScheme routingScheme() const;
+    int routingSchemeVersion() const;
+
+    /// Runs the function on a retry scheduler thread once the delay has passed. Used as the timer
+    /// of asynchronous work such as hedged forwards. The function must not block.
+    void runAfter(std::chrono::microseconds delay, std::function<void()> run);
+
+    /// Calls resume(true) once this node has switched to a scheme of at least newVersion, or
+    /// resume(false) if it hasn't after the deadline. Doesn't block: requests waiting for a
+    /// reshard are parked here instead of holding HTTP worker threads, which the node needs to
+    /// take part in the reshard. resume runs on one of the SCHEME_RESUME_THREADS threads
+    /// kept for it, and may block.
+    void whenSchemeVersion(int newVersion, std::chrono::milliseconds deadline,
+                           std::function<void(bool switched)> resume);
 
 private:
-    /// Propagates the new shard scheme through the system. Must always succeed.
-    void updateShardScheme(const ShardScheme &newScheme);
+    /// Propagates the new shard scheme through the system with a SchemeChange, and waits until
+    /// it is committed. The nodes that haven't switched yet keep being sent the change until they
+    /// do, or until this node switches to a newer scheme. Returns false if a newer scheme
+    /// replaced it before it was committed.
+    bool updateShardScheme(const ShardScheme &newScheme);
+
+    /// Returns the shard that owns the key, or null if it is this node's shard. The pointer keeps
+    /// the scheme it belongs to alive.
+    std::shared_ptr<const ShardInfo> keyOwnersElsewhere(const std::string &key) const;
+
+    /// Returns the learned routing scheme if it is newer than the view's, otherwise null.
+    std::shared_ptr<const ShardScheme> newerRoutingScheme() const;
 
     using AtomicBoolPtr = std::shared_ptr<std::atomic<bool>>;
-    using SemaphorePtr = std::shared_ptr<Semaphore>;
-    using SemaphoreList = std::vector<SemaphorePtr>;
-
-    template <typename T>
-    using AtomicVectorPtr = std::shared_ptr<AtomicVector<T>>;
-
-    /// Performs the prepare phase of resharding. This will send a shards/prepare message to
-    /// every node in the system. This will return a list of semaphores that will count the number
-    /// of nodes in each shard that have responded with success. When a node responds with success,
-    /// it will be added to readyNodes its shard's semaphore will be raised.
-    SemaphoreList
-    updateShardSchemePrepare(const ShardScheme &newScheme, AtomicBoolPtr shouldStopPrepare,
-                             AtomicVectorPtr<std::pair<size_t, std::string>> readyNodes);
-
-    /// Performs the switch phase of reshading. This will send a shards/switch message to
-    /// every node in readyNodes (it is assumed that readyNodes can increase in size but its
-    /// existing entries will not change). This will return a list of semaphores that count the
-    /// number of nodes in each shard that have responded with success. It is assumed that
-    /// readyNodes has an entry for each shard ID at the start of this function.
-    SemaphoreList
-    updateShardSchemeSwitch(int newVersion, AtomicBoolPtr shouldStopSwitch,
-                            AtomicVectorPtr<std::pair<size_t, std::string>> readyNodes);
-
-    /// Starts a thread that will send messages to the address. On timeout (or exception), it
-    /// will retry unless shouldStop is true. If a response is received, it calls onResult().
-    /// The function onResult should return true if it accepts the response and false if it does
-    /// not, in which case the message will be resent while shouldStop is false.
-    void sendUntilSuccess(const std::string &address, const std::string &resource,
-                          const std::string &body,
-                          std::function<bool(Pistache::Http::Response)> onResult,
+
+    /// Hands the message to the retry scheduler, which makes attempts to send it to the address.
+    /// An attempt sends the message once and reports whether the receiver accepted it. Failed
+    /// attempts are retried with backoff while shouldStop is false. Does not block.
+    void sendUntilSuccess(const std::string &address, RetryScheduler::AttemptFunction attempt,
                           AtomicBoolPtr shouldStop = nullptr);
 
-    /// Starts a thread that sends messages to random nodes in the shard. On timeout (or exception),
-    /// it will retry unless shouldStop is true. If a response is received, it calls onResult().
-    /// The function onResult should return true if it accepts the response and false if it does
-    /// not, in which case the message will be resent while shouldStop is false.
+    /// Like sendUntilSuccess(), but each attempt goes to the next node in the shard, skipping
+    /// nodes that are known to be down unless they all are. The nodes are tried in the order the
+    /// replica selector expects them to answer, best first. Does not block.
 public:
     void sendToRandomNodeUntilSuccess(const std::set<std::string> &addresses,
-                                      const std::string &resource, const std::string &body,
-                                      std::function<bool(Pistache::Http::Response)> onResult,
+                                      RetryScheduler::AttemptFunction attempt,
                                       AtomicBoolPtr shouldStop = nullptr);
 
 private:
+    /// The result of asking every other node in the shard for its version of a key. Concurrent
+    /// reads of the same key share one of these (see getElement()).
+    struct ReadFanOut
+    {
+        ReadFanOut(const VectorClock &payload)
+            : payload(payload)
+        {
+        }
+
+        /// Payload of the read that started the fan-out. A read whose payload is covered by this
+        /// one can use the result instead of starting its own fan-out.
+        const VectorClock payload;
+
+        std::vector<DataVersion> versions;
+
+        /// The version each responding node had, or none if it didn't have the key.
+        std::vector<std::pair<std::string, std::optional<DataVersion>>> nodeVersions;
+
+        bool gotTimeout = false;
+        int newSchemeVersion = -1;
+
+        /// Set once the fields above are final. Protected by mut.
+        bool done = false;
+        std::mutex mut;
+        std::condition_variable cv;
+    };
+
+    using ReadFanOutPtr = std::shared_ptr<ReadFanOut>;
+
+    /// Asks every other node in this node's shard for its version of the key and fills in the
+    /// versions, gotTimeout and newSchemeVersion of fanOut. Does not mark it done.
+    void fanOutRead(const std::string &key, ReadFanOut &fanOut);
+
+    /// Sends the write to the other nodes in this node's shard. The returned Ack is satisfied
+    /// once enough of them have it for writeMode (or the default write mode).
+    WriteReplicator::AckPtr replicateWrite(const std::string &key, const DataVersion &version,
+                                           std::optional<WriteMode> writeMode);
+
     // periodicly chooses a random other thread to send my data to, for them to sync up
     void syncThread();
 
+    /// Queues the winning version of a key to be pushed to each of the given nodes (which may
+    /// include this node) by readRepairThread(). Drops the repair if the queue is full.
+    void queueReadRepair(const std::string &key, const DataVersion &winner,
+                         const std::vector<std::string> &staleNodes);
+
+    // periodicly sends a batch of queued read repairs to each stale node
+    void readRepairThread();
+
+    /// Merges data into mLocalData, keeping whichever version is the max. Assumes mLocalDataMut
+    /// is held.
+    void mergeIntoLocalData(const DataStore &data);
+
+    /// Merges the version into mPreparedDatastore, unless the one there is newer. Assumes
+    /// mPreparedDatastoreMut is held.
+    void mergeIntoPreparedDatastore(const std::string &key, const DataVersion &version);
+
+    /// Stores the version in mLocalData, and in mMigrationDelta if a reshard is copying the
+    /// store. Every write to mLocalData goes through here. Assumes mLocalDataMut is held.
+    void writeLocalData(const std::string &key, const DataVersion &version);
+
+    /// The work a reshard prepare starts in the background: every key that leaves this node is
+    /// shipped to its new shard, so the switch only has to replay the writes made since. Keys
+    /// that stay are left in mLocalData.
+    struct ReshardCopy
+    {
+        std::unique_ptr<ShardMigration> migration;
+
+        /// Keys handed to the migration, which the switch drops from mLocalData.
+        std::vector<std::string> movedKeys;
+
+        AtomicBoolPtr shouldStop = std::make_shared<std::atomic<bool>>(false);
+
+        /// Raised once every key that leaves has been handed to the migration, or the copy has
+        /// stopped.
+        Semaphore done{0};
+
+        /// Set once every batch has been acknowledged, after the switch.
+        std::atomic<bool> landed{false};
+
+        int schemeVersion = -1;
+        std::atomic<MigrationPhase> phase{MigrationPhase::Copying};
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+        /// Progress of the copy, for migrationStatus(): buckets of mLocalData walked so far, out
+        /// of numBuckets. Nothing resumes from it. A prepare that is sent again leaves the running
+        /// copy alone, and the store only lives in memory, so a node that restarts has nothing
+        /// left to copy.
+        std::atomic<size_t> bucketsCopied{0};
+        std::atomic<size_t> numBuckets{0};
+    };
+
+    /// Starts copying mLocalData for mPreparedView on a thread of its own, and starts
+    /// collecting writes in mMigrationDelta. Assumes mReshardSwitchingSema is held.
+    void startReshardCopy();
+
+    /// The switch reshardSwitch() starts, on a thread of its own: waits for the copy, replays the
+    /// writes made since, and swaps the views. Assumes mReshardSwitchingSema is held, and releases
+    /// it.
+    void runReshardSwitch(int schemeVersion);
+
+    /// Stops the copy started by the last prepare, if any, and waits for it. Assumes
+    /// mReshardSwitchingSema is held.
+    void stopReshardCopy();
+
+    /// Hands the keys of mLocalData that leave this node under mPreparedView to the copy's
+    /// migration, a few buckets at a time so client operations only wait for one chunk. Stops
+    /// early if the copy's shouldStop becomes true.
+    void copyLocalDataForReshard(ReshardCopy &copy);
+
+    /// Hands the key to the copy's migration unless this node keeps it under mPreparedView.
+    void stageForReshard(const std::string &key, const DataVersion &data, ReshardCopy &copy);
+
+    /// Asks the shard that owned the key before the last switch for it, if that was another
+    /// shard and the switch was recent enough that the key may still be on its way here. Each key
+    /// is asked for until the previous owner has answered for it once since the switch. Whatever
+    /// comes back is merged into mLocalData, and this node's resulting version is returned.
+    /// Assumes mViewsReadSema is decremented, and that mLocalDataMut isn't held.
+    std::optional<DataVersion> fetchFromPreviousOwner(const std::string &key);
+
+    /// Calls fetchFromPreviousOwner() if this node doesn't have the key. Same assumptions.
+    void fetchIfHandedOff(const std::string &key);
+
+    /// Ends the grace period of the switch to the given scheme version, unless another switch
+    /// has happened since.
+    void endHandoff(int schemeVersion);
+
     void incrementClock();
     void mergeAndIncrementClock(const VectorClock &other);
     void mergeClock(const VectorClock &other);
 
+    /// Resumes the waiters of whenSchemeVersion() that the current scheme satisfies.
     void triggerSchemeChangeEnd();
 
+    struct SchemeWaiter
+    {
+        int version;
+        std::function<void(bool switched)> resume;
+    };
+
+    using SchemeWaiterPtr = std::shared_ptr<SchemeWaiter>;
+
+    /// Queues the waiter to be resumed by resumeThread().
+    void queueResume(SchemeWaiterPtr waiter, bool switched);
+
+    // resumes the waiters queued by queueResume(), one at a time
+    void resumeThread();
+
     VectorClock mNodeClock;
     std::shared_ptr<View> mView;
+    const std::shared_ptr<PeerTransport> mTransport;
+
+    /// Set by learnRoutingScheme(); protected by mRoutingSchemeMut.
+    std::shared_ptr<const ShardScheme> mRoutingScheme;
+    mutable std::mutex mRoutingSchemeMut;
     DataStore mLocalData;
 
     /// Only one client operation at a time. Lock claimed at the start of each high level client op,
@@ -210,14 +545,84 @@ private:
     /// Lock this while changing mViewsReadSema.
     std::mutex mViewsReadChangeMut;
 
-    // Used to trigger threads waiting on the scheme to be updated
-    // Lock exclusivly used for this purpose
+    /// Requests waiting for the scheme to be updated (see whenSchemeVersion()).
+    std::vector<SchemeWaiterPtr> mSchemeWaiters;
+
+    /// Waiters to resume, with whether the scheme switched. Protected by mResumeMut; mResumeReady
+    /// is notified when one is queued.
+    std::deque<std::pair<SchemeWaiterPtr, bool>> mResumeQueue;
+    std::mutex mResumeMut;
+    std::condition_variable mResumeReady;
+
+    /// The last scheme change this node started, while it is still being sent to some nodes.
+    std::shared_ptr<SchemeChange> mSchemeChange;
+
+    /// Used to protect mSchemeWaiters and mSchemeChange, and held while checking mView's version
+    /// against them.
     std::mutex mSchemeChangeMut;
-    std::condition_variable mSchemeChangeCV;
 
     /// Whether a reshard-switch is currently being performed.
     Semaphore mReshardSwitchingSema;
 
     std::unique_ptr<View> mPreparedView;
     std::unique_ptr<DataStore> mPreparedDatastore;
+
+    /// The copy started by the last prepare; null when none is pending. Only used while holding
+    /// mReshardSwitchingSema.
+    std::shared_ptr<ReshardCopy> mReshardCopy;
+
+    /// The copy started by the last prepare, kept after it is done for migrationStatus().
+    /// Protected by mLastReshardCopyMut.
+    std::shared_ptr<const ReshardCopy> mLastReshardCopy;
+    mutable std::mutex mLastReshardCopyMut;
+
+    /// The scheme before the last switch, which reads fall back to for keys that may still be on
+    /// their way to this node. Null once the grace period ends. Protected by mHandoffMut, like
+    /// mHandoffFetchedKeys, the keys already fetched since the switch.
+    std::shared_ptr<const ShardScheme> mHandoffScheme;
+    std::unordered_set<std::string> mHandoffFetchedKeys;
+    std::mutex mHandoffMut;
+
+    /// The copy of the last switch, whose batches may still be in flight. Protected by
+    /// mHandoffMut.
+    std::shared_ptr<ReshardCopy> mHandoffCopy;
+
+    /// Keys this node handed off at the last switch. Their batches may not have landed yet, so
+    /// directGet() still answers for them until the grace period ends. If they haven't landed by
+    /// the next prepare, they go back into mLocalData for its copy to send again. Protected by
+    /// mLocalDataMut.
+    DataStore mHandedOffData;
+
+    /// Writes to mLocalData made since a reshard prepare, to be replayed before the switch. Null
+    /// when no reshard is pending. Protected by mLocalDataMut.
+    std::unique_ptr<DataStore> mMigrationDelta;
+
+    /// Fan-out reads that are currently running, by key.
+    std::unordered_map<std::string, ReadFanOutPtr> mInFlightReads;
+
+    /// Used to protect mInFlightReads.
+    std::mutex mInFlightReadsMut;
+
+    /// Winning versions waiting to be pushed, by the address of the node that needs them.
+    std::unordered_map<std::string, DataStore> mReadRepairs;
+
+    /// Total number of entries in mReadRepairs.
+    size_t mNumReadRepairs = 0;
+
+    /// Used to protect mReadRepairs and mNumReadRepairs.
+    std::mutex mReadRepairsMut;
+
+    const WriteMode mDefaultWriteMode;
+    const size_t mMigrationBytesPerSecond;
+    const int mMigrationCpuPercent;
+    WriteReplicator mWriteReplicator;
+
+    /// Sends every inter-server message that has to be retried until it succeeds, except for
+    /// replication batches.
+    RetryScheduler mRetryScheduler;
+
+    /// Resends the replication batches that failed, with an in-flight budget of their own.
+    RetryScheduler mReplicationRetryScheduler;
+
+    Metrics mMetrics;
 };
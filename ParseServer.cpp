@@ -1,8 +1,18 @@
 #include "ParseServer.h"
 
+#include "InterServer.h"
 #include "ParsingHelpers.h"
+#include "ShardRouting.h"
 #include "ShardSchemeUtility.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <optional>
 #include <pistache/async.h>
 #include <pistache/http_headers.h>
 #include <set>
@@ -25,22 +35,33 @@ ParseServer::ParseServer(shared_ptr<Node> node)
     MAKE_ROUTE(Get, "/keyValue-store/search/:key", hasElementImpl);
     MAKE_ROUTE(Put, "/keyValue-store/:key", putElementImpl);
     MAKE_ROUTE(Delete, "/keyValue-store/:key", delElementImpl);
+    MAKE_ROUTE(Get, BATCH_RESOURCE, getBatchImpl);
+    MAKE_ROUTE(Put, BATCH_RESOURCE, putBatchImpl);
 
     MAKE_ROUTE(Get, "/view", getViewImpl);
     MAKE_ROUTE(Put, "/view", addViewImpl);
     MAKE_ROUTE(Delete, "/view", delViewImpl);
+    MAKE_ROUTE(Patch, "/view", patchViewImpl);
 
     MAKE_ROUTE(Get, "/shard/my_id", getShardMyIdImpl);
     MAKE_ROUTE(Get, "/shard/all_ids", getShardAllIdsImpl);
     MAKE_ROUTE(Get, "/shard/members/:shardId", getShardMembersImpl);
     MAKE_ROUTE(Get, "/shard/count/:shardId", getShardCountImpl);
+    MAKE_ROUTE(Get, ShardRouting::SCHEME_RESOURCE, getShardSchemeImpl);
+    MAKE_ROUTE(Get, "/shard/migration", getShardMigrationImpl);
+    MAKE_ROUTE(Get, "/shard/plan/:numShards", getShardPlanImpl);
     MAKE_ROUTE(Put, "/shard/changeShardNumber", putShardChangeNumberImpl);
 
+    MAKE_ROUTE(Get, "/metrics", getMetricsImpl);
+
     MAKE_ROUTE(Patch, "/inter_server/dataStore/:key", patchInterImpl);
     MAKE_ROUTE(Patch, "/inter_server/dataSync/push", patchSyncPush);
+    MAKE_ROUTE(Patch, "/inter_server/count", patchCountImpl);
     MAKE_ROUTE(Patch, "/inter_server/shards/prepare", shardPrepareImpl);
     MAKE_ROUTE(Patch, "/inter_server/shards/switch", shardSwitchImpl);
     MAKE_ROUTE(Patch, "/inter_server/shards/move", shardMoveImpl);
+    MAKE_ROUTE(Patch, "/inter_server/shards/moveBatch", shardMoveBatchImpl);
+    MAKE_ROUTE(Patch, "/inter_server/shards/plan", shardPlanImpl);
 
 #undef MAKE_ROUTE
 }
@@ -51,23 +72,225 @@ ParseServer::handler() const
     return mRouter->handler();
 }
 
+RpcStatus
+ParseServer::handleRpc(RpcOp op, RpcReader &request, RpcWriter &reply)
+{
+    switch (op) {
+    case RpcOp::DataGet: {
+        string key(request.string());
+
+        auto val = mNode->directGet(key);
+        reply.u8(val.has_value());
+        reply.i32(val ? val->second : mNode->getView()->scheme().version());
+        if (val)
+            reply.dataVersion(val->first);
+
+        return RpcStatus::Ok;
+    }
+
+    case RpcOp::DataPush: {
+        uint32_t numEntries = request.count(RpcReader::MIN_ENTRY_SIZE);
+
+        Node::DataStore data;
+        data.reserve(numEntries);
+        for (uint32_t idx = 0; idx < numEntries; ++idx) {
+            string key(request.string());
+            data.emplace(move(key), request.dataVersion());
+        }
+
+        return mNode->syncData(data) ? RpcStatus::Ok : RpcStatus::Rejected;
+    }
+
+    case RpcOp::ShardPrepare:
+        return mNode->reshardPrepare(request.scheme()) ? RpcStatus::Ok : RpcStatus::Rejected;
+
+    case RpcOp::ShardSwitch:
+        return mNode->reshardSwitch(request.i32()) ? RpcStatus::Ok : RpcStatus::Rejected;
+
+    case RpcOp::ShardMove: {
+        int version = request.i32();
+        string key(request.string());
+        Node::DataVersion dataVersion = request.dataVersion();
+
+        return mNode->reshardMove(version, key, dataVersion) ? RpcStatus::Ok
+                                                              : RpcStatus::Rejected;
+    }
+
+    case RpcOp::ShardMoveBatch: {
+        int version = request.i32();
+        uint32_t numEntries = request.count(RpcReader::MIN_ENTRY_SIZE);
+
+        Node::DataStore data;
+        data.reserve(numEntries);
+        for (uint32_t idx = 0; idx < numEntries; ++idx) {
+            string key(request.string());
+            data.emplace(move(key), request.dataVersion());
+        }
+
+        return mNode->reshardMoveBatch(version, data) ? RpcStatus::Ok : RpcStatus::Rejected;
+    }
+
+    case RpcOp::Count:
+        reply.u64(mNode->count());
+        return RpcStatus::Ok;
+
+    case RpcOp::ShardPlan: {
+        vector<InterServer::ShardLoad> loads = mNode->loadByShard(request.scheme());
+
+        reply.u32((uint32_t)loads.size());
+        for (const InterServer::ShardLoad &load : loads) {
+            reply.u64(load.numKeys);
+            reply.u64(load.numBytes);
+        }
+        return RpcStatus::Ok;
+    }
+
+    default:
+        return RpcStatus::BadRequest;
+    }
+}
+
+namespace
+{
+/// Returns true if the client asked for a redirect instead of a forwarded request.
+bool
+wantsRedirect(const Rest::Request &request)
+{
+    auto route = request.headers().tryGetRaw(ShardRouting::ROUTE_HEADER);
+    return !route.isEmpty() && route.get().value() == ShardRouting::REDIRECT;
+}
+
+/// Answers a forwarded request this node won't serve or pass on with its scheme, so the sender can
+/// route by it.
+void
+sendMisdirected(Http::ResponseWriter &response, const ShardScheme &scheme)
+{
+    response.headers().addRaw(
+        Http::Header::Raw(ShardRouting::SCHEME_VERSION_HEADER, to_string(scheme.version())));
+    response.send(ShardRouting::MISDIRECTED, ShardSchemeUtility::serializeScheme(scheme),
+                  MIME(Text, Plain));
+}
+
+/// The message of a write that was applied by the node the client asked, but not acknowledged by
+/// enough replicas in time. It is answered with 202 Accepted.
+const char *const UNCONFIRMED_MSG = "Written, but not acknowledged by enough replicas in time";
+
+/// The message of a view change that a newer change replaced.
+const char *const SUPERSEDED_MSG = "A newer view change replaced this one before it completed";
+
+/// The status of the answer to a view change: a change that would leave a shard with too few
+/// nodes is a bad request, one that doesn't apply to the view is not found, and one that a newer
+/// change replaced is a conflict.
+
+Http::Code
+viewChangeCode(Node::ViewChange change)
+{
+    switch (change) {
+    case Node::ViewChange::Done:
+        return Http::Code::Ok;
+    case Node::ViewChange::TooFewNodes:
+        return Http::Code::Bad_Request;
+    case Node::ViewChange::Superseded:
+        return Http::Code::Conflict;
+    case Node::ViewChange::Invalid:
+    default:
+        return Http::Code::Not_Found;
+    }
+}
+
+/// Parses a scheme version sent by another node. Returns false unless str is a whole number that
+/// fits in an int.
+bool
+parseVersion(const string &str, int &version)
+{
+    if (str.empty())
+        return false;
+
+    char *end;
+    errno = 0;
+    long val = strtol(str.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE || val < INT_MIN || val > INT_MAX)
+        return false;
+
+    version = val;
+    return true;
+}
+} // namespace
+
 #define CHECK_FORWARD(KEY)                                                                         \
-    string _dest = mNode->keyToNode(KEY);                                                          \
-    if (!_dest.empty()) {                                                                          \
-        forwardRequest(_dest, request, response);                                                  \
-        return;                                                                                    \
+    if (routeElsewhere(KEY, request, response))                                                    \
+        return;
+
+bool
+ParseServer::routeElsewhere(const string &key, const RestRequest &request, HttpResponse &response)
+{
+    string dest = mNode->keyToNode(key);
+    if (dest.empty())
+        return false;
+
+    if (wantsRedirect(request)) {
+        redirectRequest(dest, key, request, response);
+        return true;
     }
 
+    optional<int> hops = getIntHeader(request, ShardRouting::FORWARD_HOPS_HEADER);
+    if (!hops) {
+        forwardRequest(dest, key, 1, request, response);
+        return true;
+    }
+
+    // Another node sent the request here by its scheme. Passing it on only helps if this node's
+    // scheme is newer; otherwise the sender is told, so requests can't bounce between nodes that
+    // disagree about the owner.
+    ShardScheme scheme = mNode->routingScheme();
+    optional<int> senderVersion = getIntHeader(request, ShardRouting::SCHEME_VERSION_HEADER);
+    if (*hops >= ShardRouting::MAX_FORWARD_HOPS || scheme.version() <= senderVersion.value_or(-1)) {
+        sendMisdirected(response, scheme);
+        return true;
+    }
+
+    ++mNode->metrics().extraHops;
+    forwardRequest(dest, key, *hops + 1, request, response);
+    return true;
+}
+
+void
+ParseServer::retryAfterSchemeChange(int newVersion, Handler handler, const RestRequest &request,
+                                    HttpResponse &response)
+{
+    // How long a request waits for the switch before the client is told to try again.
+    const chrono::milliseconds SCHEME_CHANGE_DEADLINE = 10s;
+
+    // Parked until the switch, without a thread. std::function needs a copyable function and the
+    // response can only be moved, so it is shared.
+    auto parked = make_shared<HttpResponse>(move(response));
+
+    mNode->whenSchemeVersion(newVersion, SCHEME_CHANGE_DEADLINE,
+                             [this, handler, request, parked](bool switched) {
+                                 if (switched)
+                                     (this->*handler)(request, move(*parked));
+                                 else
+                                     parked->send(Http::Code::Service_Unavailable);
+                             });
+}
+
 void
 ParseServer::putElementImpl(const RestRequest &request, HttpResponse response)
 {
-PUT_ELEMENT_TOP:
     string key = request.param(":key").as<string>();
     CHECK_FORWARD(key)
     string value = getParam(request, "val");
     VectorClock payload = VectorClock::fromString(getParam(request, "payload"));
 
-    auto putResult = mNode->putElement(key, value, payload);
+    // Optional per-request write mode; the node's default is used if it is missing.
+    string writeModeStr = getParam(request, "w");
+    optional<Node::WriteMode> writeMode = stringToWriteMode(writeModeStr);
+    if (!writeModeStr.empty() && !writeMode) {
+        response.send(Http::Code::Bad_Request);
+        return;
+    }
+
+    auto putResult = mNode->putElement(key, value, payload, writeMode);
 
     if (putResult.isBadRequest()) {
         response.send(Http::Code::Bad_Request);
@@ -75,33 +298,41 @@ PUT_ELEMENT_TOP:
     }
 
     if (putResult.hasWrongSchemeVersion()) {
-        mNode->waitForNewSchemeVersion(putResult.newSchemeVersion);
-        goto PUT_ELEMENT_TOP;
+        retryAfterSchemeChange(putResult.newSchemeVersion, &ParseServer::putElementImpl, request,
+                               response);
+        return;
     }
 
+    // Written here, but not acknowledged by enough replicas in time.
+    bool unconfirmed = putResult.isUnconfirmed();
+
     switch (putResult.value) {
     case Node::PutSuccessType::CreatedNewValue: {
         ostringstream stream;
         stream << "{" << endl;
         stream << "\"replaced\":false," << endl;
-        stream << "\"msg\":\"Added successfully\"," << endl;
+        stream << "\"msg\":\"" << (unconfirmed ? UNCONFIRMED_MSG : "Added successfully") << "\","
+               << endl;
         stream << "\"payload\":\"" << putResult.clock.toString() << "\"" << endl;
         stream << "}" << endl;
 
-        response.send(Http::Code::Ok, // NOTE: hw specs say this should return Ok
-                      stream.str(), MIME(Application, Json));
+        // NOTE: hw specs say this should return Ok
+        response.send(unconfirmed ? Http::Code::Accepted : Http::Code::Ok, stream.str(),
+                      MIME(Application, Json));
     } break;
 
     case Node::PutSuccessType::UpdatedExistingValue: {
         ostringstream stream;
         stream << "{" << endl;
         stream << "\"replaced\":true," << endl;
-        stream << "\"msg\":\"Updated successfully\"," << endl;
+        stream << "\"msg\":\"" << (unconfirmed ? UNCONFIRMED_MSG : "Updated successfully")
+               << "\"," << endl;
         stream << "\"payload\":\"" << putResult.clock.toString() << "\"" << endl;
         stream << "}" << endl;
 
-        response.send(Http::Code::Created, // NOTE: hw specs say this should return Created
-                      stream.str(), MIME(Application, Json));
+        // NOTE: hw specs say this should return Created
+        response.send(unconfirmed ? Http::Code::Accepted : Http::Code::Created, stream.str(),
+                      MIME(Application, Json));
     } break;
 
     default:
@@ -113,7 +344,6 @@ PUT_ELEMENT_TOP:
 void
 ParseServer::getElementImpl(const RestRequest &request, HttpResponse response)
 {
-GET_ELEM_TOP:
     string key = request.param(":key").as<string>();
     CHECK_FORWARD(key)
     VectorClock requestPayload = VectorClock::fromString(getParam(request, "payload"));
@@ -125,8 +355,9 @@ GET_ELEM_TOP:
     }
 
     if (getResult.hasWrongSchemeVersion()) {
-        mNode->waitForNewSchemeVersion(getResult.newSchemeVersion);
-        goto GET_ELEM_TOP;
+        retryAfterSchemeChange(getResult.newSchemeVersion, &ParseServer::getElementImpl, request,
+                               response);
+        return;
     }
 
     auto value = getResult.value;
@@ -160,7 +391,6 @@ GET_ELEM_TOP:
 void
 ParseServer::hasElementImpl(const RestRequest &request, HttpResponse response)
 {
-HAS_ELEM_TOP:
     string key = request.param(":key").as<string>();
     CHECK_FORWARD(key)
     VectorClock requestPayload = VectorClock::fromString(getParam(request, "payload"));
@@ -172,8 +402,9 @@ HAS_ELEM_TOP:
     }
 
     if (hasResult.hasWrongSchemeVersion()) {
-        mNode->waitForNewSchemeVersion(hasResult.newSchemeVersion);
-        goto HAS_ELEM_TOP;
+        retryAfterSchemeChange(hasResult.newSchemeVersion, &ParseServer::hasElementImpl, request,
+                               response);
+        return;
     }
 
     bool found = hasResult.value;
@@ -192,11 +423,18 @@ HAS_ELEM_TOP:
 void
 ParseServer::delElementImpl(const RestRequest &request, HttpResponse response)
 {
-DEL_ELEM_TOP:
     string key = request.param(":key").as<string>();
     CHECK_FORWARD(key)
     VectorClock requestPayload = VectorClock::fromString(getParam(request, "payload"));
-    auto delResult = mNode->delElement(key, requestPayload);
+
+    string writeModeStr = getParam(request, "w");
+    optional<Node::WriteMode> writeMode = stringToWriteMode(writeModeStr);
+    if (!writeModeStr.empty() && !writeMode) {
+        response.send(Http::Code::Bad_Request);
+        return;
+    }
+
+    auto delResult = mNode->delElement(key, requestPayload, writeMode);
 
     if (delResult.isBadRequest()) {
         response.send(Http::Code::Bad_Request);
@@ -204,21 +442,28 @@ DEL_ELEM_TOP:
     }
 
     if (delResult.hasWrongSchemeVersion()) {
-        mNode->waitForNewSchemeVersion(delResult.newSchemeVersion);
-        goto DEL_ELEM_TOP;
+        retryAfterSchemeChange(delResult.newSchemeVersion, &ParseServer::delElementImpl, request,
+                               response);
+        return;
     }
 
     bool deleted = delResult.value;
+    bool unconfirmed = delResult.isUnconfirmed();
     VectorClock payload = delResult.clock;
 
     ostringstream stream;
     stream << "{" << endl;
     stream << "\"result\":" << (deleted ? "\"Success\"" : "\"Error\"") << "," << endl;
-    stream << "\"msg\":" << (deleted ? "\"Key deleted\"" : "\"Key does not exist\"") << "," << endl;
+    if (unconfirmed)
+        stream << "\"msg\":\"" << UNCONFIRMED_MSG << "\"," << endl;
+    else
+        stream << "\"msg\":" << (deleted ? "\"Key deleted\"" : "\"Key does not exist\"") << ","
+               << endl;
     stream << "\"payload\":\"" << payload.toString() << "\"" << endl;
     stream << "}" << endl;
 
-    response.send(deleted ? Http::Code::Ok : Http::Code::Not_Found, stream.str(),
+    Http::Code code = deleted ? Http::Code::Ok : Http::Code::Not_Found;
+    response.send(unconfirmed ? Http::Code::Accepted : code, stream.str(),
                   MIME(Application, Json));
 }
 
@@ -251,7 +496,8 @@ ParseServer::addViewImpl(const RestRequest &request, HttpResponse response)
 {
     string ip_port = getParam(request, "ip_port");
 
-    bool success = mNode->addNode(ip_port);
+    Node::ViewChange change = mNode->addNode(ip_port);
+    bool success = change == Node::ViewChange::Done;
 
     ostringstream stream;
     stream << "{" << endl;
@@ -259,12 +505,15 @@ ParseServer::addViewImpl(const RestRequest &request, HttpResponse response)
     stream << "\"msg\":" << endl;
     if (success)
         stream << "\"Successfully added " << ip_port << " to view\"" << endl;
+    else if (change == Node::ViewChange::TooFewNodes)
+        stream << "\"Every shard needs at least two nodes\"" << endl;
+    else if (change == Node::ViewChange::Superseded)
+        stream << "\"" << SUPERSEDED_MSG << "\"" << endl;
     else
         stream << "\"" << ip_port << " is already in view\"" << endl;
     stream << "}" << endl;
 
-    response.send(success ? Http::Code::Ok : Http::Code::Not_Found, stream.str(),
-                  MIME(Application, Json));
+    response.send(viewChangeCode(change), stream.str(), MIME(Application, Json));
 }
 
 void
@@ -272,7 +521,8 @@ ParseServer::delViewImpl(const RestRequest &request, HttpResponse response)
 {
     string ip_port = getParam(request, "ip_port");
 
-    bool success = mNode->delNode(ip_port);
+    Node::ViewChange change = mNode->delNode(ip_port);
+    bool success = change == Node::ViewChange::Done;
 
     ostringstream stream;
     stream << "{" << endl;
@@ -280,12 +530,109 @@ ParseServer::delViewImpl(const RestRequest &request, HttpResponse response)
     stream << "\"msg\":";
     if (success)
         stream << "\"Successfully removed " << ip_port << " from view\"" << endl;
+    else if (change == Node::ViewChange::TooFewNodes)
+        stream << "\"Every shard needs at least two nodes\"" << endl;
+    else if (change == Node::ViewChange::Superseded)
+        stream << "\"" << SUPERSEDED_MSG << "\"" << endl;
     else
         stream << "\"" << ip_port << " is not in current view\"" << endl;
     stream << "}" << endl;
 
-    response.send(success ? Http::Code::Ok : Http::Code::Not_Found, stream.str(),
-                  MIME(Application, Json));
+    response.send(viewChangeCode(change), stream.str(), MIME(Application, Json));
+}
+
+void
+ParseServer::patchViewImpl(const RestRequest &request, HttpResponse response)
+{
+    auto nonEmpty = [](vector<string> addresses) {
+        addresses.erase(remove(addresses.begin(), addresses.end(), ""), addresses.end());
+        return addresses;
+    };
+
+    vector<string> added = nonEmpty(splitByCommas(getParam(request, "add")));
+    vector<string> removed = nonEmpty(splitByCommas(getParam(request, "remove")));
+
+    Node::ViewChange change = mNode->changeView(added, removed);
+    bool success = change == Node::ViewChange::Done;
+
+    ostringstream stream;
+    stream << "{" << endl;
+    stream << "\"result\":" << (success ? "\"Success\"" : "\"Error\"") << "," << endl;
+    stream << "\"msg\":";
+    if (success)
+        stream << "\"Successfully added " << added.size() << " and removed " << removed.size()
+               << " nodes\"" << endl;
+    else if (change == Node::ViewChange::TooFewNodes)
+        stream << "\"Every shard needs at least two nodes\"" << endl;
+    else if (change == Node::ViewChange::Superseded)
+        stream << "\"" << SUPERSEDED_MSG << "\"" << endl;
+    else
+        stream << "\"Nothing to change, or an added node is already in view, a removed node is "
+                  "not, or a node is given twice\""
+               << endl;
+    stream << "}" << endl;
+
+    response.send(viewChangeCode(change), stream.str(), MIME(Application, Json));
+}
+
+void
+ParseServer::getMetricsImpl(const RestRequest &request, HttpResponse response)
+{
+    const Node::Metrics &metrics = mNode->metrics();
+
+    ostringstream stream;
+    stream << "{" << endl;
+    stream << "\"fanOutReads\":" << metrics.fanOutReads << "," << endl;
+    stream << "\"coalescedReads\":" << metrics.coalescedReads << "," << endl;
+    stream << "\"readRepairsQueued\":" << metrics.readRepairsQueued << "," << endl;
+    stream << "\"readRepairsSent\":" << metrics.readRepairsSent << "," << endl;
+    stream << "\"readRepairsDropped\":" << metrics.readRepairsDropped << "," << endl;
+    stream << "\"writeQuorumTimeouts\":" << metrics.writeQuorumTimeouts << "," << endl;
+    stream << "\"hedgedForwards\":" << metrics.hedgedForwards << "," << endl;
+    stream << "\"hedgeWins\":" << metrics.hedgeWins << "," << endl;
+    stream << "\"redirects\":" << metrics.redirects << "," << endl;
+    stream << "\"extraHops\":" << metrics.extraHops << "," << endl;
+    stream << "\"migratedKeys\":" << metrics.migratedKeys << "," << endl;
+    stream << "\"migrationBatches\":" << metrics.migrationBatches << "," << endl;
+    stream << "\"reshardStallUs\":" << metrics.reshardStallUs << "," << endl;
+    stream << "\"migrationBytesPerSec\":" << metrics.migrationBytesPerSec << "," << endl;
+    stream << "\"retriesInFlight\":" << mNode->retryScheduler().numInFlight() << "," << endl;
+    stream << "\"retriesQueued\":" << mNode->retryScheduler().numQueued() << "," << endl;
+    stream << "\"replicationRetriesInFlight\":"
+           << mNode->replicationRetryScheduler().numInFlight() << "," << endl;
+    stream << "\"replicationDropped\":" << mNode->writeReplicator().numDropped() << "," << endl;
+
+    // Latency estimates in milliseconds and circuit breaker states, by peer.
+    shared_ptr<PeerLatencyTracker> latencies = mNode->transport().peerLatencies();
+    shared_ptr<PeerCircuitBreakers> breakers = mNode->transport().peerBreakers();
+
+    set<string> peerSet;
+    for (const string &peer : latencies->addresses())
+        peerSet.insert(peer);
+    for (const string &peer : breakers->addresses())
+        peerSet.insert(peer);
+    vector<string> peers(peerSet.begin(), peerSet.end());
+
+    stream << "\"peers\":{";
+    for (size_t idx = 0; idx < peers.size(); ++idx) {
+        auto toMs = [](optional<chrono::microseconds> us) {
+            return us ? us->count() / 1000.0 : -1.0;
+        };
+
+        stream << (idx == 0 ? "" : ",") << endl;
+        stream << "\"" << peers[idx] << "\":{";
+        stream << "\"ewmaMs\":" << toMs(latencies->ewma(peers[idx])) << ",";
+        stream << "\"p50Ms\":" << toMs(latencies->percentile(peers[idx], 0.50)) << ",";
+        stream << "\"p95Ms\":" << toMs(latencies->percentile(peers[idx], 0.95)) << ",";
+        stream << "\"p99Ms\":" << toMs(latencies->percentile(peers[idx], 0.99)) << ",";
+        stream << "\"timeoutMs\":" << latencies->timeoutFor(peers[idx]).count() << ",";
+        stream << "\"breaker\":\""
+               << PeerCircuitBreakers::stateToString(breakers->state(peers[idx])) << "\"}";
+    }
+    stream << endl << "}" << endl;
+    stream << "}" << endl;
+
+    response.send(Http::Code::Ok, stream.str(), MIME(Application, Json));
 }
 
 void
@@ -309,23 +656,269 @@ ParseServer::patchSyncPush(const RestRequest &request, HttpResponse response)
 }
 
 void
-ParseServer::forwardRequest(const string &dest, const RestRequest &request, HttpResponse &response)
+ParseServer::patchCountImpl(const RestRequest &request, HttpResponse response)
+{
+    response.send(Http::Code::Ok, to_string(mNode->count()), MIME(Application, Json));
+}
+
+namespace
+{
+/// A client request being forwarded to the node responsible for its key, and maybe hedged to
+/// another replica. It belongs to the callbacks of its messages and to its hedge timer, so it lives
+/// until the last of them has run. The client gets the first answer.
+///
+/// If a node answers that it doesn't own the key, the node the client asked learns its scheme and
+/// resends the request once, by that scheme; a node that was only passing the request on hands
+/// the answer back instead.
+struct Forward : enable_shared_from_this<Forward>
+{
+    Forward(shared_ptr<Node> node, const string &key, int hops, const Rest::Request &request,
+            Http::ResponseWriter &&response)
+        : node(node)
+        , key(key)
+        , hops(hops)
+        , method(request.method())
+        , resource(request.resource())
+        , query(request.query())
+        , body(request.body())
+        , response(move(response))
+    {
+    }
+
+    /// Sends the request to target as its hops'th hop. The caller counts it in pending first.
+    void send(const string &target, int hops);
+
+    /// Sends the request to hedgeTarget, unless that has been done or the client has its answer.
+    void hedge();
+
+    /// Called when target answered that it doesn't own the key, with its scheme.
+    void misdirected(const string &target, const string &serializedScheme);
+
+    /// Called when a message came to nothing. Hedges right away if that hasn't been done, and
+    /// answers the client if nothing else is in flight.
+    void attemptFailed();
+
+    const shared_ptr<Node> node;
+
+    const string key;
+
+    /// The hop the request takes from this node. 1 if a client sent it here.
+    const int hops;
+
+    const Http::Method method;
+    const string resource;
+    const Http::Uri::Query query;
+    const string body;
+
+    Http::ResponseWriter response;
+
+    /// Empty if the request isn't hedged. Set before the first message is sent.
+    string hedgeTarget;
+
+    /// Protects the fields below.
+    mutex mut;
+    size_t pending = 0;
+    bool hedged = false;
+    bool answered = false;
+    bool resent = false;
+
+    /// The newest scheme of the nodes that said they don't own the key.
+    optional<ShardScheme> misdirectedScheme;
+};
+
+void
+Forward::send(const string &target, int hops)
 {
-    auto requestBuilder = mNode->requestBuilder();
-    requestBuilder.method(request.method())
-        .resource(dest + request.resource())
-        .params(request.query())
-        .body(request.body());
+    shared_ptr<PeerLatencyTracker> latencies = node->transport().peerLatencies();
+    shared_ptr<PeerCircuitBreakers> breakers = node->transport().peerBreakers();
+    shared_ptr<ReplicaSelector> selector = node->transport().replicaSelector();
+
+    auto requestBuilder = node->requestBuilder();
+
+    // clang-format off
+    requestBuilder
+        .method(method)
+        .resource(target + resource)
+        .params(query)
+        .header<ShardRouting::ForwardHopsHeader>(hops)
+        .header<ShardRouting::SchemeVersionHeader>(node->routingSchemeVersion())
+        .body(body);
+    // clang-format on
+
+    auto start = chrono::steady_clock::now();
+    auto elapsed = [start]() {
+        return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+    };
+
+    shared_ptr<Forward> self = shared_from_this();
+
+    selector->requestStarted(target);
 
     auto _response = requestBuilder.send();
     _response.then(
-        [&response](Http::Response rsp) {
-            response.send(rsp.code(), rsp.body(), MIME(Application, Json));
+        [self, latencies, breakers, selector, target, elapsed](Http::Response rsp) {
+            latencies->record(target, elapsed());
+            breakers->recordSuccess(target);
+            selector->requestFinished(target);
+
+            if (rsp.code() == ShardRouting::MISDIRECTED &&
+                !rsp.headers().tryGetRaw(ShardRouting::SCHEME_VERSION_HEADER).isEmpty()) {
+                self->misdirected(target, rsp.body());
+                return;
+            }
+
+            {
+                lock_guard<mutex> lk(self->mut);
+                --self->pending;
+                if (self->answered)
+                    return;
+                self->answered = true;
+            }
+
+            if (target == self->hedgeTarget)
+                ++self->node->metrics().hedgeWins;
+
+            self->response.send(rsp.code(), rsp.body(), MIME(Application, Json));
         },
-        Async::IgnoreException);
+        [self, latencies, breakers, selector, target, elapsed](exception_ptr) {
+            latencies->record(target, elapsed());
+            breakers->recordFailure(target);
+            selector->requestFinished(target);
+            self->attemptFailed();
+        });
+}
+
+void
+Forward::misdirected(const string &target, const string &serializedScheme)
+{
+    ShardScheme scheme = ShardSchemeUtility::deserializeScheme(serializedScheme);
+    node->learnRoutingScheme(scheme);
+
+    // Only the node the client asked resends, so the resend is the request's last hop. It goes by
+    // the newest scheme this node knows, which may be the one just learned.
+    string next;
+    if (hops == 1)
+        next = node->keyToOtherNode(key, target);
+
+    bool resend;
+    {
+        lock_guard<mutex> lk(mut);
+        if (!misdirectedScheme || scheme.version() > misdirectedScheme->version())
+            misdirectedScheme = scheme;
+
+        resend = !next.empty() && !resent && !answered;
+        if (resend) {
+            resent = true;
+            ++pending;
+        }
+    }
+
+    if (resend) {
+        ++node->metrics().extraHops;
+        send(next, ShardRouting::MAX_FORWARD_HOPS);
+    }
+
+    attemptFailed();
+}
+
+void
+Forward::attemptFailed()
+{
+    bool gaveUp;
+    optional<ShardScheme> scheme;
+    {
+        lock_guard<mutex> lk(mut);
+        --pending;
+        gaveUp = !answered && pending == 0 && (hedged || hedgeTarget.empty());
+        if (gaveUp)
+            answered = true;
+        scheme = misdirectedScheme;
+    }
 
-    Async::Barrier barrier(_response);
-    barrier.wait();
+    // A failure doesn't wait for the hedge timer.
+    if (!gaveUp) {
+        hedge();
+        return;
+    }
+
+    // A node passing the request on hands the refusal back, so the node the client asked can
+    // resend by the scheme in it. That node tells the client to try again later.
+    if (scheme && hops > 1)
+        sendMisdirected(response, *scheme);
+    else if (scheme)
+        response.send(Http::Code::Service_Unavailable);
+    else
+        response.send(Http::Code::Gateway_Timeout);
+}
+
+void
+Forward::hedge()
+{
+    {
+        lock_guard<mutex> lk(mut);
+        if (hedgeTarget.empty() || hedged || answered)
+            return;
+
+        hedged = true;
+        ++pending;
+    }
+
+    ++node->metrics().hedgedForwards;
+    send(hedgeTarget, hops);
+}
+} // namespace
+
+void
+ParseServer::forwardRequest(const string &dest, const string &key, int hops,
+                            const RestRequest &request, HttpResponse &response)
+{
+    // Hedge after this long if there is no latency estimate for dest yet.
+    const chrono::microseconds DEFAULT_HEDGE_DELAY = 100ms;
+    const chrono::microseconds MIN_HEDGE_DELAY = 2ms;
+
+    shared_ptr<Forward> forward = make_shared<Forward>(mNode, key, hops, request, move(response));
+
+    // Reads can safely be answered by either replica. Writes are never hedged: each replica would
+    // create its own version of the value.
+    if (request.method() == Http::Method::Get)
+        forward->hedgeTarget = mNode->keyToOtherNode(key, dest);
+
+    forward->pending = 1;
+    forward->send(dest, hops);
+
+    // If dest is slow, the request is sent to the other replica too. The Pistache client can't
+    // abort the first request, so whichever answer loses is dropped when it arrives.
+    if (!forward->hedgeTarget.empty()) {
+        shared_ptr<PeerLatencyTracker> latencies = mNode->transport().peerLatencies();
+        chrono::microseconds hedgeDelay =
+            max(latencies->percentile(dest, 0.95).value_or(DEFAULT_HEDGE_DELAY), MIN_HEDGE_DELAY);
+        mNode->runAfter(hedgeDelay, [forward]() { forward->hedge(); });
+    }
+}
+
+void
+ParseServer::redirectRequest(const string &dest, const string &key, const RestRequest &request,
+                             HttpResponse &response)
+{
+    // The scheme can change between picking dest and here; the client follows up either way.
+    ShardScheme scheme = mNode->routingScheme();
+    const ShardInfo &shard = scheme.getResponsibleShardInfo(hash<string>{}(key));
+
+    string members;
+    for (const string &member : shard.getNodeSet())
+        members += (members.empty() ? "" : ",") + member;
+
+    // as_str() starts with '?' if there are parameters.
+    string location = "http://" + dest + request.resource() + request.query().as_str();
+
+    response.headers()
+        .add<Http::Header::Location>(location)
+        .addRaw(Http::Header::Raw(ShardRouting::MEMBERS_HEADER, members))
+        .addRaw(Http::Header::Raw(ShardRouting::SCHEME_VERSION_HEADER,
+                                  to_string(scheme.version())));
+
+    ++mNode->metrics().redirects;
+    response.send(Http::Code::Temporary_Redirect);
 }
 
 void
@@ -423,19 +1016,53 @@ ParseServer::getShardCountImpl(const RestRequest &request, HttpResponse response
     int shardId = request.param(":shardId").as<int>();
     bool success = shardId >= 0 && shardId < mNode->getView()->scheme().getNumShards();
     if (success) {
+        // Give up on the other shard after this long.
+        const chrono::milliseconds COUNT_TIMEOUT = 5s;
+
         size_t count = 0;
 
         if (mNode->getView()->getShardId() == shardId) {
             count = mNode->count();
         } else {
-            const set<string> &shardMembers =
-                mNode->getView()->scheme().getShardInfo(shardId).getNodeSet();
-
-            mNode->sendToRandomNodeUntilSuccess(shardMembers, "/count", "",
-                                                [&count](Pistache::Http::Response r) -> bool {
-                                                    count = atoi(r.body().c_str());
-                                                    return true;
-                                                });
+            shared_ptr<View> view = mNode->getView();
+            const set<string> &shardMembers = view->scheme().getShardInfo(shardId).getNodeSet();
+
+            // Shared with the callbacks, which can run after this function has returned.
+            struct CountState
+            {
+                mutex mut;
+                condition_variable cv;
+                optional<size_t> count;
+            };
+            shared_ptr<CountState> state = make_shared<CountState>();
+            shared_ptr<atomic<bool>> shouldStop = make_shared<atomic<bool>>(false);
+
+            auto attempt = [node = mNode, state](const string &address, function<void(bool)> done) {
+                auto onReply = [state, done](optional<size_t> count) {
+                    if (count) {
+                        lock_guard<mutex> lk(state->mut);
+                        state->count = count;
+                        state->cv.notify_all();
+                    }
+                    done(count.has_value());
+                };
+
+                InterServer::countKeys(node->transport(), address, onReply);
+            };
+
+            mNode->sendToRandomNodeUntilSuccess(shardMembers, attempt, shouldStop);
+
+            auto answered = [&state]() { return state->count.has_value(); };
+
+            unique_lock<mutex> lk(state->mut);
+            if (!state->cv.wait_for(lk, COUNT_TIMEOUT, answered)) {
+                *shouldStop = true;
+                lk.unlock();
+                response.send(Http::Code::Gateway_Timeout);
+                return;
+            }
+
+            count = *state->count;
         }
 
         ostringstream stream;
@@ -455,13 +1082,106 @@ ParseServer::getShardCountImpl(const RestRequest &request, HttpResponse response
     }
 }
 
+void
+ParseServer::getShardSchemeImpl(const RestRequest &request, HttpResponse response)
+{
+    string scheme = ShardSchemeUtility::serializeScheme(mNode->getView()->scheme());
+    response.send(Http::Code::Ok, scheme, MIME(Text, Plain));
+}
+
+void
+ParseServer::getShardMigrationImpl(const RestRequest &request, HttpResponse response)
+{
+    Node::MigrationStatus status = mNode->migrationStatus();
+
+    ostringstream stream;
+    stream << "{" << endl;
+    stream << "\"phase\":\"" << Node::migrationPhaseToString(status.phase) << "\"," << endl;
+    stream << "\"schemeVersion\":" << status.schemeVersion << "," << endl;
+    stream << "\"keysMoved\":" << status.keysMoved << "," << endl;
+    stream << "\"bytesMoved\":" << status.bytesMoved << "," << endl;
+    stream << "\"progress\":" << status.progress << "," << endl;
+    stream << "\"etaSeconds\":" << status.etaSeconds << endl;
+    stream << "}" << endl;
+
+    response.send(Http::Code::Ok, stream.str(), MIME(Application, Json));
+}
+
+void
+ParseServer::getShardPlanImpl(const RestRequest &request, HttpResponse response)
+{
+    size_t numShards = request.param(":numShards").as<size_t>();
+    optional<Node::ReshardPlan> plan = mNode->planReshard(numShards);
+
+    if (!plan) {
+        ostringstream stream;
+        stream << "{" << endl;
+        stream << "\"result\":\"Error\"," << endl;
+        stream << "\"msg\":\"Not enough nodes for " << numShards << " fault tolerant shards\""
+               << endl;
+        stream << "}" << endl;
+
+        response.send(Http::Code::Bad_Request, stream.str(), MIME(Application, Json));
+        return;
+    }
+
+    uint64_t movedKeys = 0;
+    uint64_t movedBytes = 0;
+
+    // Only pairs with keys are listed. Shards that didn't answer are listed as missing.
+    ostringstream stream;
+    stream << "{" << endl;
+    stream << "\"result\":\"Success\"," << endl;
+    stream << "\"schemeVersion\":" << plan->schemeVersion << "," << endl;
+    stream << "\"pairs\":[";
+
+    bool first = true;
+    vector<size_t> missing;
+    for (size_t from = 0; from < plan->loads.size(); ++from) {
+        if (plan->loads[from].empty())
+            missing.push_back(from);
+
+        for (size_t to = 0; to < plan->loads[from].size(); ++to) {
+            const InterServer::ShardLoad &load = plan->loads[from][to];
+            if (load.numKeys == 0)
+                continue;
+
+            bool moved = to < plan->moved[from].size() && plan->moved[from][to];
+            if (moved) {
+                movedKeys += load.numKeys;
+                movedBytes += load.numBytes;
+            }
+
+            stream << (first ? "" : ",") << endl;
+            stream << "{\"from\":" << from << ",\"to\":" << to << ",\"keys\":" << load.numKeys
+                   << ",\"bytes\":" << load.numBytes << ",\"moved\":" << (moved ? "true" : "false")
+                   << "}";
+            first = false;
+        }
+    }
+    stream << endl << "]," << endl;
+
+    stream << "\"missingShards\":[";
+    for (size_t idx = 0; idx < missing.size(); ++idx)
+        stream << (idx == 0 ? "" : ",") << missing[idx];
+    stream << "]," << endl;
+
+    stream << "\"movedKeys\":" << movedKeys << "," << endl;
+    stream << "\"movedBytes\":" << movedBytes << "," << endl;
+    stream << "\"bytesPerSecond\":" << plan->bytesPerSecond << "," << endl;
+    stream << "\"etaSeconds\":" << plan->etaSeconds << endl;
+    stream << "}" << endl;
+
+    response.send(Http::Code::Ok, stream.str(), MIME(Application, Json));
+}
+
 void
 ParseServer::putShardChangeNumberImpl(const RestRequest &request, HttpResponse response)
 {
     size_t numShards = atoi(getParam(request, "num").c_str());
-    bool result = mNode->reshard(numShards);
+    Node::ViewChange change = mNode->reshard(numShards);
 
-    if (result) {
+    if (change == Node::ViewChange::Done) {
         ostringstream stream;
         stream << "{" << endl;
         stream << "\"result\":\"Success\"," << endl;
@@ -472,6 +1192,14 @@ ParseServer::putShardChangeNumberImpl(const RestRequest &request, HttpResponse r
         stream << "}" << endl;
 
         response.send(Http::Code::Ok, stream.str(), MIME(Application, Json));
+    } else if (change == Node::ViewChange::Superseded) {
+        ostringstream stream;
+        stream << "{" << endl;
+        stream << "\"result\":\"Error\"," << endl;
+        stream << "\"msg\":\"" << SUPERSEDED_MSG << "\"" << endl;
+        stream << "}" << endl;
+
+        response.send(viewChangeCode(change), stream.str(), MIME(Application, Json));
     } else {
         ostringstream stream;
         stream << "{" << endl;
@@ -534,3 +1262,35 @@ ParseServer::shardMoveImpl(const RestRequest &request, HttpResponse response)
     else
         response.send(Http::Code::Payment_Required);
 }
+
+void
+ParseServer::shardPlanImpl(const RestRequest &request, HttpResponse response)
+{
+    ShardScheme scheme = ShardSchemeUtility::deserializeScheme(request.body());
+
+    ostringstream stream;
+    for (const InterServer::ShardLoad &load : mNode->loadByShard(scheme))
+        stream << load.numKeys << " " << load.numBytes << " ";
+
+    response.send(Http::Code::Ok, stream.str(), MIME(Text, Plain));
+}
+
+void
+ParseServer::shardMoveBatchImpl(const RestRequest &request, HttpResponse response)
+{
+    const string &body = request.body();
+
+    size_t ampersand = body.find('&');
+    int version;
+    if (ampersand == string::npos || !parseVersion(body.substr(0, ampersand), version)) {
+        response.send(Http::Code::Bad_Request);
+        return;
+    }
+
+    Node::DataStore data = dataStringToMap(body.substr(ampersand + 1));
+
+    if (mNode->reshardMoveBatch(version, data))
+        response.send(Http::Code::Ok);
+    else
+        response.send(Http::Code::Payment_Required);
+}
@@ -1,4 +1,5 @@
 #include "Node.h"
+#include "RpcProtocol.h"
 #include "VectorClock.h"
 
 #include <memory>
@@ -15,14 +16,30 @@ class ParseServer
     using string = std::string;
 
 public:
+    /// Where clients send batches of keys (see getBatchImpl()).
+    static constexpr const char *BATCH_RESOURCE = "/batch/keyValue-store";
+
     ParseServer(std::shared_ptr<Node> node);
 
     /// Gets the HTTP handler for this server. Set this as the handler
     /// of an Http::Endpoint.
     std::shared_ptr<Pistache::Http::Handler> handler() const;
 
+    /// Answers an inter-server RPC (see RpcServer). Does the same as the matching
+    /// /inter_server/ route.
+    RpcStatus handleRpc(RpcOp op, RpcReader &request, RpcWriter &reply);
+
 private:
+    using Handler = void (ParseServer::*)(const RestRequest &request, HttpResponse response);
+
     // KVS:
+    /// Runs the handler on the request again once this node has switched to a scheme of at least
+    /// newVersion. Meanwhile the request is parked without a thread (see
+    /// Node::whenSchemeVersion()); if the switch takes too long, the client gets
+    /// Service_Unavailable.
+    void retryAfterSchemeChange(int newVersion, Handler handler, const RestRequest &request,
+                                HttpResponse &response);
+
     void putElementImpl(const RestRequest &request, HttpResponse response);
 
     void getElementImpl(const RestRequest &request, HttpResponse response);
@@ -31,27 +48,72 @@ private:
 
     void delElementImpl(const RestRequest &request, HttpResponse response);
 
+    // KVS batches (ParseServerBatch.cpp):
+    /// Gets or puts many keys in one request. The body has a key= parameter per key, each followed
+    /// by its val= for puts, and one payload= (and w=) for the whole batch. The answer has a result
+    /// per key, in order, and the payload merged from every part.
+    ///
+    /// The keys are split by the shard that owns them. Each other shard gets its part in one
+    /// request, sent in parallel, while this node serves its own part with one lock acquisition.
+    void getBatchImpl(const RestRequest &request, HttpResponse response);
+    void putBatchImpl(const RestRequest &request, HttpResponse response);
+
+    void runBatch(bool isPut, const RestRequest &request, HttpResponse &response);
+
     // VIEW:
     void getViewImpl(const RestRequest &request, HttpResponse response);
 
     void addViewImpl(const RestRequest &request, HttpResponse response);
 
     void delViewImpl(const RestRequest &request, HttpResponse response);
+    /// Adds the nodes in "add" and removes the nodes in "remove" (both comma-separated) with a
+    /// single scheme change.
+    void patchViewImpl(const RestRequest &request, HttpResponse response);
 
     //Shard
     void getShardMyIdImpl(const RestRequest &request, HttpResponse response);
     void getShardAllIdsImpl(const RestRequest &request, HttpResponse response);
     void getShardMembersImpl(const RestRequest &request, HttpResponse response);
     void getShardCountImpl(const RestRequest &request, HttpResponse response);
+    void getShardSchemeImpl(const RestRequest &request, HttpResponse response);
+    /// Progress of this node's part in the current or last reshard, as JSON.
+    void getShardMigrationImpl(const RestRequest &request, HttpResponse response);
+    /// What changing to numShards shards would move and how long it would take, as JSON.
+    /// Changes nothing.
+    void getShardPlanImpl(const RestRequest &request, HttpResponse response);
     void putShardChangeNumberImpl(const RestRequest &request, HttpResponse response);
 
+    // METRICS:
+    void getMetricsImpl(const RestRequest &request, HttpResponse response);
+
     // INTERSERVER:
     void patchInterImpl(const RestRequest &request, HttpResponse response);
 
     void patchSyncPush(const RestRequest &request, HttpResponse response);
 
+    void patchCountImpl(const RestRequest &request, HttpResponse response);
+
     //Forwarding:
-    void forwardRequest(const string &dest, const RestRequest &request, HttpResponse &response);
+    /// If the key is owned by another shard, sends the request on (or redirects the client) and
+    /// returns true. A request another node forwarded here is passed on only as its second hop and
+    /// only if this node's scheme is newer than the sender's; otherwise the sender gets this node's
+    /// scheme (see ShardRouting.h). Returns false if this node should serve the request.
+    bool routeElsewhere(const string &key, const RestRequest &request, HttpResponse &response);
+
+    /// Sends the request to dest as its hops'th hop and relays the answer. Reads that dest is slow
+    /// to answer (past its 95th percentile latency) are also sent to another replica of the key's
+    /// shard, and whichever answer arrives first is used.
+    ///
+    /// Does not block: the response is moved out and sent from the callback of the first answer,
+    /// so the HTTP worker thread is free for other requests while the forward is in flight.
+    void forwardRequest(const string &dest, const string &key, int hops,
+                        const RestRequest &request, HttpResponse &response);
+
+    /// Answers a request for a key owned by dest's shard with a redirect to dest, along with the
+    /// shard's members and the scheme version (see ShardRouting.h). Used instead of
+    /// forwardRequest() when the client asks for it.
+    void redirectRequest(const string &dest, const string &key, const RestRequest &request,
+                         HttpResponse &response);
 
     // INTERSERVER SHARDS:
     void shardPrepareImpl(const RestRequest &request, HttpResponse response);
@@ -59,6 +121,8 @@ private:
     void shardSwitchImpl(const RestRequest &request, HttpResponse response);
 
     void shardMoveImpl(const RestRequest &request, HttpResponse response);
+    void shardMoveBatchImpl(const RestRequest &request, HttpResponse response);
+    void shardPlanImpl(const RestRequest &request, HttpResponse response);
 
     std::shared_ptr<Node> mNode;
     std::shared_ptr<HttpRouter> mRouter;
@@ -0,0 +1,431 @@
+#include "ParseServer.h"
+
+#include "ParsingHelpers.h"
+#include "ShardRouting.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+using namespace Pistache;
+using namespace std;
+
+namespace
+{
+// How long the node the client asked waits for the other shards' parts of a batch.
+const chrono::milliseconds PART_TIMEOUT(3000);
+
+/// What happened to one key of a batch. Nodes send each other its number.
+enum class BatchStatus
+{
+    Found,
+    NotFound,
+    Created,
+    Replaced,
+    KeyNotValid,
+
+    /// The key's owner is changing and the node couldn't pass it on; the client should try again.
+    Misdirected,
+
+    /// The owner didn't answer in time.
+    Failed,
+
+    /// The owner wrote the key, but not enough replicas acknowledged it in time.
+    Unconfirmed
+};
+
+struct BatchResult
+{
+    BatchStatus status = BatchStatus::Failed;
+
+    /// The value, if the status is Found.
+    string value;
+};
+
+struct Batch
+{
+    bool isPut;
+    vector<string> keys;
+
+    /// One per key for puts, none for gets.
+    vector<string> values;
+
+    string payload;
+    string writeMode;
+};
+
+/// The results of a batch, filled in by this node and by the answers of the other shards. Whoever
+/// finishes the last part answers the request (see finishPart()).
+struct Gather
+{
+    Gather(Batch &&batch, bool fromOtherNode, const VectorClock &payload,
+           Http::ResponseWriter &&response)
+        : batch(move(batch))
+        , fromOtherNode(fromOtherNode)
+        , response(move(response))
+        , results(this->batch.keys.size())
+        , clock(payload)
+    {
+    }
+
+    const Batch batch;
+
+    /// Whether another node sent the batch, which gets its answer encoded by encodeResults().
+    const bool fromOtherNode;
+
+    Http::ResponseWriter response;
+
+    /// Protects the fields below.
+    mutex mut;
+
+    /// Parts that haven't finished, this node's own included.
+    size_t pending = 0;
+
+    vector<BatchResult> results;
+
+    /// The payload merged with the clock of every part's answer.
+    VectorClock clock;
+};
+
+/// Parses a body with a key= parameter per key, each followed by its val= for puts. Returns
+/// nothing if a put's keys and values don't pair up.
+optional<Batch>
+parseBatch(bool isPut, const string &body)
+{
+    Batch batch;
+    batch.isPut = isPut;
+
+    for (auto &param : parseFormParams(body)) {
+        if (param.first == "key") {
+            batch.keys.push_back(move(param.second));
+        } else if (param.first == "val") {
+            if (!isPut || batch.values.size() + 1 != batch.keys.size())
+                return nullopt;
+            batch.values.push_back(move(param.second));
+        } else if (param.first == "payload") {
+            batch.payload = move(param.second);
+        } else if (param.first == "w") {
+            batch.writeMode = move(param.second);
+        }
+    }
+
+    if (isPut && batch.values.size() != batch.keys.size())
+        return nullopt;
+
+    return batch;
+}
+
+/// Encodes the keys at indexes (with their values) as a batch body.
+string
+encodeBatch(const Batch &batch, const vector<size_t> &indexes)
+{
+    string body = "payload=" + HTTPify(batch.payload);
+    if (!batch.writeMode.empty())
+        body += "&w=" + HTTPify(batch.writeMode);
+
+    for (size_t idx : indexes) {
+        body += "&key=" + HTTPify(batch.keys[idx]);
+        if (batch.isPut)
+            body += "&val=" + HTTPify(batch.values[idx]);
+    }
+
+    return body;
+}
+
+/// Encodes the answer to a part of a batch sent by another node: the clock, then a line per key
+/// with the status and value. Both are HTTPified, so they have no line breaks or spaces.
+string
+encodeResults(const vector<BatchResult> &results, const VectorClock &clock)
+{
+    string body = HTTPify(clock.toString()) + "\n";
+    for (const BatchResult &result : results)
+        body += to_string((int)result.status) + " " + HTTPify(result.value) + "\n";
+    return body;
+}
+
+/// Reads the answer to a part into the results of the keys at indexes. Keys without a line keep
+/// their results.
+void
+decodeResults(const string &body, const vector<size_t> &indexes, Gather &gather)
+{
+    istringstream stream(body);
+
+    string clockString;
+    if (!getline(stream, clockString))
+        return;
+    VectorClock clock = VectorClock::fromString(unHTTPify(clockString));
+    gather.clock = VectorClock::merge(gather.clock, clock);
+
+    string line;
+    for (size_t idx : indexes) {
+        if (!getline(stream, line))
+            return;
+
+        size_t space = line.find(' ');
+        if (space == string::npos)
+            return;
+
+        BatchResult &result = gather.results[idx];
+        result.status = (BatchStatus)atoi(line.substr(0, space).c_str());
+        result.value = unHTTPify(line.substr(space + 1));
+    }
+}
+
+/// Encodes the answer for the client: a result per key, in order, and the merged payload.
+string
+resultsToJson(const Batch &batch, const vector<BatchResult> &results, const VectorClock &clock)
+{
+    ostringstream stream;
+    stream << "{" << endl;
+    stream << "\"results\":[" << endl;
+
+    for (size_t idx = 0; idx < results.size(); ++idx) {
+        stream << "{\"key\":\"" << batch.keys[idx] << "\",";
+
+        switch (results[idx].status) {
+        case BatchStatus::Found:
+            stream << "\"result\":\"Success\",\"value\":\"" << results[idx].value << "\"}";
+            break;
+        case BatchStatus::NotFound:
+            stream << "\"result\":\"Error\",\"msg\":\"Key does not exist\"}";
+            break;
+        case BatchStatus::Created:
+            stream << "\"result\":\"Success\",\"replaced\":false}";
+            break;
+        case BatchStatus::Replaced:
+            stream << "\"result\":\"Success\",\"replaced\":true}";
+            break;
+        case BatchStatus::KeyNotValid:
+            stream << "\"result\":\"Error\",\"msg\":\"Key not valid\"}";
+            break;
+        case BatchStatus::Misdirected:
+            stream << "\"result\":\"Error\",\"msg\":\"Shard scheme is changing, try again\"}";
+            break;
+        case BatchStatus::Unconfirmed:
+            stream << "\"result\":\"Unconfirmed\",\"msg\":\"Not acknowledged by enough replicas\"}";
+            break;
+        case BatchStatus::Failed:
+        default:
+            stream << "\"result\":\"Error\",\"msg\":\"Owner did not answer\"}";
+            break;
+        }
+
+        stream << (idx + 1 < results.size() ? "," : "") << endl;
+    }
+
+    stream << "]," << endl;
+    stream << "\"payload\":\"" << clock.toString() << "\"" << endl;
+    stream << "}" << endl;
+    return stream.str();
+}
+
+/// Counts one part of the batch as finished, and answers the request if it was the last.
+void
+finishPart(const shared_ptr<Gather> &gather)
+{
+    {
+        lock_guard<mutex> lk(gather->mut);
+        if (--gather->pending != 0)
+            return;
+    }
+
+    // Nothing else touches the results once every part has finished.
+    if (gather->fromOtherNode)
+        gather->response.send(Http::Code::Ok, encodeResults(gather->results, gather->clock),
+                              MIME(Text, Plain));
+    else
+        gather->response.send(Http::Code::Ok,
+                              resultsToJson(gather->batch, gather->results, gather->clock),
+                              MIME(Application, Json));
+}
+
+/// Sends the keys at indexes, which all belong to one other shard, to a member of it as their
+/// hops'th hop. The answer is put in gather when it arrives, or after PART_TIMEOUT the keys keep
+/// their Failed results; either way the part is finished then.
+void
+sendPart(const shared_ptr<Node> &node, const vector<size_t> &indexes, int hops,
+         const shared_ptr<Gather> &gather)
+{
+    const Batch &batch = gather->batch;
+    string target = node->keyToNode(batch.keys[indexes[0]]);
+    shared_ptr<PeerCircuitBreakers> breakers = node->transport().peerBreakers();
+    shared_ptr<ReplicaSelector> selector = node->transport().replicaSelector();
+
+    auto requestBuilder = node->requestBuilder();
+
+    // clang-format off
+    requestBuilder
+        .method(batch.isPut ? Http::Method::Put : Http::Method::Get)
+        .resource(target + ParseServer::BATCH_RESOURCE)
+        .header<ShardRouting::ForwardHopsHeader>(hops)
+        .header<ShardRouting::SchemeVersionHeader>(node->routingSchemeVersion())
+        .body(encodeBatch(batch, indexes))
+        .timeout(PART_TIMEOUT);
+    // clang-format on
+
+    selector->requestStarted(target);
+
+    auto _response = requestBuilder.send();
+    _response.then(
+        [gather, breakers, selector, target, indexes](Http::Response rsp) {
+            breakers->recordSuccess(target);
+            selector->requestFinished(target);
+
+            if (rsp.code() == Http::Code::Ok) {
+                lock_guard<mutex> lk(gather->mut);
+                decodeResults(rsp.body(), indexes, *gather);
+            }
+            finishPart(gather);
+        },
+        [gather, breakers, selector, target](exception_ptr) {
+            breakers->recordFailure(target);
+            selector->requestFinished(target);
+            finishPart(gather);
+        });
+}
+
+/// Puts the keys at indexes, which belong to this node's shard, and fills in their results.
+void
+putLocalPart(Node &node, const vector<size_t> &indexes, const VectorClock &payload,
+             optional<Node::WriteMode> writeMode, Gather &gather)
+{
+    const Batch &batch = gather.batch;
+    vector<pair<string, string>> entries;
+    entries.reserve(indexes.size());
+    for (size_t idx : indexes)
+        entries.emplace_back(batch.keys[idx], batch.values[idx]);
+
+    auto putResult = node.putElements(entries, payload, writeMode);
+
+    lock_guard<mutex> lk(gather.mut);
+    if (putResult.isBadRequest())
+        return;
+
+    for (size_t pos = 0; pos < indexes.size(); ++pos) {
+        BatchResult &result = gather.results[indexes[pos]];
+        switch (putResult.value[pos]) {
+        case Node::PutSuccessType::CreatedNewValue:
+            result.status =
+                putResult.isUnconfirmed() ? BatchStatus::Unconfirmed : BatchStatus::Created;
+            break;
+        case Node::PutSuccessType::UpdatedExistingValue:
+            result.status =
+                putResult.isUnconfirmed() ? BatchStatus::Unconfirmed : BatchStatus::Replaced;
+            break;
+        default:
+            result.status = BatchStatus::KeyNotValid;
+            break;
+        }
+    }
+
+    gather.clock = VectorClock::merge(gather.clock, putResult.clock);
+}
+
+/// Reads the keys at indexes, which belong to this node's shard, and fills in their results.
+void
+getLocalPart(Node &node, const vector<size_t> &indexes, const VectorClock &payload,
+             Gather &gather)
+{
+    const Batch &batch = gather.batch;
+    vector<string> keys;
+    keys.reserve(indexes.size());
+    for (size_t idx : indexes)
+        keys.push_back(batch.keys[idx]);
+
+    auto getResult = node.getElements(keys, payload);
+
+    lock_guard<mutex> lk(gather.mut);
+    if (getResult.isBadRequest())
+        return;
+
+    // Another replica has switched to a newer scheme, under which the keys may belong to other
+    // shards. Rather than hold the thread until this node switches too, the client is told to
+    // try them again.
+    if (getResult.hasWrongSchemeVersion()) {
+        for (size_t idx : indexes)
+            gather.results[idx].status = BatchStatus::Misdirected;
+        return;
+    }
+
+    for (size_t pos = 0; pos < indexes.size(); ++pos) {
+        BatchResult &result = gather.results[indexes[pos]];
+        result.status = getResult.value[pos] ? BatchStatus::Found : BatchStatus::NotFound;
+        result.value = getResult.value[pos].value_or("");
+    }
+
+    gather.clock = VectorClock::merge(gather.clock, getResult.clock);
+}
+} // namespace
+
+void
+ParseServer::getBatchImpl(const RestRequest &request, HttpResponse response)
+{
+    runBatch(false, request, response);
+}
+
+void
+ParseServer::putBatchImpl(const RestRequest &request, HttpResponse response)
+{
+    runBatch(true, request, response);
+}
+
+void
+ParseServer::runBatch(bool isPut, const RestRequest &request, HttpResponse &response)
+{
+    optional<Batch> batch = parseBatch(isPut, request.body());
+    optional<Node::WriteMode> writeMode = stringToWriteMode(batch ? batch->writeMode : "");
+    if (!batch || (!batch->writeMode.empty() && !writeMode)) {
+        response.send(Http::Code::Bad_Request);
+        return;
+    }
+
+    // Set if another node sent this part of a batch; the same rules as for single keys decide
+    // whether keys it doesn't own are passed on (see routeElsewhere()).
+    optional<int> hops = getIntHeader(request, ShardRouting::FORWARD_HOPS_HEADER);
+    optional<int> senderVersion = getIntHeader(request, ShardRouting::SCHEME_VERSION_HEADER);
+
+    VectorClock payload = VectorClock::fromString(batch->payload);
+    shared_ptr<Gather> gather =
+        make_shared<Gather>(move(*batch), hops.has_value(), payload, move(response));
+    const vector<string> &keys = gather->batch.keys;
+
+    ShardScheme scheme = mNode->routingScheme();
+    bool canPassOn = !hops || (*hops < ShardRouting::MAX_FORWARD_HOPS &&
+                               scheme.version() > senderVersion.value_or(-1));
+
+    vector<size_t> local;
+
+    // Keys owned by other shards, by shard id.
+    map<size_t, vector<size_t>> remote;
+
+    for (size_t idx = 0; idx < keys.size(); ++idx) {
+        const string &key = keys[idx];
+        if (mNode->keyToNode(key).empty())
+            local.push_back(idx);
+        else if (canPassOn)
+            remote[scheme.getResponsibleShardId(hash<string>{}(key))].push_back(idx);
+        else
+            gather->results[idx].status = BatchStatus::Misdirected;
+    }
+
+    if (hops && !remote.empty())
+        ++mNode->metrics().extraHops;
+
+    // The other shards work on their parts while this node does its own. Nothing waits for them:
+    // the last part to finish answers the request.
+    {
+        lock_guard<mutex> lk(gather->mut);
+        gather->pending = remote.size() + 1;
+    }
+    for (const auto &shardKeys : remote)
+        sendPart(mNode, shardKeys.second, hops.value_or(0) + 1, gather);
+
+    if (!local.empty() && isPut)
+        putLocalPart(*mNode, local, payload, writeMode, *gather);
+    else if (!local.empty())
+        getLocalPart(*mNode, local, payload, *gather);
+
+    finishPart(gather);
+}
@@ -38,6 +38,27 @@ unHTTPify(const string &strWithPluses)
     return out;
 }
 
+string
+HTTPify(const string &str)
+{
+    const char *HEX_DIGITS = "0123456789ABCDEF";
+
+    string out;
+    for (unsigned char c : str) {
+        if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            out += (char)c;
+        } else if (c == ' ') {
+            out += '+';
+        } else {
+            out += '%';
+            out += HEX_DIGITS[c >> 4];
+            out += HEX_DIGITS[c & 15];
+        }
+    }
+
+    return out;
+}
+
 typename Node::DataVersion
 stringToDataVersion(const string &str)
 {
@@ -88,6 +109,8 @@ dataStringToMap(const string &str)
             break;
         string key = str.substr(lastPos, p - lastPos);
         int end = str.find_first_of('$', p + 1);
+        if (end == string::npos)
+            break;
         string rest = str.substr(p + 1, end - p - 1);
 
         lastPos = end + 1;
@@ -98,20 +121,39 @@ dataStringToMap(const string &str)
     return ret;
 }
 
+string
+dataEntryToString(const string &key, const Node::DataVersion &dataVersion)
+{
+    string ret = key;
+    ret += '|';
+    ret += dataVersionToString(dataVersion);
+    ret += '$';
+
+    return ret;
+}
+
 string
 mapToDataString(const unordered_map<string, typename Node::DataVersion> &map)
 {
     string ret;
-    for (auto it = map.begin(); it != map.end(); ++it) {
-        ret += it->first;
-        ret += '|';
-        ret += dataVersionToString(it->second);
-        ret += '$';
-    }
+    for (auto it = map.begin(); it != map.end(); ++it)
+        ret += dataEntryToString(it->first, it->second);
 
     return ret;
 }
 
+optional<Node::WriteMode>
+stringToWriteMode(const string &str)
+{
+    if (str == "1")
+        return Node::WriteMode::One;
+    if (str == "quorum")
+        return Node::WriteMode::Quorum;
+    if (str == "all")
+        return Node::WriteMode::All;
+    return {};
+}
+
 /// Removes surrounding whitespace from string.
 string
 trim(const string &str)
@@ -187,6 +229,33 @@ getParam(const string &paramString, const string &paramName)
     }
 }
 
+vector<pair<string, string>>
+parseFormParams(const string &paramString)
+{
+    vector<pair<string, string>> params;
+
+    size_t paramStart = 0;
+    while (paramStart < paramString.size()) {
+        size_t paramEnd = paramString.find('&', paramStart);
+        if (paramEnd == string::npos)
+            paramEnd = paramString.size();
+
+        string param = paramString.substr(paramStart, paramEnd - paramStart);
+        size_t equals = param.find('=');
+
+        // Decoded after splitting, so names and values may contain encoded '&' and '='.
+        if (equals == string::npos)
+            params.emplace_back(unHTTPify(param), "");
+        else
+            params.emplace_back(unHTTPify(param.substr(0, equals)),
+                                unHTTPify(param.substr(equals + 1)));
+
+        paramStart = paramEnd + 1;
+    }
+
+    return params;
+}
+
 /// Parses the request body for a parameter.
 string
 getParam(const Pistache::Http::Request &request, const string &paramName)
@@ -194,6 +263,15 @@ getParam(const Pistache::Http::Request &request, const string &paramName)
     return getParam(unHTTPify(request.body()), paramName);
 }
 
+optional<int>
+getIntHeader(const Pistache::Http::Request &request, const string &name)
+{
+    auto header = request.headers().tryGetRaw(name);
+    if (header.isEmpty())
+        return nullopt;
+    return atoi(header.get().value().c_str());
+}
+
 string
 escapeChars(string_view str, string_view charsWithoutBackslash)
 {
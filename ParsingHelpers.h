@@ -4,6 +4,7 @@
 #include "VectorClock.h"
 
 #include <cctype>
+#include <optional>
 #include <pistache/endpoint.h>
 #include <string>
 #include <unordered_map>
@@ -14,6 +15,10 @@ typename Node::DataVersion stringToDataVersion(const std::string &str);
 
 std::string unHTTPify(const std::string &str);
 
+/// Encodes str as a form value: unreserved characters are kept, spaces become pluses and
+/// everything else becomes %XX. Inverse of unHTTPify().
+std::string HTTPify(const std::string &str);
+
 std::string dataVersionToString(const Node::DataVersion &dataVersion);
 
 std::pair<Node::DataVersion, int> stringTodataVersionAndSchemeVersion(const std::string &str);
@@ -22,8 +27,15 @@ std::string dataVersionAndSchemeVersionToString(const std::pair<Node::DataVersio
 
 std::unordered_map<std::string, typename Node::DataVersion> dataStringToMap(const std::string &str);
 
+/// Writes a single entry in the format used by mapToDataString(). Concatenating entries gives a
+/// string that dataStringToMap() can read.
+std::string dataEntryToString(const std::string &key, const Node::DataVersion &dataVersion);
+
 std::string mapToDataString(const std::unordered_map<std::string, typename Node::DataVersion> &map);
 
+/// Parses "1", "quorum" or "all". Returns nothing for anything else.
+std::optional<Node::WriteMode> stringToWriteMode(const std::string &str);
+
 /// Removes surrounding whitespace from string.
 std::string trim(const std::string &str);
 
@@ -35,9 +47,16 @@ std::vector<std::string> splitByCommas(const std::string &str);
 /// empty string is returned.
 std::string getParam(const std::string &paramString, const std::string &paramName);
 
+/// Splits a form-encoded string ("name1=value1&name2=value2&...") into its (name, value) pairs, in
+/// order and decoded. Unlike getParam(), names may repeat and values may contain encoded '&'.
+std::vector<std::pair<std::string, std::string>> parseFormParams(const std::string &paramString);
+
 /// Parses the request body for a parameter.
 std::string getParam(const Pistache::Http::Request &request, const std::string &paramName);
 
+/// Returns the value of an integer header, or nothing if the request doesn't have it.
+std::optional<int> getIntHeader(const Pistache::Http::Request &request, const std::string &name);
+
 /// Prepends a backslash to every character in str that should be escaped (specified by chars).
 std::string escapeChars(std::string_view str, std::string_view chars);
 
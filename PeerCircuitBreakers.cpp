@@ -0,0 +1,154 @@
+#include "PeerCircuitBreakers.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+// Consecutive failures that open a closed breaker.
+const size_t FAILURE_THRESHOLD = 5;
+
+// How long a breaker stays open the first time, and at most.
+const chrono::milliseconds MIN_OPEN_DURATION(500);
+const chrono::milliseconds MAX_OPEN_DURATION(30000);
+} // namespace
+
+bool
+PeerCircuitBreakers::allowRequest(const string &address)
+{
+    lock_guard<mutex> lock(mMutex);
+
+    auto it = mBreakers.find(address);
+    if (it == mBreakers.end())
+        return true;
+
+    Breaker &breaker = it->second;
+
+    switch (breaker.state) {
+    case State::Closed:
+        return true;
+
+    case State::Open:
+        if (Clock::now() < breaker.openUntil)
+            return false;
+
+        breaker.state = State::HalfOpen;
+        breaker.probeInFlight = true;
+        return true;
+
+    case State::HalfOpen:
+    default:
+        if (breaker.probeInFlight)
+            return false;
+
+        breaker.probeInFlight = true;
+        return true;
+    }
+}
+
+bool
+PeerCircuitBreakers::isOpen(const string &address) const
+{
+    lock_guard<mutex> lock(mMutex);
+
+    auto it = mBreakers.find(address);
+    return it != mBreakers.end() && it->second.state == State::Open &&
+           Clock::now() < it->second.openUntil;
+}
+
+void
+PeerCircuitBreakers::cancelRequest(const string &address)
+{
+    lock_guard<mutex> lock(mMutex);
+
+    auto it = mBreakers.find(address);
+    if (it != mBreakers.end() && it->second.state == State::HalfOpen)
+        it->second.probeInFlight = false;
+}
+
+void
+PeerCircuitBreakers::recordSuccess(const string &address)
+{
+    lock_guard<mutex> lock(mMutex);
+
+    auto it = mBreakers.find(address);
+    if (it == mBreakers.end())
+        return;
+
+    // Forget everything about the peer; it is healthy.
+    mBreakers.erase(it);
+}
+
+void
+PeerCircuitBreakers::recordFailure(const string &address)
+{
+    lock_guard<mutex> lock(mMutex);
+
+    Breaker &breaker = mBreakers[address];
+
+    switch (breaker.state) {
+    case State::Closed:
+        if (++breaker.consecutiveFailures >= FAILURE_THRESHOLD)
+            trip(breaker);
+        break;
+
+    case State::HalfOpen:
+        // The probe failed.
+        trip(breaker);
+        break;
+
+    case State::Open:
+    default:
+        // A message that was sent before the breaker opened.
+        break;
+    }
+}
+
+PeerCircuitBreakers::State
+PeerCircuitBreakers::state(const string &address) const
+{
+    lock_guard<mutex> lock(mMutex);
+
+    auto it = mBreakers.find(address);
+    return it == mBreakers.end() ? State::Closed : it->second.state;
+}
+
+vector<string>
+PeerCircuitBreakers::addresses() const
+{
+    lock_guard<mutex> lock(mMutex);
+
+    vector<string> addresses;
+    for (const auto &entry : mBreakers)
+        addresses.push_back(entry.first);
+
+    return addresses;
+}
+
+const char *
+PeerCircuitBreakers::stateToString(State state)
+{
+    switch (state) {
+    case State::Closed:
+        return "closed";
+    case State::Open:
+        return "open";
+    case State::HalfOpen:
+    default:
+        return "half-open";
+    }
+}
+
+void
+PeerCircuitBreakers::trip(Breaker &breaker)
+{
+    if (breaker.state == State::Closed)
+        breaker.openDuration = MIN_OPEN_DURATION;
+    else
+        breaker.openDuration = min(breaker.openDuration * 2, MAX_OPEN_DURATION);
+
+    breaker.state = State::Open;
+    breaker.probeInFlight = false;
+    breaker.openUntil = Clock::now() + breaker.openDuration;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Thrown (as a promise rejection) for messages that were not sent because the destination's
+/// circuit breaker is open.
+class PeerUnavailableError : public std::runtime_error
+{
+public:
+    PeerUnavailableError(const std::string &address)
+        : std::runtime_error(address + " is unavailable")
+    {
+    }
+};
+
+/// A circuit breaker for every node we talk to. After enough consecutive failures a peer's
+/// breaker opens and messages to it fail immediately instead of waiting for a timeout. Once the
+/// open period has passed, a single probe message is let through (half-open); if it succeeds the
+/// breaker closes, otherwise it opens again for twice as long.
+///
+/// Thread-safe.
+class PeerCircuitBreakers
+{
+public:
+    enum class State
+    {
+        Closed,
+        Open,
+        HalfOpen
+    };
+
+    /// Returns whether a message may be sent to the address now. When the open period of the
+    /// address has passed, this lets one probe through and returns false to everybody else until
+    /// the probe's result is recorded.
+    bool allowRequest(const std::string &address);
+
+    /// Returns whether the address' breaker is open and not yet due for a probe. Unlike
+    /// allowRequest(), this never changes anything.
+    bool isOpen(const std::string &address) const;
+
+    /// Gives back a request that allowRequest() let through but that was never sent, so that the
+    /// next request can be the probe instead.
+    void cancelRequest(const std::string &address);
+
+    /// Records that a message to the address got an answer.
+    void recordSuccess(const std::string &address);
+
+    /// Records that a message to the address failed or timed out.
+    void recordFailure(const std::string &address);
+
+    State state(const std::string &address) const;
+
+    /// Returns every address that has a breaker.
+    std::vector<std::string> addresses() const;
+
+    static const char *stateToString(State state);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Breaker
+    {
+        State state = State::Closed;
+        size_t consecutiveFailures = 0;
+        bool probeInFlight = false;
+        std::chrono::milliseconds openDuration{0};
+        Clock::time_point openUntil;
+    };
+
+    /// Opens the breaker, doubling the open period if it was already open or half-open. Assumes
+    /// mMutex is held.
+    void trip(Breaker &breaker);
+
+    mutable std::mutex mMutex;
+    std::unordered_map<std::string, Breaker> mBreakers;
+};
@@ -0,0 +1,99 @@
+#include "PeerLatencyTracker.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+// Weight of a new sample in the moving average.
+const double EWMA_ALPHA = 0.2;
+
+// Number of recent samples kept per address for percentiles.
+const size_t WINDOW_SIZE = 256;
+
+// Percentiles are not reported with fewer samples than this.
+const size_t MIN_SAMPLES = 16;
+
+// Timeouts are this many times the 99th percentile, within the bounds below.
+const int TIMEOUT_MULTIPLIER = 3;
+const chrono::milliseconds MIN_TIMEOUT(100);
+const chrono::milliseconds MAX_TIMEOUT(2000);
+const chrono::milliseconds DEFAULT_TIMEOUT(1000);
+} // namespace
+
+void
+PeerLatencyTracker::record(const string &address, chrono::microseconds latency)
+{
+    lock_guard<mutex> lock(mMutex);
+
+    Samples &samples = mSamples[address];
+
+    if (samples.recent.empty())
+        samples.ewmaUs = latency.count();
+    else
+        samples.ewmaUs = EWMA_ALPHA * latency.count() + (1 - EWMA_ALPHA) * samples.ewmaUs;
+
+    if (samples.recent.size() < WINDOW_SIZE) {
+        samples.recent.push_back(latency.count());
+    } else {
+        samples.recent[samples.next] = latency.count();
+        samples.next = (samples.next + 1) % WINDOW_SIZE;
+    }
+}
+
+optional<chrono::microseconds>
+PeerLatencyTracker::ewma(const string &address) const
+{
+    lock_guard<mutex> lock(mMutex);
+
+    auto it = mSamples.find(address);
+    if (it == mSamples.end() || it->second.recent.empty())
+        return {};
+
+    return chrono::microseconds((int64_t)it->second.ewmaUs);
+}
+
+optional<chrono::microseconds>
+PeerLatencyTracker::percentile(const string &address, double p) const
+{
+    vector<int64_t> recent;
+
+    {
+        lock_guard<mutex> lock(mMutex);
+
+        auto it = mSamples.find(address);
+        if (it == mSamples.end() || it->second.recent.size() < MIN_SAMPLES)
+            return {};
+
+        recent = it->second.recent;
+    }
+
+    size_t idx = min(recent.size() - 1, (size_t)(p * recent.size()));
+    nth_element(recent.begin(), recent.begin() + idx, recent.end());
+
+    return chrono::microseconds(recent[idx]);
+}
+
+chrono::milliseconds
+PeerLatencyTracker::timeoutFor(const string &address) const
+{
+    optional<chrono::microseconds> p99 = percentile(address, 0.99);
+    if (!p99)
+        return DEFAULT_TIMEOUT;
+
+    auto timeout = chrono::duration_cast<chrono::milliseconds>(*p99 * TIMEOUT_MULTIPLIER);
+    return clamp(timeout, MIN_TIMEOUT, MAX_TIMEOUT);
+}
+
+vector<string>
+PeerLatencyTracker::addresses() const
+{
+    lock_guard<mutex> lock(mMutex);
+
+    vector<string> addresses;
+    for (const auto &entry : mSamples)
+        addresses.push_back(entry.first);
+
+    return addresses;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Keeps a latency estimate for every node we talk to: an exponentially weighted moving average
+/// and the distribution of the most recent round trips.
+///
+/// Thread-safe.
+class PeerLatencyTracker
+{
+public:
+    /// Records the time between sending a message to the address and getting its answer (or
+    /// giving up on it).
+    void record(const std::string &address, std::chrono::microseconds latency);
+
+    /// Returns the moving average of the latency to the address, if there are any samples.
+    std::optional<std::chrono::microseconds> ewma(const std::string &address) const;
+
+    /// Returns the p-th percentile (0 <= p <= 1) of the recent latencies to the address. Returns
+    /// nothing if there are too few samples for the estimate to mean anything.
+    std::optional<std::chrono::microseconds> percentile(const std::string &address,
+                                                        double p) const;
+
+    /// Returns how long to wait for an answer from the address before giving up: a few times its
+    /// 99th percentile latency, within fixed bounds. Uses a conservative default while there are
+    /// too few samples.
+    std::chrono::milliseconds timeoutFor(const std::string &address) const;
+
+    /// Returns every address that has samples.
+    std::vector<std::string> addresses() const;
+
+private:
+    struct Samples
+    {
+        double ewmaUs = 0;
+
+        /// Ring buffer of the most recent latencies, in microseconds.
+        std::vector<int64_t> recent;
+        size_t next = 0;
+    };
+
+    mutable std::mutex mMutex;
+    std::unordered_map<std::string, Samples> mSamples;
+};
@@ -0,0 +1,117 @@
+#include "PeerTransport.h"
+
+using namespace std;
+
+PeerTransport::PeerTransport(size_t numIoThreads, size_t connectionsPerPeer,
+                             RpcClient::Backend rpcBackend, uint16_t rpcPort)
+    : mPeerLatencies(make_shared<PeerLatencyTracker>())
+    , mPeerBreakers(make_shared<PeerCircuitBreakers>())
+    , mReplicaSelector(make_shared<ReplicaSelector>(mPeerLatencies, mPeerBreakers))
+    , mRpcClient(numIoThreads, connectionsPerPeer, rpcBackend, rpcPort)
+{
+    // clang-format off
+    auto opts = Pistache::Http::Client::options()
+                    .threads(numIoThreads)
+                    .keepAlive(true)
+                    .maxConnectionsPerHost(8);
+    // clang-format on
+
+    mClient.init(opts);
+}
+
+PeerTransport::~PeerTransport() { mClient.shutdown(); }
+
+Pistache::Async::Promise<Pistache::Http::Response>
+PeerTransport::sendMsg(const string &address, const string &resource, const string &msg,
+                       optional<chrono::milliseconds> timeout, bool tracked) const
+{
+    // Don't wait for a timeout from a node that is known to be down.
+    bool allowed = tracked ? mPeerBreakers->allowRequest(address) : !mPeerBreakers->isOpen(address);
+    if (!allowed)
+        return Pistache::Async::Promise<Pistache::Http::Response>::rejected(
+            PeerUnavailableError(address));
+
+    Pistache::Http::RequestBuilder requestBuilder = mClient.get("");
+
+    // clang-format off
+    requestBuilder
+        .method(Pistache::Http::Method::Patch)
+        .resource(address + "/inter_server/" + resource)
+        .body(msg)
+        .timeout(timeout.value_or(mPeerLatencies->timeoutFor(address)));
+    // clang-format on
+
+    if (!tracked)
+        return requestBuilder.send();
+
+    auto start = chrono::steady_clock::now();
+    auto recordLatency = [peerLatencies = mPeerLatencies, selector = mReplicaSelector, address,
+                          start]() {
+        peerLatencies->record(address, chrono::duration_cast<chrono::microseconds>(
+                                           chrono::steady_clock::now() - start));
+        selector->requestFinished(address);
+    };
+
+    mReplicaSelector->requestStarted(address);
+
+    // A failure counts as a sample too: timing out says at least as much about the node as a
+    // slow answer does.
+    auto rsp = requestBuilder.send();
+    rsp.then(
+        [recordLatency, peerBreakers = mPeerBreakers, address](Pistache::Http::Response) {
+            recordLatency();
+            peerBreakers->recordSuccess(address);
+        },
+        [recordLatency, peerBreakers = mPeerBreakers, address](exception_ptr) {
+            recordLatency();
+            peerBreakers->recordFailure(address);
+        });
+
+    return rsp;
+}
+
+bool
+PeerTransport::sendRpc(const string &address, RpcOp op, string_view body,
+                       RpcClient::ReplyFunction onReply,
+                       optional<chrono::milliseconds> timeout, bool tracked) const
+{
+    bool allowed = tracked ? mPeerBreakers->allowRequest(address) : !mPeerBreakers->isOpen(address);
+    if (!allowed) {
+        onReply(RpcClient::Outcome::Failed, RpcStatus::Ok, {});
+        return true;
+    }
+
+    if (!tracked)
+        return mRpcClient.call(address, op, body,
+                               timeout.value_or(mPeerLatencies->timeoutFor(address)), onReply);
+
+    auto start = chrono::steady_clock::now();
+
+    auto recordAndReply = [peerLatencies = mPeerLatencies, peerBreakers = mPeerBreakers,
+                           selector = mReplicaSelector, address, start,
+                           onReply](RpcClient::Outcome outcome, RpcStatus status,
+                                    string_view replyBody) {
+        peerLatencies->record(address, chrono::duration_cast<chrono::microseconds>(
+                                           chrono::steady_clock::now() - start));
+        selector->requestFinished(address);
+
+        if (outcome == RpcClient::Outcome::Replied)
+            peerBreakers->recordSuccess(address);
+        else
+            peerBreakers->recordFailure(address);
+
+        onReply(outcome, status, replyBody);
+    };
+
+    mReplicaSelector->requestStarted(address);
+
+    if (!mRpcClient.call(address, op, body, timeout.value_or(mPeerLatencies->timeoutFor(address)),
+                         recordAndReply)) {
+        // The caller sends it over HTTP instead, which asks the breaker again.
+        mPeerBreakers->cancelRequest(address);
+        mReplicaSelector->requestFinished(address);
+        return false;
+    }
+
+    return true;
+}
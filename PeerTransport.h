@@ -0,0 +1,85 @@
+#pragma once
+
+#include "PeerCircuitBreakers.h"
+#include "PeerLatencyTracker.h"
+#include "ReplicaSelector.h"
+#include "RpcClient.h"
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <pistache/client.h>
+#include <pistache/http.h>
+#include <string>
+#include <string_view>
+
+/// Everything a node uses to talk to other nodes: the HTTP client, the RPC connection pools, and
+/// what is known about each peer (latencies, circuit breakers and requests in flight). It belongs
+/// to the Node and outlives views, so connections and peer history survive scheme changes.
+class PeerTransport
+{
+public:
+    /// numIoThreads is the number of threads that read answers, for both HTTP and RPC.
+    /// connectionsPerPeer is the number of RPC connections kept open to each peer. rpcBackend is
+    /// the RpcClient backend to use if the kernel supports it. rpcPort is the port every node
+    /// listens for RPC on.
+    PeerTransport(size_t numIoThreads = 2, size_t connectionsPerPeer = 2,
+                  RpcClient::Backend rpcBackend = RpcClient::Backend::Epoll,
+                  uint16_t rpcPort = DEFAULT_RPC_PORT);
+
+    ~PeerTransport();
+
+    /// Sends a message to another node. The message is sent with the PATCH method
+    /// to inter_server/$resource, with $msg being sent in the body. The round trip time is
+    /// recorded in peerLatencies(), and the message counts as in flight in replicaSelector() until
+    /// it is answered. If no timeout is given, the address' adaptive timeout is
+    /// used. If the address' circuit breaker is open, the promise is rejected right away with a
+    /// PeerUnavailableError.
+    ///
+    /// Messages that are not tracked are for work that takes the receiver a while, such as scheme
+    /// switches and moves. They are refused while the breaker is open, but their latency and
+    /// outcome are not recorded, so a slow answer neither raises the adaptive timeout nor trips
+    /// the breaker. They should be given a timeout.
+    ///
+    /// Thread-safe.
+    Pistache::Async::Promise<Pistache::Http::Response>
+    sendMsg(const std::string &address, const std::string &resource, const std::string &msg,
+            std::optional<std::chrono::milliseconds> timeout = {}, bool tracked = true) const;
+
+    /// Sends an RPC request to another node over a pooled connection (see RpcClient). Latency
+    /// and failures are recorded the same way as for sendMsg(), and the same timeout and tracking
+    /// apply. If
+    /// the address' circuit breaker is open, onReply fails right away. Returns false without
+    /// calling onReply if the node doesn't accept RPC connections, in which case the caller should
+    /// use sendMsg() instead.
+    ///
+    /// Thread-safe.
+    bool sendRpc(const std::string &address, RpcOp op, std::string_view body,
+                 RpcClient::ReplyFunction onReply,
+                 std::optional<std::chrono::milliseconds> timeout = {},
+                 bool tracked = true) const;
+
+    Pistache::Http::RequestBuilder requestBuilder() { return mClient.get(""); }
+
+    /// Returns the RpcClient backend in use.
+    RpcClient::Backend rpcBackend() const { return mRpcClient.backend(); }
+
+    /// Returns the latency estimates of the nodes messages have been sent to.
+    std::shared_ptr<PeerLatencyTracker> peerLatencies() const { return mPeerLatencies; }
+
+    /// Returns the circuit breakers of the nodes messages have been sent to.
+    std::shared_ptr<PeerCircuitBreakers> peerBreakers() const { return mPeerBreakers; }
+
+    /// Returns what picks the replica to send a request to, by the peers' latencies, breakers and
+    /// requests in flight. Requests sent with requestBuilder() should be counted in it by the
+    /// caller.
+    std::shared_ptr<ReplicaSelector> replicaSelector() const { return mReplicaSelector; }
+
+private:
+    const std::shared_ptr<PeerLatencyTracker> mPeerLatencies;
+    const std::shared_ptr<PeerCircuitBreakers> mPeerBreakers;
+    const std::shared_ptr<ReplicaSelector> mReplicaSelector;
+
+    mutable Pistache::Http::Client mClient;
+    mutable RpcClient mRpcClient;
+};
@@ -0,0 +1,140 @@
+// Measures how much data a reshard moves with range and ring placement. For each change of the
+// shard count, every key is placed by the old and the new scheme. Two fractions are reported:
+// keys that end up on a shard with a different ID, of which adding or removing one of N shards
+// ideally moves 1/N, and copies of keys that a node has to receive because it owns them under
+// the new scheme but didn't under the old one. The second also counts nodes that change shards
+// to keep the shards even.
+//
+// The ring schemes are also sent through the RPC encoding, which must keep their placement.
+//
+// Built and run by ./build.sh placementbench; the argument is [number of keys]. Exits with 1 if
+// a ring reshard moves more than 1.5 times the ideal fraction of keys.
+
+#include "RpcProtocol.h"
+#include "ShardScheme.h"
+#include "ShardSchemeUtility.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+using ShardSchemeUtility::Placement;
+
+namespace
+{
+/// Returns the fraction of the keys that the new scheme puts on a shard with a different ID.
+double
+movedKeysFraction(const ShardScheme &oldScheme, const ShardScheme &newScheme,
+                  const vector<size_t> &keyHashes)
+{
+    size_t numMoved = 0;
+    for (size_t keyHash : keyHashes) {
+        if (oldScheme.getResponsibleShardId(keyHash) != newScheme.getResponsibleShardId(keyHash))
+            ++numMoved;
+    }
+
+    return (double)numMoved / keyHashes.size();
+}
+
+/// Returns the fraction of the copies placed by the new scheme that are on nodes which didn't have
+/// them under the old one.
+double
+movedCopiesFraction(const ShardScheme &oldScheme, const ShardScheme &newScheme,
+                    const vector<size_t> &keyHashes)
+{
+    size_t numCopies = 0;
+    size_t numMoved = 0;
+
+    for (size_t keyHash : keyHashes) {
+        const set<string> &oldOwners = oldScheme.getResponsibleShardInfo(keyHash).getNodeSet();
+        for (const string &node : newScheme.getResponsibleShardInfo(keyHash).getNodeSet()) {
+            ++numCopies;
+            if (!oldOwners.count(node))
+                ++numMoved;
+        }
+    }
+
+    return (double)numMoved / numCopies;
+}
+
+/// Returns true if both schemes put every key on the same shard.
+bool
+samePlacement(const ShardScheme &a, const ShardScheme &b, const vector<size_t> &keyHashes)
+{
+    for (size_t keyHash : keyHashes) {
+        if (a.getResponsibleShardId(keyHash) != b.getResponsibleShardId(keyHash))
+            return false;
+    }
+    return true;
+}
+
+ShardScheme
+roundTrip(const ShardScheme &scheme)
+{
+    RpcWriter writer;
+    writer.scheme(scheme);
+
+    RpcReader reader(writer.buffer());
+    return reader.scheme();
+}
+} // namespace
+
+int
+main(int argc, char **argv)
+{
+    size_t numKeys = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+
+    vector<size_t> keyHashes;
+    for (size_t idx = 0; idx < numKeys; ++idx)
+        keyHashes.push_back(hash<string>()("key" + to_string(idx)));
+
+    printf("%zu keys, two nodes per shard of the larger scheme\n", numKeys);
+    printf("%-8s %8s %-17s %-17s\n", "", "", "   moved keys", "   moved copies");
+    printf("%-8s %8s %8s %8s %8s %8s\n", "change", "ideal", "range", "ring", "range", "ring");
+
+    bool ok = true;
+
+    for (size_t numShards = 1; numShards < 8; ++numShards) {
+        vector<string> addresses;
+        for (size_t idx = 0; idx < 2 * (numShards + 1); ++idx)
+            addresses.push_back("10.0.0." + to_string(20 + idx) + ":8080");
+
+        double ideal = 1.0 / (numShards + 1);
+
+        for (bool grow : {true, false}) {
+            size_t from = grow ? numShards : numShards + 1;
+            size_t to = grow ? numShards + 1 : numShards;
+
+            double movedKeys[2];
+            double movedCopies[2];
+            for (Placement placement : {Placement::Range, Placement::Ring}) {
+                ShardScheme oldScheme =
+                    ShardSchemeUtility::createInitialShardScheme(from, addresses, placement);
+                ShardScheme newScheme = ShardSchemeUtility::createNewShardScheme(oldScheme, to);
+
+                bool ring = placement == Placement::Ring;
+                movedKeys[ring] = movedKeysFraction(oldScheme, newScheme, keyHashes);
+                movedCopies[ring] = movedCopiesFraction(oldScheme, newScheme, keyHashes);
+
+                if (ring && !samePlacement(newScheme, roundTrip(newScheme), keyHashes)) {
+                    printf("%zu->%zu: the ring scheme changed when it was encoded\n", from, to);
+                    ok = false;
+                }
+            }
+
+            printf("%zu->%-5zu %7.1f%% %7.1f%% %7.1f%% %7.1f%% %7.1f%%\n", from, to, 100 * ideal,
+                   100 * movedKeys[0], 100 * movedKeys[1], 100 * movedCopies[0],
+                   100 * movedCopies[1]);
+
+            if (movedKeys[1] > 1.5 * ideal)
+                ok = false;
+        }
+    }
+
+    printf(ok ? "ring placement ok\n" : "ring placement FAILED\n");
+    return ok ? 0 : 1;
+}
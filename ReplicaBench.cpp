@@ -0,0 +1,156 @@
+// Simulation benchmark of replica selection: request latencies when forwards pick a replica at
+// random, as keyToNode() used to, and when ReplicaSelector picks it. Each replica is a queue that
+// serves one request at a time with exponentially distributed service times; requests arrive as
+// a Poisson process. Time is simulated, so the results don't depend on the machine.
+//
+// Built and run by ./build.sh replicabench; arguments are [requests per run] [requests per
+// second].
+
+#include "PeerCircuitBreakers.h"
+#include "PeerLatencyTracker.h"
+#include "ReplicaSelector.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+struct Scenario
+{
+    const char *name;
+
+    /// Mean service time of each replica, in microseconds.
+    vector<double> meanServiceUs;
+};
+
+struct Completion
+{
+    double timeUs;
+    size_t replica;
+    double latencyUs;
+
+    bool operator<(const Completion &other) const { return timeUs > other.timeUs; }
+};
+
+/// Returns the replica to send the next request to.
+using PickFunction = function<size_t(const vector<string> &replicas)>;
+
+double
+percentile(vector<double> &samples, double p)
+{
+    size_t idx = min(samples.size() - 1, (size_t)(p * samples.size()));
+    nth_element(samples.begin(), samples.begin() + idx, samples.end());
+    return samples[idx];
+}
+
+/// Simulates numRequests requests and prints their latency percentiles and where they went.
+void
+run(const Scenario &scenario, const char *policy, size_t numRequests, double requestsPerSecond,
+    shared_ptr<PeerLatencyTracker> latencies, shared_ptr<ReplicaSelector> selector,
+    PickFunction pick)
+{
+    mt19937_64 random(42);
+    srand(42);
+    exponential_distribution<double> interarrivalUs(requestsPerSecond / 1e6);
+
+    vector<string> replicas;
+    vector<exponential_distribution<double>> serviceUs;
+    for (size_t idx = 0; idx < scenario.meanServiceUs.size(); ++idx) {
+        replicas.push_back("10.0.0." + to_string(20 + idx) + ":8080");
+        serviceUs.emplace_back(1 / scenario.meanServiceUs[idx]);
+    }
+
+    vector<double> busyUntilUs(replicas.size(), 0);
+    vector<size_t> numSent(replicas.size(), 0);
+    priority_queue<Completion> completions;
+    vector<double> samples;
+    samples.reserve(numRequests);
+
+    // What the node knows when it picks is what has been answered by then.
+    auto completeUntil = [&](double nowUs) {
+        while (!completions.empty() && completions.top().timeUs <= nowUs) {
+            const Completion &done = completions.top();
+            latencies->record(replicas[done.replica],
+                              chrono::microseconds((int64_t)done.latencyUs));
+            selector->requestFinished(replicas[done.replica]);
+            samples.push_back(done.latencyUs);
+            completions.pop();
+        }
+    };
+
+    double nowUs = 0;
+    for (size_t idx = 0; idx < numRequests; ++idx) {
+        nowUs += interarrivalUs(random);
+        completeUntil(nowUs);
+
+        size_t replica = pick(replicas);
+        ++numSent[replica];
+        selector->requestStarted(replicas[replica]);
+
+        double startUs = max(nowUs, busyUntilUs[replica]);
+        busyUntilUs[replica] = startUs + serviceUs[replica](random);
+        completions.push({busyUntilUs[replica], replica, busyUntilUs[replica] - nowUs});
+    }
+    completeUntil(HUGE_VAL);
+
+    printf("%-20s %-8s p50 %8.2f ms  p99 %8.2f ms  p99.9 %8.2f ms  sent:", scenario.name, policy,
+           percentile(samples, 0.50) / 1000, percentile(samples, 0.99) / 1000,
+           percentile(samples, 0.999) / 1000);
+    for (size_t sent : numSent)
+        printf(" %4.1f%%", 100.0 * sent / numRequests);
+    printf("\n");
+}
+} // namespace
+
+int
+main(int argc, char **argv)
+{
+    size_t numRequests = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+    double requestsPerSecond = argc > 2 ? atof(argv[2]) : 1000;
+
+    // Three replicas can serve 3000 requests per second when they are equal. In the second
+    // scenario one of them is overloaded by other work and only serves 400.
+    vector<Scenario> scenarios = {
+        {"equal replicas", {1000, 1000, 1000}},
+        {"one slow replica", {1000, 1000, 2500}},
+    };
+
+    printf("%zu requests at %.0f per second\n", numRequests, requestsPerSecond);
+
+    for (const Scenario &scenario : scenarios) {
+        for (bool selected : {false, true}) {
+            auto latencies = make_shared<PeerLatencyTracker>();
+            auto breakers = make_shared<PeerCircuitBreakers>();
+            auto selector = make_shared<ReplicaSelector>(latencies, breakers);
+
+            PickFunction pick;
+            if (selected) {
+                pick = [selector](const vector<string> &replicas) {
+                    string choice = selector->pick(replicas);
+                    return (size_t)(find(replicas.begin(), replicas.end(), choice) -
+                                    replicas.begin());
+                };
+            } else {
+                pick = [](const vector<string> &replicas) {
+                    return (size_t)(rand() % replicas.size());
+                };
+            }
+
+            run(scenario, selected ? "p2c" : "random", numRequests, requestsPerSecond, latencies,
+                selector, pick);
+        }
+    }
+
+    return 0;
+}
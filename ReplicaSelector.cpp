@@ -0,0 +1,104 @@
+#include "ReplicaSelector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+ReplicaSelector::ReplicaSelector(shared_ptr<PeerLatencyTracker> latencies,
+                                 shared_ptr<PeerCircuitBreakers> breakers)
+    : mLatencies(latencies)
+    , mBreakers(breakers)
+{
+}
+
+void
+ReplicaSelector::requestStarted(const string &address)
+{
+    lock_guard<mutex> lock(mMutex);
+    ++mInFlight[address];
+}
+
+void
+ReplicaSelector::requestFinished(const string &address)
+{
+    lock_guard<mutex> lock(mMutex);
+
+    auto it = mInFlight.find(address);
+    if (it == mInFlight.end())
+        return;
+
+    if (--it->second == 0)
+        mInFlight.erase(it);
+}
+
+size_t
+ReplicaSelector::numInFlight(const string &address) const
+{
+    lock_guard<mutex> lock(mMutex);
+
+    auto it = mInFlight.find(address);
+    return it == mInFlight.end() ? 0 : it->second;
+}
+
+string
+ReplicaSelector::pick(const vector<string> &replicas, const string &exclude) const
+{
+    vector<const string *> candidates;
+    for (const string &replica : replicas) {
+        if (replica != exclude && !mBreakers->isOpen(replica))
+            candidates.push_back(&replica);
+    }
+
+    if (candidates.empty() && exclude.empty()) {
+        for (const string &replica : replicas)
+            candidates.push_back(&replica);
+    }
+
+    if (candidates.empty())
+        return "";
+    if (candidates.size() == 1)
+        return *candidates[0];
+
+    // Two different replicas at random.
+    size_t first = rand() % candidates.size();
+    size_t second = (first + 1 + rand() % (candidates.size() - 1)) % candidates.size();
+
+    const string &a = *candidates[first];
+    const string &b = *candidates[second];
+    return cost(a) <= cost(b) ? a : b;
+}
+
+vector<string>
+ReplicaSelector::order(vector<string> replicas) const
+{
+    vector<pair<double, string>> ranked;
+    ranked.reserve(replicas.size());
+
+    // Open breakers sort after everything else, but keep their order among themselves.
+    for (string &replica : replicas) {
+        double rank = mBreakers->isOpen(replica) ? HUGE_VAL : cost(replica);
+        ranked.emplace_back(rank, move(replica));
+    }
+
+    stable_sort(ranked.begin(), ranked.end(),
+                [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    vector<string> ordered;
+    ordered.reserve(ranked.size());
+    for (auto &entry : ranked)
+        ordered.push_back(move(entry.second));
+
+    return ordered;
+}
+
+double
+ReplicaSelector::cost(const string &address) const
+{
+    optional<chrono::microseconds> latency = mLatencies->ewma(address);
+
+    // The extra microsecond keeps requests in flight counting when there is no latency yet.
+    double latencyUs = latency ? latency->count() : 0;
+    return (latencyUs + 1) * (1 + numInFlight(address));
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "PeerCircuitBreakers.h"
+#include "PeerLatencyTracker.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Decides which replica of a shard a request goes to. Each choice is the better of two replicas
+/// drawn at random ("power of two choices"), judged by how long a request to each can expect to
+/// take: its average latency times one more than the number of requests in flight to it. That
+/// steers requests away from slow and overloaded replicas, without the herding that comes from
+/// always sending to whichever looked best last.
+///
+/// Replicas whose circuit breaker is open are passed over unless they all are.
+///
+/// Thread-safe.
+class ReplicaSelector
+{
+public:
+    ReplicaSelector(std::shared_ptr<PeerLatencyTracker> latencies,
+                    std::shared_ptr<PeerCircuitBreakers> breakers);
+
+    /// Counts a request to the address as in flight until requestFinished() is called for it.
+    void requestStarted(const std::string &address);
+    void requestFinished(const std::string &address);
+
+    size_t numInFlight(const std::string &address) const;
+
+    /// Returns one of the replicas other than exclude, or an empty string if there is none. If
+    /// every replica's breaker is open one of them is returned anyway, unless exclude is given:
+    /// a second choice (such as a hedge) isn't worth sending to a node that is down.
+    std::string pick(const std::vector<std::string> &replicas,
+                     const std::string &exclude = "") const;
+
+    /// Returns the replicas from the one expected to answer first to the one expected to answer
+    /// last, with those whose breaker is open at the end.
+    std::vector<std::string> order(std::vector<std::string> replicas) const;
+
+private:
+    /// Returns the expected time of a request to the address, in microseconds. Addresses without
+    /// latency samples only cost their requests in flight, so they are tried early.
+    double cost(const std::string &address) const;
+
+    const std::shared_ptr<PeerLatencyTracker> mLatencies;
+    const std::shared_ptr<PeerCircuitBreakers> mBreakers;
+
+    /// Used to protect mInFlight.
+    mutable std::mutex mMutex;
+    std::unordered_map<std::string, size_t> mInFlight;
+};
@@ -0,0 +1,193 @@
+#include "RetryScheduler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+using namespace std;
+
+namespace
+{
+// First and longest wait between retries.
+const chrono::milliseconds RETRY_BASE(10);
+const chrono::milliseconds RETRY_CAP(2000);
+
+/// Returns how long to wait before retry number `attempt` (starting at 1): a random time up to an
+/// exponentially growing limit. The randomness keeps many senders from retrying in lockstep.
+chrono::milliseconds
+retryBackoff(size_t attempt)
+{
+    chrono::milliseconds limit = RETRY_CAP;
+    if (attempt < 16)
+        limit = min(limit, RETRY_BASE * (1 << attempt));
+
+    return chrono::milliseconds(rand() % (limit.count() + 1));
+}
+
+bool
+shouldStop(const RetryScheduler::AtomicBoolPtr &stop)
+{
+    return stop != nullptr && *stop;
+}
+} // namespace
+
+RetryScheduler::RetryScheduler(IsDownFunction isDown, size_t numThreads, size_t maxInFlight)
+    : mIsDown(isDown)
+    , mMaxInFlight(maxInFlight)
+{
+    for (size_t idx = 0; idx < numThreads; ++idx)
+        mThreads.emplace_back(&RetryScheduler::workerThread, this);
+}
+
+RetryScheduler::~RetryScheduler()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mTasksChanged.notify_all();
+
+    for (thread &t : mThreads)
+        t.join();
+}
+
+void
+RetryScheduler::submit(const vector<string> &addresses, AttemptFunction attempt,
+                       AtomicBoolPtr shouldStop)
+{
+    assert(!addresses.empty());
+
+    MessagePtr message = make_shared<Message>();
+    message->addresses = addresses;
+    message->attempt = attempt;
+    message->shouldStop = shouldStop;
+
+    {
+        lock_guard<mutex> lock(mMutex);
+        if (mInFlight >= mMaxInFlight) {
+            mWaiting.push_back(message);
+            return;
+        }
+        ++mInFlight;
+    }
+
+    schedule(Clock::now(), [this, message]() { send(message); });
+}
+
+size_t
+RetryScheduler::numInFlight() const
+{
+    lock_guard<mutex> lock(mMutex);
+    return mInFlight;
+}
+
+size_t
+RetryScheduler::numQueued() const
+{
+    lock_guard<mutex> lock(mMutex);
+    return mWaiting.size();
+}
+
+void
+RetryScheduler::runAfter(chrono::microseconds delay, function<void()> run)
+{
+    schedule(Clock::now() + delay, move(run));
+}
+
+void
+RetryScheduler::schedule(Clock::time_point due, function<void()> run)
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mTasks.push({due, mNextSequence++, move(run)});
+    }
+    mTasksChanged.notify_one();
+}
+
+void
+RetryScheduler::send(MessagePtr message)
+{
+    if (shouldStop(message->shouldStop)) {
+        finish();
+        return;
+    }
+
+    // Go straight to the next node instead of waiting on one that is known to be down, unless
+    // they all are.
+    const vector<string> &addresses = message->addresses;
+    string address;
+    size_t numSkipped = 0;
+    do {
+        address = addresses[message->nextAddress];
+        message->nextAddress = (message->nextAddress + 1) % addresses.size();
+    } while (mIsDown(address) && ++numSkipped < addresses.size());
+
+    // The result is handled on a pool thread so that done() never blocks a network thread.
+    message->attempt(address, [this, message](bool success) {
+        schedule(Clock::now(), [this, message, success]() {
+            if (success)
+                finish();
+            else
+                retry(message);
+        });
+    });
+}
+
+void
+RetryScheduler::retry(MessagePtr message)
+{
+    if (shouldStop(message->shouldStop)) {
+        finish();
+        return;
+    }
+
+    ++message->numFailures;
+    schedule(Clock::now() + retryBackoff(message->numFailures),
+             [this, message]() { send(message); });
+}
+
+void
+RetryScheduler::finish()
+{
+    MessagePtr next;
+
+    {
+        lock_guard<mutex> lock(mMutex);
+        if (mWaiting.empty()) {
+            --mInFlight;
+            return;
+        }
+
+        // The slot goes straight to the next message.
+        next = mWaiting.front();
+        mWaiting.pop_front();
+    }
+
+    schedule(Clock::now(), [this, next]() { send(next); });
+}
+
+void
+RetryScheduler::workerThread()
+{
+    unique_lock<mutex> lock(mMutex);
+
+    while (!mStopping) {
+        if (mTasks.empty()) {
+            mTasksChanged.wait(lock);
+            continue;
+        }
+
+        Clock::time_point due = mTasks.top().due;
+        if (Clock::now() < due) {
+            mTasksChanged.wait_until(lock, due);
+            continue;
+        }
+
+        function<void()> run = mTasks.top().run;
+        mTasks.pop();
+
+        lock.unlock();
+        run();
+        lock.lock();
+    }
+}
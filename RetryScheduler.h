@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Owns every inter-server message that must be resent until it succeeds. Each message is a small
+/// state machine (send, wait for the answer, back off, send again) driven by a timer queue and a
+/// fixed pool of threads, so the number of threads does not depend on the number of messages.
+///
+/// At most maxInFlight messages are being worked on at once; the rest wait in FIFO order.
+class RetryScheduler
+{
+public:
+    /// Sends the message to the address once and calls done() with whether it succeeded. done()
+    /// may be called from any thread, but only once.
+    using AttemptFunction =
+        std::function<void(const std::string &address, std::function<void(bool success)> done)>;
+
+    /// Returns true if the address is known to be down and should be skipped when possible.
+    using IsDownFunction = std::function<bool(const std::string &address)>;
+
+    using AtomicBoolPtr = std::shared_ptr<std::atomic<bool>>;
+
+    RetryScheduler(IsDownFunction isDown, size_t numThreads = 2,
+                   size_t maxInFlight = 1024);
+
+    ~RetryScheduler();
+
+    /// Makes attempts to the addresses in turn until one succeeds or shouldStop becomes true.
+    /// Nodes that are down are skipped unless all of them are. Retries back off exponentially with
+    /// jitter. Attempts are started on one of the scheduler's threads.
+    void submit(const std::vector<std::string> &addresses, AttemptFunction attempt,
+                AtomicBoolPtr shouldStop);
+
+    /// Runs the function on one of the scheduler's threads once the delay has passed. This lets
+    /// other asynchronous inter-server work, such as hedged forwards, share the timer queue. The
+    /// function must not block.
+    void runAfter(std::chrono::microseconds delay, std::function<void()> run);
+
+    /// Number of messages being worked on, and number waiting for a slot.
+    size_t numInFlight() const;
+    size_t numQueued() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Message
+    {
+        std::vector<std::string> addresses;
+        size_t nextAddress = 0;
+        AttemptFunction attempt;
+        AtomicBoolPtr shouldStop;
+
+        /// Number of failed attempts so far.
+        size_t numFailures = 0;
+    };
+
+    using MessagePtr = std::shared_ptr<Message>;
+
+    struct Task
+    {
+        Clock::time_point due;
+        uint64_t sequence;
+        std::function<void()> run;
+
+        // For the priority queue: the earliest task (then the oldest) is on top.
+        bool operator<(const Task &other) const
+        {
+            if (due != other.due)
+                return due > other.due;
+            return sequence > other.sequence;
+        }
+    };
+
+    /// Runs the task on a pool thread once `due` has passed.
+    void schedule(Clock::time_point due, std::function<void()> run);
+
+    void send(MessagePtr message);
+    void retry(MessagePtr message);
+
+    /// Frees the message's slot and starts the next waiting message, if any.
+    void finish();
+
+    void workerThread();
+
+    IsDownFunction mIsDown;
+    const size_t mMaxInFlight;
+
+    /// Protects everything below.
+    mutable std::mutex mMutex;
+    std::condition_variable mTasksChanged;
+    std::priority_queue<Task> mTasks;
+    uint64_t mNextSequence = 0;
+    std::deque<MessagePtr> mWaiting;
+    size_t mInFlight = 0;
+    bool mStopping = false;
+
+    std::vector<std::thread> mThreads;
+};
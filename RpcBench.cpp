@@ -0,0 +1,146 @@
+// Loopback benchmark of the inter-server RPC client backends: messages per second, and CPU time
+// the sending process spends per message. The RPC server runs in a child process so its CPU time
+// isn't counted.
+//
+// Built and run by ./build.sh rpcbench; arguments are [seconds per backend] [messages in flight]
+// [body bytes].
+
+#include "RpcClient.h"
+#include "RpcServer.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+// The client is given the server's RPC port, and only takes the host from this.
+const char *SERVER_ADDRESS = "127.0.0.1:18080";
+const uint16_t SERVER_RPC_PORT = 18081;
+
+double
+cpuSeconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/// Answers every request with its own body, like a DataGet of a value that size.
+[[noreturn]] void
+runServer()
+{
+    RpcServer server(SERVER_RPC_PORT, [](RpcOp, RpcReader &request, RpcWriter &reply) {
+        reply.string(request.string());
+        return RpcStatus::Ok;
+    });
+
+    if (!server.start()) {
+        fprintf(stderr, "Could not listen on port %d\n", SERVER_RPC_PORT);
+        _exit(1);
+    }
+
+    while (true)
+        pause();
+}
+
+/// Keeps inFlight messages going for the duration: each reply sends the next message.
+void
+runClient(RpcClient::Backend backend, chrono::seconds duration, size_t inFlight, size_t bodySize)
+{
+    RpcClient client(2, 2, backend, SERVER_RPC_PORT);
+
+    RpcWriter request;
+    request.string(string(bodySize, 'x'));
+
+    atomic<bool> stopping{false};
+    atomic<size_t> numReplied{0};
+    atomic<size_t> numFailed{0};
+    atomic<size_t> numOutstanding{0};
+
+    function<void()> send = [&]() {
+        ++numOutstanding;
+        client.call(SERVER_ADDRESS, RpcOp::DataGet, request.buffer(), chrono::seconds(5),
+                    [&](RpcClient::Outcome outcome, RpcStatus, string_view) {
+                        if (outcome == RpcClient::Outcome::Replied)
+                            ++numReplied;
+                        else
+                            ++numFailed;
+
+                        if (!stopping)
+                            send();
+                        --numOutstanding;
+                    });
+    };
+
+    // Opens the connections before measuring.
+    for (int idx = 0; idx < 100; ++idx) {
+        atomic<bool> done{false};
+        client.call(SERVER_ADDRESS, RpcOp::DataGet, request.buffer(), chrono::seconds(5),
+                    [&done](RpcClient::Outcome, RpcStatus, string_view) { done = true; });
+        while (!done)
+            this_thread::yield();
+    }
+
+    double cpuStart = cpuSeconds();
+    auto start = chrono::steady_clock::now();
+
+    for (size_t idx = 0; idx < inFlight; ++idx)
+        send();
+
+    this_thread::sleep_for(duration);
+    stopping = true;
+    size_t replied = numReplied;
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double cpu = cpuSeconds() - cpuStart;
+
+    while (numOutstanding > 0)
+        this_thread::sleep_for(chrono::milliseconds(1));
+
+    printf("%-8s %10.0f msg/s %8.2f us CPU/msg %6zu failed\n",
+           backend == RpcClient::Backend::IoUring ? "io_uring" : "epoll", replied / seconds,
+           cpu * 1e6 / max(replied, (size_t)1), (size_t)numFailed);
+}
+} // namespace
+
+int
+main(int argc, char **argv)
+{
+    chrono::seconds duration(argc > 1 ? atoi(argv[1]) : 5);
+    size_t inFlight = argc > 2 ? strtoul(argv[2], nullptr, 10) : 64;
+    size_t bodySize = argc > 3 ? strtoul(argv[3], nullptr, 10) : 100;
+
+    pid_t server = fork();
+    if (server == 0)
+        runServer();
+
+    // Gives the server time to start listening.
+    this_thread::sleep_for(chrono::milliseconds(200));
+
+    printf("%zu in flight, %zu byte bodies, %lld s per backend\n", inFlight, bodySize,
+           (long long)duration.count());
+
+    runClient(RpcClient::Backend::Epoll, duration, inFlight, bodySize);
+
+    {
+        RpcClient probe(1, 1, RpcClient::Backend::IoUring);
+        if (probe.backend() == RpcClient::Backend::IoUring)
+            runClient(RpcClient::Backend::IoUring, duration, inFlight, bodySize);
+        else
+            printf("io_uring   not supported here; the client falls back to epoll\n");
+    }
+
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+    return 0;
+}
@@ -0,0 +1,672 @@
+#include "RpcClient.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+// How long a node that refused a connection is left alone.
+const chrono::milliseconds REFUSED_RETRY_PERIOD(1000);
+
+// How often I/O threads check for calls past their deadline.
+const int DEADLINE_CHECK_PERIOD_MS = 10;
+
+// Operations one io_uring I/O thread can have in flight: a read and a send per connection, plus
+// its wakeup and timer.
+const unsigned RING_ENTRIES = 1024;
+
+// Each io_uring I/O thread registers this many read buffers of this size with the kernel.
+// Connections beyond that read into buffers of their own, which the kernel maps on every read.
+const int NUM_READ_BUFFERS = 32;
+const size_t READ_BUFFER_SIZE = 16 * 1024;
+
+/// What an io_uring completion is for. Stored in the low bits of the user data, with the socket
+/// in the rest.
+enum class Completion : uint64_t
+{
+    Read = 0,
+    Send = 1,
+    Wake = 2,
+    Timer = 3
+};
+
+uint64_t
+userDataFor(int fd, Completion completion)
+{
+    return (uint64_t)fd << 2 | (uint64_t)completion;
+}
+
+// A write that can't make progress for this long breaks the connection.
+const int SEND_TIMEOUT_MS = 2000;
+
+enum class ConnectResult
+{
+    Connected,
+    Refused,
+    TimedOut
+};
+
+/// Connects to host:port, waiting at most timeout. On success, fd is a blocking socket.
+ConnectResult
+connectTo(const string &address, chrono::milliseconds timeout, int &fd)
+{
+    size_t colon = address.rfind(':');
+    if (colon == string::npos)
+        return ConnectResult::Refused;
+
+    string host = address.substr(0, colon);
+    string port = address.substr(colon + 1);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *info = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &info) != 0 || !info)
+        return ConnectResult::Refused;
+
+    fd = socket(info->ai_family, info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                info->ai_protocol);
+    if (fd < 0) {
+        freeaddrinfo(info);
+        return ConnectResult::Refused;
+    }
+
+    int rc = connect(fd, info->ai_addr, info->ai_addrlen);
+    freeaddrinfo(info);
+
+    if (rc < 0 && errno == EINPROGRESS) {
+        pollfd pfd = {fd, POLLOUT, 0};
+        if (poll(&pfd, 1, (int)timeout.count()) <= 0) {
+            close(fd);
+            return ConnectResult::TimedOut;
+        }
+
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        rc = error == 0 ? 0 : -1;
+    }
+
+    if (rc < 0) {
+        close(fd);
+        return ConnectResult::Refused;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    timeval sendTimeout = {SEND_TIMEOUT_MS / 1000, (SEND_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+    return ConnectResult::Connected;
+}
+} // namespace
+
+RpcClient::Connection::~Connection() { close(fd); }
+
+RpcClient::RpcClient(size_t numIoThreads, size_t connectionsPerPeer, Backend backend,
+                     uint16_t rpcPort)
+    : mConnectionsPerPeer(max(connectionsPerPeer, (size_t)1))
+    , mBackend(backend)
+    , mRpcPort(rpcPort)
+{
+    for (size_t idx = 0; idx < max(numIoThreads, (size_t)1); ++idx)
+        mIoThreads.push_back(make_unique<IoThread>());
+
+    // Either every thread gets a ring or none does, so calls don't have to care which thread a
+    // connection belongs to.
+    if (mBackend == Backend::IoUring) {
+        for (auto &io : mIoThreads) {
+            io->ring = make_unique<IoUring>(RING_ENTRIES);
+            if (!io->ring->isValid())
+                mBackend = Backend::Epoll;
+        }
+    }
+
+    for (auto &io : mIoThreads) {
+        if (mBackend == Backend::Epoll) {
+            io->ring = nullptr;
+            io->epollFd = epoll_create1(EPOLL_CLOEXEC);
+            io->thread = thread(&RpcClient::epollThread, this, ref(*io));
+            continue;
+        }
+
+        io->wakeFd = eventfd(0, EFD_CLOEXEC);
+
+        io->readBufferMemory.resize(NUM_READ_BUFFERS * READ_BUFFER_SIZE);
+        iovec region = {io->readBufferMemory.data(), io->readBufferMemory.size()};
+        io->readBuffersRegistered = io->ring->registerBuffers(&region, 1);
+        for (int index = NUM_READ_BUFFERS - 1; index >= 0; --index)
+            io->freeReadBuffers.push_back(index);
+
+        io->thread = thread(&RpcClient::ioUringThread, this, ref(*io));
+    }
+}
+
+RpcClient::~RpcClient()
+{
+    {
+        lock_guard<mutex> lock(mPeersMut);
+        for (auto &entry : mPeers) {
+            for (ConnectionPtr &connection : entry.second.connections)
+                closeConnection(*connection);
+        }
+    }
+
+    mStopping = true;
+    for (auto &io : mIoThreads) {
+        if (io->wakeFd >= 0) {
+            uint64_t one = 1;
+            ssize_t rc = write(io->wakeFd, &one, sizeof(one));
+            (void)rc;
+        }
+
+        io->thread.join();
+
+        if (io->epollFd >= 0)
+            close(io->epollFd);
+
+        io->ring = nullptr;
+        if (io->wakeFd >= 0)
+            close(io->wakeFd);
+    }
+}
+
+string
+RpcClient::rpcAddressFor(const string &httpAddress) const
+{
+    size_t colon = httpAddress.rfind(':');
+    return httpAddress.substr(0, colon) + ":" + to_string(mRpcPort);
+}
+
+bool
+RpcClient::call(const string &address, RpcOp op, string_view body, chrono::milliseconds timeout,
+                ReplyFunction onReply)
+{
+    ConnectionPtr connection;
+    uint32_t requestId;
+    bool wasIdle = false;
+
+    // A connection can break between getting it and using it; one more try gets a fresh one.
+    for (int attempt = 0; attempt < 2 && !connection; ++attempt) {
+        bool timedOut = false;
+        connection = getConnection(address, timeout, timedOut);
+
+        if (timedOut) {
+            onReply(Outcome::Failed, RpcStatus::Ok, {});
+            return true;
+        }
+
+        if (!connection)
+            return false;
+
+        lock_guard<mutex> lock(connection->mut);
+        if (connection->closed) {
+            connection = nullptr;
+            continue;
+        }
+
+        requestId = connection->nextRequestId++;
+        connection->pending[requestId] = {Clock::now() + timeout, move(onReply)};
+
+        // With io_uring, the I/O thread sends the frame along with any others queued by then.
+        if (mBackend == Backend::IoUring) {
+            wasIdle = connection->outgoing.empty();
+            appendRpcFrame(connection->outgoing, requestId, (uint8_t)op, body);
+        }
+    }
+
+    if (!connection) {
+        onReply(Outcome::Failed, RpcStatus::Ok, {});
+        return true;
+    }
+
+    if (mBackend == Backend::IoUring) {
+        if (wasIdle)
+            markReady(connection);
+        return true;
+    }
+
+    bool sent;
+    {
+        lock_guard<mutex> lock(connection->writeMut);
+        sent = sendRpcFrame(connection->fd, requestId, (uint8_t)op, body);
+    }
+
+    // Fails this call along with everything else on the connection.
+    if (!sent)
+        closeConnection(*connection);
+
+    return true;
+}
+
+RpcClient::ConnectionPtr
+RpcClient::getConnection(const string &address, chrono::milliseconds timeout, bool &timedOut)
+{
+    {
+        lock_guard<mutex> lock(mPeersMut);
+        Peer &peer = mPeers[address];
+
+        // Forget connections that broke; they are replaced below.
+        auto &connections = peer.connections;
+        connections.erase(remove_if(connections.begin(), connections.end(),
+                                    [](const ConnectionPtr &connection) {
+                                        lock_guard<mutex> connectionLock(connection->mut);
+                                        return connection->closed;
+                                    }),
+                          connections.end());
+
+        if (connections.size() >= mConnectionsPerPeer)
+            return connections[peer.next++ % connections.size()];
+
+        if (Clock::now() < peer.refusedUntil)
+            return nullptr;
+    }
+
+    // Connect without holding the lock, so a slow node doesn't hold up calls to the others.
+    int fd = -1;
+    switch (connectTo(rpcAddressFor(address), timeout, fd)) {
+    case ConnectResult::Refused: {
+        lock_guard<mutex> lock(mPeersMut);
+        mPeers[address].refusedUntil = Clock::now() + REFUSED_RETRY_PERIOD;
+        return nullptr;
+    }
+    case ConnectResult::TimedOut:
+        timedOut = true;
+        return nullptr;
+    case ConnectResult::Connected:
+    default:
+        break;
+    }
+
+    ConnectionPtr connection = make_shared<Connection>(fd);
+
+    IoThread &io = *mIoThreads[mNextIoThread++ % mIoThreads.size()];
+    connection->io = &io;
+
+    {
+        lock_guard<mutex> lock(mPeersMut);
+        Peer &peer = mPeers[address];
+
+        // Other calls may have filled the pool in the meantime. Use theirs; ours closes when it
+        // goes out of scope.
+        if (peer.connections.size() >= mConnectionsPerPeer)
+            return peer.connections[peer.next++ % peer.connections.size()];
+
+        // The I/O thread knows the connection before anyone can send on it.
+        {
+            lock_guard<mutex> ioLock(io.mut);
+            io.connections[fd] = connection;
+        }
+
+        peer.connections.push_back(connection);
+    }
+
+    if (mBackend == Backend::IoUring) {
+        markReady(connection);
+        return connection;
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    epoll_ctl(io.epollFd, EPOLL_CTL_ADD, fd, &event);
+
+    return connection;
+}
+
+void
+RpcClient::epollThread(IoThread &io)
+{
+    const int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+
+    while (!mStopping) {
+        int numEvents = epoll_wait(io.epollFd, events, MAX_EVENTS, DEADLINE_CHECK_PERIOD_MS);
+
+        for (int idx = 0; idx < numEvents; ++idx) {
+            ConnectionPtr connection;
+            {
+                lock_guard<mutex> lock(io.mut);
+                auto it = io.connections.find(events[idx].data.fd);
+                if (it == io.connections.end())
+                    continue;
+                connection = it->second;
+            }
+
+            // The read buffer receives into itself.
+            if (!connection->readBuffer.recv(connection->fd) ||
+                !dispatchReceived(*connection, {}))
+                closeConnection(*connection);
+        }
+
+        sweepConnections(io, [&io](Connection &connection) {
+            epoll_ctl(io.epollFd, EPOLL_CTL_DEL, connection.fd, nullptr);
+            return true;
+        });
+    }
+}
+
+void
+RpcClient::ioUringThread(IoThread &io)
+{
+    IoUring &ring = *io.ring;
+    const chrono::milliseconds DEADLINE_CHECK_PERIOD(DEADLINE_CHECK_PERIOD_MS);
+
+    ring.prepareRead(io.wakeFd, &io.wakeValue, sizeof(io.wakeValue),
+                     userDataFor(0, Completion::Wake));
+    ring.prepareTimeout(DEADLINE_CHECK_PERIOD, userDataFor(0, Completion::Timer));
+    io.numInFlight = 2;
+
+    // A connection's read buffer goes back to the pool once the kernel is done with it.
+    auto canDrop = [&io](Connection &connection) {
+        if (connection.readInFlight || connection.sendInFlight)
+            return false;
+
+        if (connection.readBufferIndex >= 0)
+            io.freeReadBuffers.push_back(connection.readBufferIndex);
+        return true;
+    };
+
+    auto onCompletion = [this, &io, &ring, &canDrop, DEADLINE_CHECK_PERIOD](uint64_t userData,
+                                                                            int result) {
+        --io.numInFlight;
+
+        Completion completion = (Completion)(userData & 3);
+        switch (completion) {
+        case Completion::Wake:
+            // Connections marked ready are picked up before the next wait.
+            io.wakePending = false;
+            if (!mStopping) {
+                ring.prepareRead(io.wakeFd, &io.wakeValue, sizeof(io.wakeValue), userData);
+                ++io.numInFlight;
+            }
+            return;
+        case Completion::Timer:
+            sweepConnections(io, canDrop);
+            if (!mStopping) {
+                ring.prepareTimeout(DEADLINE_CHECK_PERIOD, userData);
+                ++io.numInFlight;
+            }
+            return;
+        case Completion::Read:
+        case Completion::Send:
+        default:
+            break;
+        }
+
+        ConnectionPtr connection;
+        {
+            lock_guard<mutex> lock(io.mut);
+            auto it = io.connections.find((int)(userData >> 2));
+            if (it == io.connections.end())
+                return;
+            connection = it->second;
+        }
+
+        if (completion == Completion::Read) {
+            connection->readInFlight = false;
+
+            string_view received(connection->readChunk, result > 0 ? (size_t)result : 0);
+            bool retry = result == -EINTR || result == -EAGAIN;
+            if (!retry && (result <= 0 || !dispatchReceived(*connection, received)))
+                closeConnection(*connection);
+            else
+                startRead(io, *connection);
+        } else {
+            connection->sendInFlight = false;
+
+            if (result < 0) {
+                closeConnection(*connection);
+            } else {
+                connection->sendOffset += (size_t)result;
+                startSend(io, *connection);
+            }
+        }
+    };
+
+    // Everything queued in one pass, including reads and sends started by completions, goes to
+    // the kernel in one system call, which also waits for the next completions.
+    while (io.numInFlight > 0) {
+        vector<ConnectionPtr> ready;
+        {
+            lock_guard<mutex> lock(io.mut);
+            ready.swap(io.ready);
+        }
+
+        for (const ConnectionPtr &connection : ready) {
+            startRead(io, *connection);
+            startSend(io, *connection);
+        }
+
+        ring.submitAndWait();
+        ring.forEachCompletion(onCompletion);
+    }
+}
+
+void
+RpcClient::startRead(IoThread &io, Connection &connection)
+{
+    if (connection.readInFlight)
+        return;
+
+    {
+        lock_guard<mutex> lock(connection.mut);
+        if (connection.closed)
+            return;
+    }
+
+    if (!connection.readChunk) {
+        if (!io.freeReadBuffers.empty()) {
+            connection.readBufferIndex = io.freeReadBuffers.back();
+            io.freeReadBuffers.pop_back();
+            connection.readChunk =
+                io.readBufferMemory.data() + connection.readBufferIndex * READ_BUFFER_SIZE;
+        } else {
+            connection.ownReadBuffer.resize(READ_BUFFER_SIZE);
+            connection.readChunk = connection.ownReadBuffer.data();
+        }
+    }
+
+    uint64_t userData = userDataFor(connection.fd, Completion::Read);
+    if (connection.readBufferIndex >= 0 && io.readBuffersRegistered)
+        io.ring->prepareReadFixed(connection.fd, connection.readChunk, READ_BUFFER_SIZE, 0,
+                                  userData);
+    else
+        io.ring->prepareRead(connection.fd, connection.readChunk, READ_BUFFER_SIZE, userData);
+
+    connection.readInFlight = true;
+    ++io.numInFlight;
+}
+
+void
+RpcClient::startSend(IoThread &io, Connection &connection)
+{
+    if (connection.sendInFlight)
+        return;
+
+    {
+        // A closed connection may already be dropped by the thread; nothing more may be started
+        // on it.
+        lock_guard<mutex> lock(connection.mut);
+        if (connection.closed)
+            return;
+
+        if (connection.sendOffset == connection.sending.size()) {
+            connection.sending.clear();
+            connection.sendOffset = 0;
+
+            // Keeps both buffers' memory around for the next frames.
+            connection.sending.swap(connection.outgoing);
+        }
+    }
+
+    if (connection.sending.empty())
+        return;
+
+    size_t length = min(connection.sending.size() - connection.sendOffset,
+                        (size_t)RpcFrameHeader::MAX_BODY_LENGTH);
+    io.ring->prepareSend(connection.fd, connection.sending.data() + connection.sendOffset,
+                         (unsigned)length, userDataFor(connection.fd, Completion::Send));
+
+    connection.sendInFlight = true;
+    ++io.numInFlight;
+}
+
+void
+RpcClient::markReady(const ConnectionPtr &connection)
+{
+    IoThread &io = *connection->io;
+    {
+        lock_guard<mutex> lock(io.mut);
+        io.ready.push_back(connection);
+    }
+
+    if (!io.wakePending.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t rc = write(io.wakeFd, &one, sizeof(one));
+        (void)rc;
+    }
+}
+
+void
+RpcClient::sweepConnections(IoThread &io, const function<bool(Connection &)> &canDrop)
+{
+    vector<ConnectionPtr> connections;
+    {
+        lock_guard<mutex> lock(io.mut);
+        for (auto it = io.connections.begin(); it != io.connections.end();) {
+            bool closed;
+            {
+                lock_guard<mutex> connectionLock(it->second->mut);
+                closed = it->second->closed;
+            }
+
+            if (!closed)
+                connections.push_back(it->second);
+
+            if (closed && canDrop(*it->second))
+                it = io.connections.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    Clock::time_point now = Clock::now();
+    for (const ConnectionPtr &connection : connections) {
+        vector<ReplyFunction> expired;
+        {
+            lock_guard<mutex> lock(connection->mut);
+            for (auto it = connection->pending.begin(); it != connection->pending.end();) {
+                if (it->second.deadline <= now) {
+                    expired.push_back(move(it->second.onReply));
+                    it = connection->pending.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        for (ReplyFunction &onReply : expired)
+            onReply(Outcome::Failed, RpcStatus::Ok, {});
+    }
+}
+
+optional<size_t>
+RpcClient::dispatchReplies(Connection &connection, string_view bytes)
+{
+    // Bodies are views into bytes.
+    size_t offset = 0;
+    while (bytes.size() - offset >= RpcFrameHeader::SIZE) {
+        RpcFrameHeader header = RpcFrameHeader::read(bytes.data() + offset);
+        if (header.bodyLength > RpcFrameHeader::MAX_BODY_LENGTH)
+            return nullopt;
+
+        if (bytes.size() - offset - RpcFrameHeader::SIZE < header.bodyLength)
+            break;
+
+        string_view body(bytes.data() + offset + RpcFrameHeader::SIZE, header.bodyLength);
+        offset += RpcFrameHeader::SIZE + header.bodyLength;
+
+        ReplyFunction onReply;
+        {
+            lock_guard<mutex> lock(connection.mut);
+            auto it = connection.pending.find(header.requestId);
+
+            // Already failed by its deadline.
+            if (it == connection.pending.end())
+                continue;
+
+            onReply = move(it->second.onReply);
+            connection.pending.erase(it);
+        }
+
+        onReply(Outcome::Replied, (RpcStatus)header.code, body);
+    }
+
+    return offset;
+}
+
+bool
+RpcClient::dispatchReceived(Connection &connection, string_view received)
+{
+    RpcRecvBuffer &buffer = connection.readBuffer;
+
+    // Usually no partial frame is left over, and the replies are handed out straight from what
+    // was received.
+    if (buffer.empty()) {
+        optional<size_t> used = dispatchReplies(connection, received);
+        if (!used)
+            return false;
+
+        buffer.append(received.substr(*used));
+        return true;
+    }
+
+    buffer.append(received);
+    optional<size_t> used = dispatchReplies(connection, buffer.unread());
+    if (!used)
+        return false;
+
+    buffer.consume(*used);
+    return true;
+}
+
+void
+RpcClient::closeConnection(Connection &connection)
+{
+    unordered_map<uint32_t, PendingCall> pending;
+
+    {
+        lock_guard<mutex> lock(connection.mut);
+        if (connection.closed)
+            return;
+
+        connection.closed = true;
+        pending.swap(connection.pending);
+    }
+
+    // The I/O thread stops watching the connection on its next pass. The socket is closed once
+    // the last reference is gone.
+    shutdown(connection.fd, SHUT_RDWR);
+
+    for (auto &entry : pending)
+        entry.second.onReply(Outcome::Failed, RpcStatus::Ok, {});
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "IoUring.h"
+#include "RpcProtocol.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// Sends RPC frames (see RpcProtocol.h) to other nodes over persistent TCP connections. Each peer
+/// has a small pool of connections, opened on first use and reopened after they break; calls are
+/// spread over the pool in turn. Requests on a connection are pipelined: each is matched to its
+/// reply by request ID, so a slow request does not hold up the ones behind it.
+///
+/// Replies are read by a fixed number of I/O threads, each of which watches a share of the
+/// connections. With the epoll backend, callers write requests to the socket themselves and the
+/// threads wait for replies with epoll. With the io_uring backend, callers only queue requests;
+/// each thread hands the queued sends and its reads to the kernel in one batch per wakeup, and
+/// reads into buffers registered with the kernel.
+///
+/// Thread-safe.
+class RpcClient
+{
+public:
+    enum class Outcome
+    {
+        /// The peer replied; status and body are valid.
+        Replied,
+
+        /// No reply before the timeout, or the connection broke first.
+        Failed
+    };
+
+    enum class Backend
+    {
+        Epoll,
+        IoUring
+    };
+
+    /// Called once per call, usually on an I/O thread. The body is only valid during the call.
+    using ReplyFunction =
+        std::function<void(Outcome outcome, RpcStatus status, std::string_view body)>;
+
+    /// If the io_uring backend is asked for but the kernel doesn't support it, the client uses
+    /// epoll instead (see backend()). Every node is expected to listen for RPC on rpcPort.
+    RpcClient(size_t numIoThreads = 2, size_t connectionsPerPeer = 2,
+              Backend backend = Backend::Epoll, uint16_t rpcPort = DEFAULT_RPC_PORT);
+
+    RpcClient(const RpcClient &) = delete;
+    RpcClient &operator=(const RpcClient &) = delete;
+
+    /// Closes every connection and stops the I/O threads. Calls that haven't been answered fail.
+    ~RpcClient();
+
+    /// Sends a request to the RPC port of the node at address (see rpcAddressFor()). Returns false
+    /// without calling onReply if the node refused the connection, which means it has no RPC
+    /// listener and the caller should use HTTP instead. Otherwise onReply is called exactly once.
+    bool call(const std::string &address, RpcOp op, std::string_view body,
+              std::chrono::milliseconds timeout, ReplyFunction onReply);
+
+    /// Returns the address of the RPC listener of the node whose HTTP address is httpAddress: the
+    /// same host, on the RPC port.
+    std::string rpcAddressFor(const std::string &httpAddress) const;
+
+    /// Returns the backend in use.
+    Backend backend() const { return mBackend; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct PendingCall
+    {
+        Clock::time_point deadline;
+        ReplyFunction onReply;
+    };
+
+    struct IoThread;
+
+    struct Connection
+    {
+        Connection(int fd)
+            : fd(fd)
+        {
+        }
+
+        ~Connection();
+
+        const int fd;
+
+        /// The I/O thread that reads the connection's replies.
+        IoThread *io = nullptr;
+
+        /// Serializes writes so frames are never interleaved. Only used with the epoll backend.
+        std::mutex writeMut;
+
+        /// Protects the fields below.
+        std::mutex mut;
+        std::unordered_map<uint32_t, PendingCall> pending;
+        uint32_t nextRequestId = 0;
+        bool closed = false;
+
+        /// Frames waiting to be sent by the I/O thread. Only used with the io_uring backend.
+        std::string outgoing;
+
+        /// Bytes received but not yet handed out. Only touched by the connection's I/O thread.
+        RpcRecvBuffer readBuffer;
+
+        // Only used by the I/O thread, with the io_uring backend.
+
+        /// Frames being sent, and how much of them has been sent.
+        std::string sending;
+        size_t sendOffset = 0;
+
+        bool readInFlight = false;
+        bool sendInFlight = false;
+
+        /// Where the kernel puts received bytes: one of the thread's registered read buffers, or
+        /// ownReadBuffer if they were all taken.
+        char *readChunk = nullptr;
+        int readBufferIndex = -1;
+        std::vector<char> ownReadBuffer;
+    };
+
+    using ConnectionPtr = std::shared_ptr<Connection>;
+
+    /// The connections to one peer.
+    struct Peer
+    {
+        std::vector<ConnectionPtr> connections;
+        size_t next = 0;
+
+        /// A peer that refused a connection isn't asked again until this time, so falling back to
+        /// HTTP costs nothing extra per call.
+        Clock::time_point refusedUntil;
+    };
+
+    struct IoThread
+    {
+        /// Only used with the epoll backend.
+        int epollFd = -1;
+
+        /// Connections watched by this thread, by socket. Protected by mut.
+        std::mutex mut;
+        std::unordered_map<int, ConnectionPtr> connections;
+
+        // Only used with the io_uring backend.
+
+        std::unique_ptr<IoUring> ring;
+
+        /// Connections that are new or have frames to send. Protected by mut.
+        std::vector<ConnectionPtr> ready;
+
+        /// Written to wake the thread up when ready gets a connection. wakePending is set from the
+        /// write until the thread has woken up, so callers don't write again in the meantime.
+        int wakeFd = -1;
+        uint64_t wakeValue = 0;
+        std::atomic<bool> wakePending{false};
+
+        /// Registered with the ring, and cut into read buffers for the connections.
+        std::vector<char> readBufferMemory;
+        bool readBuffersRegistered = false;
+        std::vector<int> freeReadBuffers;
+
+        /// Operations handed to the ring that haven't completed yet.
+        size_t numInFlight = 0;
+
+        std::thread thread;
+    };
+
+    /// Returns an open connection to the address, opening one if the pool isn't full. Returns null
+    /// if the connection was refused. Sets timedOut instead if connecting took longer than timeout.
+    ConnectionPtr getConnection(const std::string &address, std::chrono::milliseconds timeout,
+                                bool &timedOut);
+
+    /// Reads replies from the thread's connections with epoll, drops the ones that broke, and
+    /// fails calls that are past their deadline.
+    void epollThread(IoThread &io);
+
+    /// Does the same as epollThread() with io_uring, and sends the frames queued by callers. Runs
+    /// until the client stops and no operations are left in flight.
+    void ioUringThread(IoThread &io);
+
+    /// Queues a read on the connection with the thread's ring, unless one is in flight.
+    static void startRead(IoThread &io, Connection &connection);
+
+    /// Queues a send of the connection's outgoing frames with the thread's ring, unless one is in
+    /// flight.
+    static void startSend(IoThread &io, Connection &connection);
+
+    /// Lets the connection's I/O thread know that it is new or has frames to send.
+    static void markReady(const ConnectionPtr &connection);
+
+    /// Drops the thread's closed connections that canDrop allows, and fails calls that are past
+    /// their deadline. A connection stays up when a call times out; a late reply is dropped when it
+    /// arrives.
+    static void sweepConnections(IoThread &io, const std::function<bool(Connection &)> &canDrop);
+
+    /// Hands out every complete reply in bytes. Returns the number of bytes used, or nothing if
+    /// bytes holds something that isn't a valid frame.
+    static std::optional<size_t> dispatchReplies(Connection &connection, std::string_view bytes);
+
+    /// Hands out the replies in the connection's read buffer followed by received, and keeps the
+    /// rest in the read buffer. Returns false if they aren't valid frames.
+    static bool dispatchReceived(Connection &connection, std::string_view received);
+
+    /// Marks the connection closed and fails every call still waiting on it.
+    static void closeConnection(Connection &connection);
+
+    const size_t mConnectionsPerPeer;
+    Backend mBackend;
+    const uint16_t mRpcPort;
+
+    std::vector<std::unique_ptr<IoThread>> mIoThreads;
+    std::atomic<size_t> mNextIoThread{0};
+    std::atomic<bool> mStopping{false};
+
+    /// Used to protect mPeers.
+    std::mutex mPeersMut;
+    std::unordered_map<std::string, Peer> mPeers;
+};
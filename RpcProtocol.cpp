@@ -0,0 +1,311 @@
+#include "RpcProtocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <unordered_map>
+
+using namespace std;
+
+namespace
+{
+
+void
+putLittleEndian(char *out, uint64_t val, size_t numBytes)
+{
+    for (size_t idx = 0; idx < numBytes; ++idx)
+        out[idx] = (char)((val >> (8 * idx)) & 0xff);
+}
+
+uint64_t
+getLittleEndian(const char *in, size_t numBytes)
+{
+    uint64_t val = 0;
+    for (size_t idx = 0; idx < numBytes; ++idx)
+        val |= (uint64_t)(unsigned char)in[idx] << (8 * idx);
+    return val;
+}
+
+} // namespace
+
+void
+RpcFrameHeader::write(char *out) const
+{
+    putLittleEndian(out, bodyLength, 4);
+    putLittleEndian(out + 4, requestId, 4);
+    out[8] = (char)code;
+}
+
+RpcFrameHeader
+RpcFrameHeader::read(const char *in)
+{
+    RpcFrameHeader header;
+    header.bodyLength = (uint32_t)getLittleEndian(in, 4);
+    header.requestId = (uint32_t)getLittleEndian(in + 4, 4);
+    header.code = (uint8_t)in[8];
+    return header;
+}
+
+void
+appendRpcFrame(string &buffer, uint32_t requestId, uint8_t code, string_view body)
+{
+    char header[RpcFrameHeader::SIZE];
+    RpcFrameHeader{(uint32_t)body.size(), requestId, code}.write(header);
+
+    buffer.append(header, sizeof(header));
+    buffer.append(body.data(), body.size());
+}
+
+bool
+sendRpcFrame(int fd, uint32_t requestId, uint8_t code, string_view body)
+{
+    char header[RpcFrameHeader::SIZE];
+    RpcFrameHeader{(uint32_t)body.size(), requestId, code}.write(header);
+
+    // Small frames go out in one send, which matters with TCP_NODELAY.
+    string_view parts[2] = {string_view(header, sizeof(header)), body};
+    std::string joined;
+    if (body.size() <= 4096) {
+        joined.reserve(sizeof(header) + body.size());
+        appendRpcFrame(joined, requestId, code, body);
+        parts[0] = joined;
+        parts[1] = string_view();
+    }
+
+    for (string_view part : parts) {
+        while (!part.empty()) {
+            ssize_t sent = send(fd, part.data(), part.size(), MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent <= 0)
+                return false;
+            part.remove_prefix((size_t)sent);
+        }
+    }
+
+    return true;
+}
+
+bool
+RpcRecvBuffer::recv(int fd)
+{
+    // Each receive has room for at least this much.
+    const size_t CHUNK_SIZE = 64 * 1024;
+
+    reserve(CHUNK_SIZE);
+
+    ssize_t received;
+    do {
+        received = ::recv(fd, mStorage.get() + mWriteOffset, mCapacity - mWriteOffset, 0);
+    } while (received < 0 && errno == EINTR);
+
+    if (received <= 0)
+        return false;
+
+    mWriteOffset += (size_t)received;
+    return true;
+}
+
+void
+RpcRecvBuffer::append(string_view bytes)
+{
+    if (bytes.empty())
+        return;
+
+    reserve(bytes.size());
+    memcpy(mStorage.get() + mWriteOffset, bytes.data(), bytes.size());
+    mWriteOffset += bytes.size();
+}
+
+void
+RpcRecvBuffer::reserve(size_t n)
+{
+    // Storage is never smaller than this, so a new one is needed at most once per this many bytes.
+    const size_t MIN_CAPACITY = 256 * 1024;
+
+    if (mCapacity - mWriteOffset >= n)
+        return;
+
+    size_t numUnread = mWriteOffset - mReadOffset;
+
+    // Nobody else looks at the storage, and it has room once the unread bytes are moved to the
+    // front. Other holders only ever let go of it, so the count can't grow behind our back.
+    if (mStorage && mStorage.use_count() == 1 && mCapacity >= numUnread + n) {
+        memmove(mStorage.get(), mStorage.get() + mReadOffset, numUnread);
+    } else {
+        // The unread bytes are usually part of a frame. The capacity doubles as a large frame
+        // comes in, so it is copied a bounded number of times.
+        size_t capacity = max({numUnread + n, 2 * numUnread, MIN_CAPACITY});
+        shared_ptr<char[]> storage(new char[capacity]);
+        if (numUnread != 0)
+            memcpy(storage.get(), mStorage.get() + mReadOffset, numUnread);
+
+        mStorage = move(storage);
+        mCapacity = capacity;
+    }
+
+    mReadOffset = 0;
+    mWriteOffset = numUnread;
+}
+
+void
+RpcWriter::u8(uint8_t val)
+{
+    mBuffer += (char)val;
+}
+
+void
+RpcWriter::u32(uint32_t val)
+{
+    char bytes[4];
+    putLittleEndian(bytes, val, 4);
+    mBuffer.append(bytes, 4);
+}
+
+void
+RpcWriter::u64(uint64_t val)
+{
+    char bytes[8];
+    putLittleEndian(bytes, val, 8);
+    mBuffer.append(bytes, 8);
+}
+
+void
+RpcWriter::string(string_view str)
+{
+    u32((uint32_t)str.size());
+    mBuffer.append(str.data(), str.size());
+}
+
+void
+RpcWriter::clock(const VectorClock &clock)
+{
+    i64(clock.physicalTimeStamp());
+
+    const auto &nodeClocks = clock.nodeClocks();
+    u32((uint32_t)nodeClocks.size());
+    for (const auto &entry : nodeClocks) {
+        string(entry.first);
+        i32(entry.second);
+    }
+}
+
+void
+RpcWriter::dataVersion(const DataVersion &dataVersion)
+{
+    clock(dataVersion.clock);
+    string(dataVersion.value);
+}
+
+void
+RpcWriter::scheme(const ShardScheme &scheme)
+{
+    i32(scheme.version());
+    u32((uint32_t)scheme.getNumShards());
+
+    for (size_t id = 0; id < scheme.getNumShards(); ++id) {
+        const ShardInfo &shard = scheme.getShardInfo(id);
+
+        u64(shard.getHash());
+        u32((uint32_t)shard.getNumNodes());
+        for (const std::string &node : shard.getNodeSet())
+            string(node);
+
+        u32((uint32_t)shard.getTokens().size());
+        for (size_t token : shard.getTokens())
+            u64(token);
+    }
+}
+
+string_view
+RpcReader::take(size_t n)
+{
+    if (n > mRemaining.size())
+        throw RpcDecodeError();
+
+    string_view taken = mRemaining.substr(0, n);
+    mRemaining.remove_prefix(n);
+    return taken;
+}
+
+uint8_t
+RpcReader::u8()
+{
+    return (uint8_t)take(1)[0];
+}
+
+uint32_t
+RpcReader::u32()
+{
+    return (uint32_t)getLittleEndian(take(4).data(), 4);
+}
+
+uint64_t
+RpcReader::u64()
+{
+    return getLittleEndian(take(8).data(), 8);
+}
+
+string_view
+RpcReader::string()
+{
+    return take(u32());
+}
+
+uint32_t
+RpcReader::count(size_t minSize)
+{
+    uint32_t n = u32();
+    if (minSize > 0 && n > mRemaining.size() / minSize)
+        throw RpcDecodeError();
+
+    return n;
+}
+
+VectorClock
+RpcReader::clock()
+{
+    time_t timeStamp = (time_t)i64();
+
+    uint32_t numNodes = u32();
+    unordered_map<std::string, int> nodeClocks;
+    for (uint32_t idx = 0; idx < numNodes; ++idx) {
+        std::string node(string());
+        nodeClocks[node] = i32();
+    }
+
+    return VectorClock(move(nodeClocks), timeStamp);
+}
+
+DataVersion
+RpcReader::dataVersion()
+{
+    VectorClock versionClock = clock();
+    return DataVersion(std::string(string()), versionClock);
+}
+
+ShardScheme
+RpcReader::scheme()
+{
+    int version = i32();
+    uint32_t numShards = u32();
+
+    ShardScheme scheme(version);
+
+    for (uint32_t id = 0; id < numShards; ++id) {
+        ShardInfo shard(u64());
+
+        uint32_t numNodes = u32();
+        for (uint32_t nodeIdx = 0; nodeIdx < numNodes; ++nodeIdx)
+            shard.addNode(std::string(string()));
+
+        uint32_t numTokens = u32();
+        for (uint32_t tokenIdx = 0; tokenIdx < numTokens; ++tokenIdx)
+            shard.addToken(u64());
+
+        scheme.addShard(shard);
+    }
+
+    return scheme;
+}
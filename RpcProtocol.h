@@ -0,0 +1,199 @@
+#pragma once
+
+#include "DataVersion.h"
+#include "ShardScheme.h"
+#include "VectorClock.h"
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/// Binary protocol for inter-server messages. Every message is a frame: a fixed-size header
+/// followed by a body.
+///
+///     u32 body length | u32 request ID | u8 op (requests) or status (replies) | body
+///
+/// A reply carries the request ID of the request it answers, so replies on a connection can
+/// arrive in any order. Integers are little-endian. Strings are a u32 length followed by the
+/// bytes, with no escaping.
+
+/// The port every node listens for RPC on, unless it is started with another one. All nodes must
+/// use the same port.
+const uint16_t DEFAULT_RPC_PORT = 8081;
+
+/// Inter-server operations. Each one has an equivalent PATCH route under /inter_server/.
+enum class RpcOp : uint8_t
+{
+    /// key -> u8 found, i32 scheme version, [data version if found]
+    DataGet = 1,
+
+    /// u32 n, n * (key, data version) -> nothing. Same as dataSync/push.
+    DataPush = 2,
+
+    /// scheme -> nothing. Same as shards/prepare.
+    ShardPrepare = 3,
+
+    /// i32 scheme version -> nothing. Same as shards/switch. Rejected until the switch is done.
+    ShardSwitch = 4,
+
+    /// i32 scheme version, key, data version -> nothing. Same as shards/move.
+    ShardMove = 5,
+
+    /// nothing -> u64 number of keys. Same as count.
+    Count = 6,
+
+    /// i32 scheme version, u32 n, n * (key, data version) -> nothing. Same as shards/moveBatch.
+    ShardMoveBatch = 7,
+
+    /// scheme -> u32 n, n * (u64 keys, u64 bytes). Same as shards/plan.
+    ShardPlan = 8
+};
+
+enum class RpcStatus : uint8_t
+{
+    Ok = 0,
+
+    /// The request was understood but refused (the HTTP routes answer these with an error code).
+    Rejected = 1,
+
+    BadRequest = 2
+};
+
+struct RpcFrameHeader
+{
+    static const size_t SIZE = 9;
+
+    /// Frames with larger bodies are treated as a protocol error.
+    static const uint32_t MAX_BODY_LENGTH = 1u << 30;
+
+    uint32_t bodyLength;
+    uint32_t requestId;
+
+    /// RpcOp for requests, RpcStatus for replies.
+    uint8_t code;
+
+    /// Writes the header into the first SIZE bytes of out.
+    void write(char *out) const;
+
+    /// Reads a header from the first SIZE bytes of in.
+    static RpcFrameHeader read(const char *in);
+};
+
+/// Appends a whole frame to buffer.
+void appendRpcFrame(std::string &buffer, uint32_t requestId, uint8_t code, std::string_view body);
+
+/// Writes a whole frame to the socket, blocking until it has been sent. Returns false if the socket
+/// failed. Callers must make sure that only one thread writes to a socket at a time.
+bool sendRpcFrame(int fd, uint32_t requestId, uint8_t code, std::string_view body);
+
+/// Bytes received from a socket, which frames are read from in place. Bytes are received after
+/// the write offset and consumed from the read offset, so receiving neither clears memory nor
+/// moves what is already there. Frame bodies can be handed to other threads as views: share()
+/// keeps the storage alive, and while it is shared the buffer moves on to new storage rather than
+/// overwrite it.
+class RpcRecvBuffer
+{
+public:
+    /// Reads whatever the socket has (waiting if it has nothing). Returns false if the socket was
+    /// closed or failed.
+    bool recv(int fd);
+
+    /// Appends bytes that were received some other way.
+    void append(std::string_view bytes);
+
+    /// The bytes received and not consumed yet.
+    std::string_view unread() const
+    {
+        return std::string_view(mStorage.get() + mReadOffset, mWriteOffset - mReadOffset);
+    }
+
+    bool empty() const { return mReadOffset == mWriteOffset; }
+
+    /// Drops the first n unread bytes.
+    void consume(size_t n) { mReadOffset += n; }
+
+    /// Returns a handle that keeps the bytes unread() points to where they are.
+    std::shared_ptr<const void> share() const { return mStorage; }
+
+private:
+    /// Makes room for at least n bytes after the write offset.
+    void reserve(size_t n);
+
+    std::shared_ptr<char[]> mStorage;
+    size_t mCapacity = 0;
+    size_t mReadOffset = 0;
+    size_t mWriteOffset = 0;
+};
+
+/// Thrown by RpcReader when a body is shorter than its contents claim.
+class RpcDecodeError : public std::runtime_error
+{
+public:
+    RpcDecodeError()
+        : std::runtime_error("truncated RPC message")
+    {
+    }
+};
+
+/// Builds a frame body.
+class RpcWriter
+{
+public:
+    void u8(uint8_t val);
+    void u32(uint32_t val);
+    void i32(int32_t val) { u32((uint32_t)val); }
+    void u64(uint64_t val);
+    void i64(int64_t val) { u64((uint64_t)val); }
+    void string(std::string_view str);
+
+    void clock(const VectorClock &clock);
+    void dataVersion(const DataVersion &dataVersion);
+    void scheme(const ShardScheme &scheme);
+
+    const std::string &buffer() const { return mBuffer; }
+    std::string &buffer() { return mBuffer; }
+
+private:
+    std::string mBuffer;
+};
+
+/// Reads a frame body. Strings are returned as views into the body, so nothing is copied until
+/// the caller decides to keep it; the body must outlive the views.
+class RpcReader
+{
+public:
+    /// The fewest bytes a key followed by a data version takes.
+    static const size_t MIN_ENTRY_SIZE = 20;
+
+    RpcReader(std::string_view body)
+        : mRemaining(body)
+    {
+    }
+
+    uint8_t u8();
+    uint32_t u32();
+    int32_t i32() { return (int32_t)u32(); }
+    uint64_t u64();
+    int64_t i64() { return (int64_t)u64(); }
+    std::string_view string();
+
+    /// Reads a u32 number of elements that each take at least minSize bytes. Throws
+    /// RpcDecodeError if the rest of the body is too short for them, so callers can reserve room
+    /// for that many.
+    uint32_t count(size_t minSize);
+
+    VectorClock clock();
+    DataVersion dataVersion();
+    ShardScheme scheme();
+
+    /// Returns true if the whole body has been read.
+    bool atEnd() const { return mRemaining.empty(); }
+
+private:
+    /// Returns the next n bytes and moves past them.
+    std::string_view take(size_t n);
+
+    std::string_view mRemaining;
+};
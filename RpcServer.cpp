@@ -0,0 +1,132 @@
+#include "RpcServer.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+RpcServer::Connection::~Connection() { close(fd); }
+
+RpcServer::RpcServer(uint16_t port, Handler handler, size_t numWorkers)
+    : mPort(port)
+    , mHandler(handler)
+    , mNumWorkers(numWorkers)
+{
+}
+
+bool
+RpcServer::start()
+{
+    int listenFd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0)
+        return false;
+
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    // Accept IPv4 connections too.
+    int zero = 0;
+    setsockopt(listenFd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+
+    sockaddr_in6 addr = {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(mPort);
+
+    if (bind(listenFd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenFd, 128) < 0) {
+        close(listenFd);
+        return false;
+    }
+
+    for (size_t idx = 0; idx < mNumWorkers; ++idx)
+        thread(&RpcServer::workerThread, this).detach();
+
+    thread(&RpcServer::acceptThread, this, listenFd).detach();
+
+    return true;
+}
+
+void
+RpcServer::acceptThread(int listenFd)
+{
+    while (true) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        thread(&RpcServer::connectionThread, this, make_shared<Connection>(fd)).detach();
+    }
+}
+
+void
+RpcServer::connectionThread(ConnectionPtr connection)
+{
+    RpcRecvBuffer buffer;
+
+    while (buffer.recv(connection->fd)) {
+        string_view bytes = buffer.unread();
+
+        // The requests share what was received instead of each copying its body.
+        shared_ptr<const void> storage = buffer.share();
+
+        size_t offset = 0;
+        while (bytes.size() - offset >= RpcFrameHeader::SIZE) {
+            RpcFrameHeader header = RpcFrameHeader::read(bytes.data() + offset);
+            if (header.bodyLength > RpcFrameHeader::MAX_BODY_LENGTH)
+                return;
+
+            if (bytes.size() - offset - RpcFrameHeader::SIZE < header.bodyLength)
+                break;
+
+            Request request{connection, header.requestId, (RpcOp)header.code, storage,
+                            bytes.substr(offset + RpcFrameHeader::SIZE, header.bodyLength)};
+            offset += RpcFrameHeader::SIZE + header.bodyLength;
+
+            {
+                lock_guard<mutex> lock(mRequestsMut);
+                mRequests.push_back(move(request));
+            }
+            mRequestsCV.notify_one();
+        }
+
+        buffer.consume(offset);
+    }
+
+    // The socket closes once the workers are done with the connection's requests.
+}
+
+void
+RpcServer::workerThread()
+{
+    while (true) {
+        Request request;
+        {
+            unique_lock<mutex> lock(mRequestsMut);
+            mRequestsCV.wait(lock, [this]() { return !mRequests.empty(); });
+
+            request = move(mRequests.front());
+            mRequests.pop_front();
+        }
+
+        RpcReader reader(request.body);
+        RpcWriter writer;
+        RpcStatus status;
+
+        try {
+            status = mHandler(request.op, reader, writer);
+        } catch (const exception &) {
+            // Malformed bodies throw RpcDecodeError, but nothing a handler throws may take the
+            // worker down with it.
+            status = RpcStatus::BadRequest;
+            writer.buffer().clear();
+        }
+
+        lock_guard<mutex> lock(request.connection->writeMut);
+        sendRpcFrame(request.connection->fd, request.requestId, (uint8_t)status, writer.buffer());
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "RpcProtocol.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/// Accepts RPC connections from other nodes (see RpcProtocol.h) and answers their requests. Each
+/// connection has a thread that reads frames; requests are handled on a fixed pool of worker
+/// threads, so a request that blocks (such as a shard switch waiting on its moves) doesn't hold up
+/// the requests behind it on the same connection.
+class RpcServer
+{
+public:
+    /// Reads the request and writes the reply body. A decode error is answered with BadRequest.
+    using Handler = std::function<RpcStatus(RpcOp op, RpcReader &request, RpcWriter &reply)>;
+
+    RpcServer(uint16_t port, Handler handler, size_t numWorkers = 8);
+
+    RpcServer(const RpcServer &) = delete;
+    RpcServer &operator=(const RpcServer &) = delete;
+
+    /// Starts listening. Returns false if the port couldn't be bound; the node then only talks
+    /// HTTP, which the other nodes fall back to.
+    bool start();
+
+private:
+    struct Connection
+    {
+        Connection(int fd)
+            : fd(fd)
+        {
+        }
+
+        ~Connection();
+
+        const int fd;
+
+        /// Serializes writes so replies are never interleaved.
+        std::mutex writeMut;
+    };
+
+    using ConnectionPtr = std::shared_ptr<Connection>;
+
+    struct Request
+    {
+        ConnectionPtr connection;
+        uint32_t requestId;
+        RpcOp op;
+
+        /// The body is a view into the connection's receive buffer, which storage keeps alive.
+        std::shared_ptr<const void> storage;
+        std::string_view body;
+    };
+
+    void acceptThread(int listenFd);
+    void connectionThread(ConnectionPtr connection);
+    void workerThread();
+
+    const uint16_t mPort;
+    Handler mHandler;
+    const size_t mNumWorkers;
+
+    /// Requests waiting for a worker. Protected by mRequestsMut.
+    std::mutex mRequestsMut;
+    std::condition_variable mRequestsCV;
+    std::deque<Request> mRequests;
+};
@@ -0,0 +1,114 @@
+#include "SchemeChange.h"
+
+using namespace std;
+
+SchemeChange::SchemeChange(const ShardScheme &newScheme, SendFunction sendPrepare,
+                           SendFunction sendSwitch)
+    : mNewScheme(newScheme)
+    , mSendPrepare(sendPrepare)
+    , mSendSwitch(sendSwitch)
+{
+    size_t numShards = mNewScheme.getNumShards();
+    mNumPrepared.resize(numShards, 0);
+    mNumSwitched.resize(numShards, 0);
+
+    // A shard without nodes has nothing to wait for.
+    for (size_t shardId = 0; shardId < numShards; ++shardId) {
+        size_t quorum = (mNewScheme.getShardInfo(shardId).getNumNodes() + 1) / 2;
+        mQuorums.push_back(quorum);
+        if (quorum == 0) {
+            ++mNumShardsPrepared;
+            ++mNumShardsSwitched;
+        }
+    }
+
+    if (mNumShardsSwitched == numShards)
+        mPhase = Phase::Committed;
+}
+
+void
+SchemeChange::start()
+{
+    {
+        lock_guard<mutex> lock(mMut);
+        if (mPhase != Phase::Preparing)
+            return;
+    }
+
+    shared_ptr<SchemeChange> self = shared_from_this();
+
+    for (size_t shardId = 0; shardId < mNewScheme.getNumShards(); ++shardId) {
+        for (const string &address : mNewScheme.getShardInfo(shardId).getNodeSet()) {
+            mSendPrepare(address, mShouldStop,
+                         [self, shardId, address]() { self->prepared(shardId, address); });
+        }
+    }
+}
+
+bool
+SchemeChange::wait()
+{
+    unique_lock<mutex> lock(mMut);
+    mDone.wait(lock,
+               [this]() { return mPhase == Phase::Committed || mPhase == Phase::Stopped; });
+    return mPhase == Phase::Committed;
+}
+
+void
+SchemeChange::stop()
+{
+    *mShouldStop = true;
+
+    lock_guard<mutex> lock(mMut);
+    if (mPhase != Phase::Committed) {
+        mPhase = Phase::Stopped;
+        mDone.notify_all();
+    }
+}
+
+void
+SchemeChange::prepared(size_t shardId, const string &address)
+{
+    vector<pair<size_t, string>> toSwitch;
+
+    {
+        lock_guard<mutex> lock(mMut);
+        if (mPhase == Phase::Stopped)
+            return;
+
+        mPreparedNodes.emplace_back(shardId, address);
+        if (++mNumPrepared[shardId] == mQuorums[shardId])
+            ++mNumShardsPrepared;
+
+        if (mPhase != Phase::Preparing) {
+            toSwitch.emplace_back(shardId, address);
+        } else if (mNumShardsPrepared == mQuorums.size()) {
+            mPhase = Phase::Switching;
+            toSwitch = mPreparedNodes;
+        }
+    }
+
+    // Sending may take the scheduler's locks, so it is done without ours.
+    for (const auto &node : toSwitch)
+        sendSwitch(node.first, node.second);
+}
+
+void
+SchemeChange::switched(size_t shardId)
+{
+    lock_guard<mutex> lock(mMut);
+    if (mPhase == Phase::Stopped)
+        return;
+
+    if (++mNumSwitched[shardId] == mQuorums[shardId] && ++mNumShardsSwitched == mQuorums.size()) {
+        mPhase = Phase::Committed;
+        mDone.notify_all();
+    }
+}
+
+void
+SchemeChange::sendSwitch(size_t shardId, const string &address)
+{
+    shared_ptr<SchemeChange> self = shared_from_this();
+    mSendSwitch(address, mShouldStop, [self, shardId]() { self->switched(shardId); });
+}
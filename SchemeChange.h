@@ -0,0 +1,91 @@
+#pragma once
+
+#include "ShardScheme.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Takes the nodes of a new scheme through a scheme change. There are no timers and no thread of
+/// its own: each acknowledgement moves the change along.
+///
+/// - Every node of the new scheme is sent a prepare.
+/// - Once a quorum of every shard has prepared, the nodes that have are sent a switch. Nodes that
+///   prepare after that are sent one right away.
+/// - The change is committed once a quorum of every shard has switched. The other nodes are still
+///   sent the messages they haven't accepted, until they do or stop() is called because a newer
+///   scheme replaces this one.
+/// - A change that is stopped before it is committed is abandoned: nothing more is sent for it.
+///
+/// A shard's quorum is half its nodes, rounded up. Committing a change therefore takes two round
+/// trips to the slowest node of each quorum, plus the time the nodes spend preparing and
+/// switching.
+class SchemeChange : public std::enable_shared_from_this<SchemeChange>
+{
+public:
+    using AtomicBoolPtr = std::shared_ptr<std::atomic<bool>>;
+
+    /// Sends the phase's message to the node until it accepts it, or until shouldStop becomes
+    /// true. Calls accepted() if the node accepts it. accepted() may be called from any thread.
+    using SendFunction = std::function<void(const std::string &address, AtomicBoolPtr shouldStop,
+                                            std::function<void()> accepted)>;
+
+    SchemeChange(const ShardScheme &newScheme, SendFunction sendPrepare, SendFunction sendSwitch);
+
+    /// Sends the prepares. Does not block. Must be called on a shared_ptr, which the messages
+    /// keep alive until they are done.
+    void start();
+
+    /// Waits until the change is committed or stopped. Returns true if it was committed.
+    bool wait();
+
+    /// Stops sending the messages that haven't been accepted yet, and abandons the change unless
+    /// it is committed. Thread-safe.
+    void stop();
+
+    int version() const { return mNewScheme.version(); }
+
+private:
+    enum class Phase
+    {
+        Preparing,
+        Switching,
+        Committed,
+        Stopped
+    };
+
+    void prepared(size_t shardId, const std::string &address);
+    void switched(size_t shardId);
+
+    void sendSwitch(size_t shardId, const std::string &address);
+
+    const ShardScheme mNewScheme;
+    const SendFunction mSendPrepare;
+    const SendFunction mSendSwitch;
+
+    /// Set by stop().
+    const AtomicBoolPtr mShouldStop = std::make_shared<std::atomic<bool>>(false);
+
+    /// Protects everything below. mDone is notified when the change is committed or stopped.
+    std::mutex mMut;
+    std::condition_variable mDone;
+
+    Phase mPhase = Phase::Preparing;
+
+    /// Quorum of each shard, and how many of its nodes have prepared and switched.
+    std::vector<size_t> mQuorums;
+    std::vector<size_t> mNumPrepared;
+    std::vector<size_t> mNumSwitched;
+
+    /// Number of shards whose quorum has prepared, and has switched.
+    size_t mNumShardsPrepared = 0;
+    size_t mNumShardsSwitched = 0;
+
+    /// Nodes that have prepared, with their shard ID.
+    std::vector<std::pair<size_t, std::string>> mPreparedNodes;
+};
@@ -0,0 +1,145 @@
+#include "ShardMigration.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+
+ShardMigration::ShardMigration(SendFunction send, size_t maxBatchesInFlight, size_t maxBatchKeys,
+                               size_t maxBatchBytes, size_t maxBytesPerSecond)
+    : mSend(send)
+    , mMaxBatchesInFlight(maxBatchesInFlight)
+    , mMaxBatchKeys(maxBatchKeys)
+    , mMaxBatchBytes(maxBatchBytes)
+    , mMaxBytesPerSecond(maxBytesPerSecond)
+    , mState(make_shared<State>())
+{
+}
+
+void
+ShardMigration::add(size_t shardId, const string &key, const DataVersion &data)
+{
+    unique_lock<mutex> lock(mState->mut);
+    if (mState->cancelled)
+        return;
+
+    Stream &stream = mState->streams[shardId];
+
+    stream.filling.emplace(key, data);
+    stream.fillingBytes += key.size() + data.value.size();
+    ++mNumKeys;
+
+    if (stream.filling.size() >= mMaxBatchKeys || stream.fillingBytes >= mMaxBatchBytes)
+        send(shardId, lock);
+}
+
+void
+ShardMigration::flush()
+{
+    unique_lock<mutex> lock(mState->mut);
+    sendPartialBatches(lock);
+}
+
+bool
+ShardMigration::finish(chrono::milliseconds timeout)
+{
+    unique_lock<mutex> lock(mState->mut);
+    sendPartialBatches(lock);
+
+    auto isDone = [this]() {
+        if (mState->cancelled)
+            return true;
+
+        for (const auto &entry : mState->streams) {
+            if (entry.second.batchesInFlight != 0)
+                return false;
+        }
+        return true;
+    };
+
+    if (timeout == chrono::milliseconds::zero())
+        mState->batchDone.wait(lock, isDone);
+    else if (!mState->batchDone.wait_for(lock, timeout, isDone))
+        return false;
+
+    return !mState->cancelled;
+}
+
+void
+ShardMigration::cancel()
+{
+    lock_guard<mutex> lock(mState->mut);
+    mState->cancelled = true;
+    mState->batchDone.notify_all();
+}
+
+uint64_t
+ShardMigration::numKeysAcknowledged() const
+{
+    lock_guard<mutex> lock(mState->mut);
+    return mState->keysAcknowledged;
+}
+
+uint64_t
+ShardMigration::numBytesAcknowledged() const
+{
+    lock_guard<mutex> lock(mState->mut);
+    return mState->bytesAcknowledged;
+}
+
+void
+ShardMigration::sendPartialBatches(unique_lock<mutex> &lock)
+{
+    for (auto &entry : mState->streams) {
+        if (!entry.second.filling.empty())
+            send(entry.first, lock);
+    }
+}
+
+void
+ShardMigration::send(size_t shardId, unique_lock<mutex> &lock)
+{
+    // Streams are never erased, so the reference survives the wait.
+    Stream &stream = mState->streams[shardId];
+    mState->batchDone.wait(lock, [&]() {
+        return mState->cancelled || stream.batchesInFlight < mMaxBatchesInFlight;
+    });
+    if (mState->cancelled)
+        return;
+
+    size_t numBytes = stream.fillingBytes;
+
+    // Only add(), flush() and finish() send, and they don't run concurrently, so mNextSendTime is
+    // only touched here. Acknowledgements only make room in the window while the lock is released.
+    if (mMaxBytesPerSecond != 0) {
+        auto now = chrono::steady_clock::now();
+        if (mNextSendTime > now) {
+            lock.unlock();
+            this_thread::sleep_until(mNextSendTime);
+            lock.lock();
+            if (mState->cancelled)
+                return;
+        }
+
+        mNextSendTime = max(now, mNextSendTime) +
+                        chrono::microseconds(numBytes * 1000000 / mMaxBytesPerSecond);
+    }
+
+    auto batch = make_shared<const DataStore>(move(stream.filling));
+    stream.filling = DataStore();
+    stream.fillingBytes = 0;
+    ++stream.batchesInFlight;
+    ++mNumBatches;
+
+    // A send that is acknowledged right away takes the lock in done().
+    lock.unlock();
+    size_t numKeys = batch->size();
+    mSend(shardId, batch, [state = mState, shardId, numKeys, numBytes]() {
+        lock_guard<mutex> doneLock(state->mut);
+        --state->streams[shardId].batchesInFlight;
+        state->keysAcknowledged += numKeys;
+        state->bytesAcknowledged += numBytes;
+        state->batchDone.notify_all();
+    });
+    lock.lock();
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "DataVersion.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/// Streams the keys a reshard moves off this node to the shards that own them under the new
+/// scheme. Each target shard gets one stream: keys are collected into batches of at most
+/// maxBatchKeys keys or maxBatchBytes bytes of keys and values, and at most maxBatchesInFlight
+/// batches per shard are waiting to be acknowledged. When a shard's window is full, add() blocks
+/// until the shard has acknowledged a batch, so a slow receiver slows the sender down instead of
+/// piling up messages.
+///
+/// If maxBytesPerSecond isn't 0, batches are paced so the migration sends at most that many bytes
+/// of keys and values per second, over all shards; add() waits out the pace like a full window.
+///
+/// A batch that is retried after a partial failure may be applied twice, which is harmless since
+/// receivers keep whichever version of a moved key has the newer clock.
+///
+/// add(), flush(), finish() and stopPacing() must not be called concurrently. Batches still in
+/// flight when the migration is destroyed may call done() afterwards; that is harmless.
+class ShardMigration
+{
+public:
+    /// Sends the batch to some node of the shard, retrying until one accepts it, then calls
+    /// done(). done() may be called from any thread.
+    using SendFunction = std::function<void(size_t shardId, std::shared_ptr<const DataStore> batch,
+                                            std::function<void()> done)>;
+
+    ShardMigration(SendFunction send, size_t maxBatchesInFlight = 4, size_t maxBatchKeys = 1024,
+                   size_t maxBatchBytes = 1 << 20, size_t maxBytesPerSecond = 0);
+
+    /// Queues the key for the shard, sending the shard's batch if it is full.
+    void add(size_t shardId, const std::string &key, const DataVersion &data);
+
+    /// Sends every partial batch. Waits for room in each shard's window and for the pace, but not
+    /// for the batches to be acknowledged.
+    void flush();
+
+    /// Sends every partial batch and waits until all batches have been acknowledged, for at most
+    /// timeout unless it is 0. Returns false if the migration was cancelled or the timeout expired.
+    bool finish(std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
+
+    /// Stops pacing the batches sent from now on. For the tail of a migration that something is
+    /// waiting on.
+    void stopPacing() { mMaxBytesPerSecond = 0; }
+
+    /// Stops the migration: add() and finish() return right away from now on, including calls
+    /// that are waiting. Batches that have been sent are not called back. Thread-safe.
+    void cancel();
+
+    /// Number of keys added, and number of batches sent for them.
+    size_t numKeys() const { return mNumKeys; }
+    size_t numBatches() const { return mNumBatches; }
+
+    /// Number of keys, and bytes of keys and values, in batches that have been acknowledged.
+    /// Thread-safe.
+    uint64_t numKeysAcknowledged() const;
+    uint64_t numBytesAcknowledged() const;
+
+private:
+    struct Stream
+    {
+        DataStore filling;
+        size_t fillingBytes = 0;
+        size_t batchesInFlight = 0;
+    };
+
+    /// What acknowledgements update. Shared with the callbacks of batches in flight.
+    struct State
+    {
+        /// Protects everything below. batchDone is notified whenever a batch is acknowledged, and
+        /// when the migration is cancelled.
+        std::mutex mut;
+        std::condition_variable batchDone;
+        std::unordered_map<size_t, Stream> streams;
+        bool cancelled = false;
+        uint64_t keysAcknowledged = 0;
+        uint64_t bytesAcknowledged = 0;
+    };
+
+    /// Sends what every stream has collected.
+    void sendPartialBatches(std::unique_lock<std::mutex> &lock);
+
+    /// Waits for room in the stream's window and sends what it has collected.
+    void send(size_t shardId, std::unique_lock<std::mutex> &lock);
+
+    SendFunction mSend;
+    const size_t mMaxBatchesInFlight;
+    const size_t mMaxBatchKeys;
+    const size_t mMaxBatchBytes;
+    size_t mMaxBytesPerSecond;
+
+    /// When the pace allows the next batch to be sent.
+    std::chrono::steady_clock::time_point mNextSendTime;
+
+    size_t mNumKeys = 0;
+    size_t mNumBatches = 0;
+
+    const std::shared_ptr<State> mState;
+};
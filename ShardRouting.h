@@ -0,0 +1,83 @@
+#pragma once
+
+#include <ostream>
+#include <pistache/http_defs.h>
+#include <pistache/http_header.h>
+#include <string>
+
+/// HTTP headers that let shard-aware clients (see KvsClient) send key requests straight to a node
+/// of the shard that owns the key, instead of having the node they ask proxy the request, and that
+/// bound how often nodes forward a request among themselves.
+namespace ShardRouting
+{
+
+/// Request header. With the value REDIRECT, a node that doesn't own the key answers with a
+/// 307 Temporary Redirect to a node that does, instead of forwarding the request.
+constexpr const char *ROUTE_HEADER = "X-Shard-Route";
+constexpr const char *REDIRECT = "redirect";
+
+/// Headers of a redirect: the members of the shard that owns the key, separated by commas, and
+/// the version of the scheme that says so. The Location header has the full URL at one member.
+constexpr const char *MEMBERS_HEADER = "X-Shard-Members";
+constexpr const char *SCHEME_VERSION_HEADER = "X-Shard-Scheme-Version";
+
+/// Headers of a request one node forwards to another: the number of hops it has taken, counting
+/// the one to the receiver, and (in SCHEME_VERSION_HEADER) the version of the scheme the sender
+/// routed it by. A receiver that doesn't own the key passes the request on only if its scheme is
+/// newer and the request has hops left. Otherwise it answers MISDIRECTED, with its serialized
+/// scheme as the body and its version in SCHEME_VERSION_HEADER.
+constexpr const char *FORWARD_HOPS_HEADER = "X-Forward-Hops";
+const int MAX_FORWARD_HOPS = 2;
+const Pistache::Http::Code MISDIRECTED = Pistache::Http::Code::Conflict;
+
+/// The headers, for sending with Pistache's RequestBuilder::header().
+class RouteHeader : public Pistache::Http::Header::Header
+{
+public:
+    NAME(ROUTE_HEADER)
+
+    void parse(const std::string &) override {}
+
+    void write(std::ostream &os) const override { os << REDIRECT; }
+};
+
+class ForwardHopsHeader : public Pistache::Http::Header::Header
+{
+public:
+    NAME(FORWARD_HOPS_HEADER)
+
+    ForwardHopsHeader(int hops)
+        : mHops(hops)
+    {
+    }
+
+    void parse(const std::string &) override {}
+
+    void write(std::ostream &os) const override { os << mHops; }
+
+private:
+    int mHops;
+};
+
+class SchemeVersionHeader : public Pistache::Http::Header::Header
+{
+public:
+    NAME(SCHEME_VERSION_HEADER)
+
+    SchemeVersionHeader(int version)
+        : mVersion(version)
+    {
+    }
+
+    void parse(const std::string &) override {}
+
+    void write(std::ostream &os) const override { os << mVersion; }
+
+private:
+    int mVersion;
+};
+
+/// Where nodes serve their serialized shard scheme (see ShardSchemeUtility::serializeScheme()).
+constexpr const char *SCHEME_RESOURCE = "/shard/scheme";
+
+} // namespace ShardRouting
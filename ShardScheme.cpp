@@ -23,6 +23,10 @@ ShardScheme::addShard(const ShardInfo &shard)
     mShards.emplace(itr, shard);
 
     mNumNodes += shard.getNodeSet().size();
+
+    // Shard IDs after the new shard have changed.
+    if (isRing() || !shard.getTokens().empty())
+        buildRing();
 }
 
 int
@@ -73,6 +77,19 @@ ShardScheme::getShardInfoForAddress(const string &address) const
 size_t
 ShardScheme::getResponsibleShardId(size_t keyHash) const
 {
+    if (isRing()) {
+        auto point = upper_bound(mRing.begin(), mRing.end(), keyHash,
+                                 [](size_t hsh, const pair<size_t, size_t> &point) {
+                                     return hsh < point.first;
+                                 });
+
+        // Past the last token, the ring wraps around to the first.
+        if (point == mRing.end())
+            point = mRing.begin();
+
+        return point->second;
+    }
+
     auto pos = firstShardAboveHash(keyHash);
 
     if (pos == mShards.end())
@@ -97,3 +114,16 @@ ShardScheme::firstShardAboveHash(size_t hsh) const
 
     return pos.underlyingIterator();
 }
+
+void
+ShardScheme::buildRing()
+{
+    mRing.clear();
+
+    for (size_t id = 0; id < mShards.size(); ++id) {
+        for (size_t token : mShards[id].getTokens())
+            mRing.emplace_back(token, id);
+    }
+
+    sort(mRing.begin(), mRing.end());
+}
@@ -1,14 +1,23 @@
 #pragma once
 
+#include <algorithm>
 #include <optional>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 class ShardInfo;
 class ShardScheme;
 
 /// NOTE: Shard IDs are indices.
+///
+/// Keys are placed in one of two ways. In a range scheme, a shard owns the hashes from the previous
+/// shard's hash up to, but not including, its own, wrapping around. In a ring scheme, each shard
+/// has many tokens, and owns the hashes from the token before each of them on the ring up to, but
+/// not including, the token. Adding a shard to a ring takes a little from every shard, and removing
+/// one spreads its keys over all the others, so only about 1/N of the keys move. A scheme is a
+/// ring scheme if any of its shards has tokens; shards are still ordered by hash.
 class ShardScheme
 {
 public:
@@ -46,14 +55,23 @@ public:
     /// Helper function equivalent to getShardInfo(getResponsibleShardId(keyHash)).
     const ShardInfo &getResponsibleShardInfo(size_t keyHash) const;
 
+    /// Returns true if keys are placed by the shards' tokens rather than by their hashes.
+    bool isRing() const { return !mRing.empty(); }
+
 private:
     /// Finds the first shard in mShards for which getHash() > hash. Returns the
     /// iterator to its position (possibly equal to mShards.end()).
     std::vector<ShardInfo>::const_iterator firstShardAboveHash(size_t hash) const;
 
+    /// Rebuilds mRing from the shards' tokens.
+    void buildRing();
+
     std::vector<ShardInfo> mShards;
     int mVersion;
     size_t mNumNodes;
+
+    /// Every shard's tokens with the shard's ID, sorted by token. Empty in a range scheme.
+    std::vector<std::pair<size_t, size_t>> mRing;
 };
 
 class ShardInfo
@@ -66,20 +84,39 @@ public:
     }
 
     /// Adds a new node to the shard.
-    void addNode(const std::string &node) { mNodes.insert(node); }
+    void addNode(const std::string &node)
+    {
+        if (mNodes.insert(node).second)
+            mNodeList.push_back(node);
+    }
 
     /// Removes a node from the shard.
-    void removeNode(const std::string &node) { mNodes.erase(node); }
+    void removeNode(const std::string &node)
+    {
+        if (mNodes.erase(node))
+            mNodeList.erase(std::find(mNodeList.begin(), mNodeList.end(), node));
+    }
 
     /// Returns the shard's hash.
     size_t getHash() const { return mHash; }
 
+    /// Adds a point that the shard owns on the hash ring.
+    void addToken(size_t token) { mTokens.push_back(token); }
+
+    /// Returns the shard's points on the hash ring, or nothing in a range scheme.
+    const std::vector<size_t> &getTokens() const { return mTokens; }
+
     size_t getNumNodes() const { return mNodes.size(); }
 
     /// Returns the nodes inside the shard.
     const std::set<std::string> &getNodeSet() const { return mNodes; }
 
+    /// Returns the same nodes as getNodeSet(), for picking one by index.
+    const std::vector<std::string> &getNodes() const { return mNodeList; }
+
 private:
     std::set<std::string> mNodes;
+    std::vector<std::string> mNodeList;
+    std::vector<size_t> mTokens;
     size_t mHash;
 };
@@ -1,12 +1,110 @@
 #include "ShardSchemeUtility.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <set>
 
 using namespace std;
 
 namespace
 {
 
+/// Adds TOKENS_PER_SHARD pseudorandom tokens to the shard. The same seed always gives the same
+/// tokens; shards must be given different seeds.
+void
+addRingTokens(ShardInfo &shard, uint64_t seed)
+{
+    // splitmix64: consecutive inputs give well-spread, independent-looking outputs.
+    uint64_t state = seed * ShardSchemeUtility::TOKENS_PER_SHARD;
+    for (size_t idx = 0; idx < ShardSchemeUtility::TOKENS_PER_SHARD; ++idx) {
+        uint64_t token = (state += 0x9e3779b97f4a7c15ull);
+        token = (token ^ (token >> 30)) * 0xbf58476d1ce4e5b9ull;
+        token = (token ^ (token >> 27)) * 0x94d049bb133111ebull;
+        shard.addToken((size_t)(token ^ (token >> 31)));
+    }
+}
+
+/// Creates a ring scheme with a version. Shards are ordered by their IDs, which are their hashes.
+ShardScheme
+createRingScheme(int version, size_t numShards, vector<string> allAddresses)
+{
+    assert(numShards > 0);
+
+    ShardScheme newScheme(version);
+
+    for (size_t shardId = 0; shardId < numShards; ++shardId) {
+        ShardInfo shard(shardId);
+        addRingTokens(shard, shardId);
+
+        // Deals the addresses out as evenly as possible.
+        size_t numNodes = allAddresses.size() / (numShards - shardId);
+        for (size_t nodeIdx = 0; nodeIdx < numNodes; ++nodeIdx) {
+            shard.addNode(allAddresses.back());
+            allAddresses.pop_back();
+        }
+
+        newScheme.addShard(shard);
+    }
+
+    return newScheme;
+}
+
+/// createNewShardScheme() for ring schemes.
+ShardScheme
+createNewRingScheme(const ShardScheme &old, size_t numShards)
+{
+    assert(numShards > 0);
+
+    int version = old.version() + 1;
+
+    // Shards past numShards go away; their nodes are dealt out to the rest.
+    vector<ShardInfo> shards;
+    vector<string> spareNodes;
+    for (size_t shardId = 0; shardId < old.getNumShards(); ++shardId) {
+        const ShardInfo &shard = old.getShardInfo(shardId);
+        if (shardId < numShards) {
+            shards.push_back(shard);
+        } else {
+            const auto &nodes = shard.getNodes();
+            spareNodes.insert(spareNodes.end(), nodes.begin(), nodes.end());
+        }
+    }
+
+    // New shards get fresh tokens. Their seeds include the version so they differ from those of
+    // every shard created before.
+    for (size_t shardId = shards.size(); shardId < numShards; ++shardId) {
+        ShardInfo shard(shardId);
+        addRingTokens(shard, ((uint64_t)version << 32) | shardId);
+        shards.push_back(shard);
+    }
+
+    auto bySize = [](const ShardInfo &a, const ShardInfo &b) {
+        return a.getNumNodes() < b.getNumNodes();
+    };
+
+    for (const string &node : spareNodes)
+        min_element(shards.begin(), shards.end(), bySize)->addNode(node);
+
+    // Moves nodes from the largest shard to the smallest until they differ by at most one.
+    while (true) {
+        auto smallest = min_element(shards.begin(), shards.end(), bySize);
+        auto largest = max_element(shards.begin(), shards.end(), bySize);
+        if (largest->getNumNodes() <= smallest->getNumNodes() + 1)
+            break;
+
+        string node = largest->getNodes().back();
+        largest->removeNode(node);
+        smallest->addNode(node);
+    }
+
+    ShardScheme newScheme(version);
+    for (const ShardInfo &shard : shards)
+        newScheme.addShard(shard);
+
+    return newScheme;
+}
+
 /// Creates a shard scheme with a version.
 ShardScheme
 createShardScheme(int version, size_t numShards, vector<string> allAddresses)
@@ -48,15 +146,21 @@ namespace ShardSchemeUtility
 {
 
 ShardScheme
-createInitialShardScheme(size_t numShards, vector<string> allAddresses)
+createInitialShardScheme(size_t numShards, vector<string> allAddresses, Placement placement)
 {
+    if (placement == Placement::Ring)
+        return createRingScheme(0, numShards, allAddresses);
+
     return createShardScheme(0, numShards, allAddresses);
 }
 
 ShardScheme
 createNewShardScheme(const ShardScheme &old, size_t numShards)
 {
-    // TODO: This should try to minimize the amount of data that is moved.
+    if (old.isRing())
+        return createNewRingScheme(old, numShards);
+
+    // TODO: Range schemes could try to minimize the amount of data that is moved too.
 
     vector<string> allAddresses;
 
@@ -70,104 +174,67 @@ createNewShardScheme(const ShardScheme &old, size_t numShards)
 }
 
 ShardScheme
-addNodeToScheme(const ShardScheme &old, const std::string &address)
+changeMembership(const ShardScheme &old, const vector<string> &added,
+                 const vector<string> &removed)
 {
-    // Inserts address into least populated shard.
-
-    size_t candidateShard = 0;
-    size_t candidateSize = old.getShardInfo(candidateShard).getNumNodes();
+    vector<ShardInfo> newShards;
+    for (size_t shardId = 0; shardId < old.getNumShards(); ++shardId)
+        newShards.push_back(old.getShardInfo(shardId));
 
-    for (size_t shardId = 1; shardId < old.getNumShards(); ++shardId) {
-        size_t size = old.getShardInfo(shardId).getNumNodes();
+    if (newShards.empty())
+        return old;
 
-        if (size < candidateSize) {
-            candidateShard = shardId;
-            candidateSize = size;
-        }
+    for (const string &address : removed) {
+        optional<size_t> shardId = old.getShardIdForAddress(address);
+        if (shardId)
+            newShards[shardId.value()].removeNode(address);
     }
 
-    ShardScheme newScheme(old.version() + 1);
+    auto bySize = [](const ShardInfo &a, const ShardInfo &b) {
+        return a.getNumNodes() < b.getNumNodes();
+    };
 
-    for (size_t shardId = 0; shardId < old.getNumShards(); ++shardId) {
-        ShardInfo newShard = old.getShardInfo(shardId);
+    // New nodes fill the smallest shards first, since a node that joins a shard has to copy its
+    // data whether it is new or not.
+    set<string> placed;
+    for (const string &address : added) {
+        if (!old.getShardIdForAddress(address) && placed.insert(address).second)
+            min_element(newShards.begin(), newShards.end(), bySize)->addNode(address);
+    }
 
-        if (shardId == candidateShard)
-            newShard.addNode(address);
+    // Nodes that are already in the scheme only move if the shards still differ by more than one.
+    while (true) {
+        auto smallest = min_element(newShards.begin(), newShards.end(), bySize);
+        auto largest = max_element(newShards.begin(), newShards.end(), bySize);
+        if (largest->getNumNodes() <= smallest->getNumNodes() + 1)
+            break;
 
-        newScheme.addShard(newShard);
+        string movedNode = *largest->getNodeSet().begin();
+        largest->removeNode(movedNode);
+        smallest->addNode(movedNode);
     }
 
+    ShardScheme newScheme(old.version() + 1);
+    for (const ShardInfo &shard : newShards)
+        newScheme.addShard(shard);
+
     return newScheme;
 }
 
 ShardScheme
-delNodeFromScheme(const ShardScheme &old, const std::string &address)
+addNodeToScheme(const ShardScheme &old, const std::string &address)
 {
-    // Removes address and possibly redistributes nodes.
-
-    optional<size_t> addressShardId = old.getShardIdForAddress(address);
+    return changeMembership(old, {address}, {});
+}
 
+ShardScheme
+delNodeFromScheme(const ShardScheme &old, const std::string &address)
+{
     // If the address was not found, don't change anything.
-    if (!addressShardId)
+    if (!old.getShardIdForAddress(address))
         return old;
 
-    // If there is only one shard, just remove the address.
-    if (old.getNumShards() == 1) {
-        assert(addressShardId.value() == 0);
-
-        ShardScheme newScheme(old.version() + 1);
-
-        ShardInfo newShard = old.getShardInfo(0);
-        newShard.removeNode(address);
-
-        newScheme.addShard(newShard);
-
-        return newScheme;
-    }
-
-    // Otherwise, try to redistribute nodes.
-
-    size_t newShardSize = old.getShardInfo(addressShardId.value()).getNumNodes() - 1;
-
-    size_t largestOtherId = addressShardId.value() == 0 ? 1 : 0;
-    size_t largestOtherSize = old.getShardInfo(largestOtherId).getNumNodes();
-    for (size_t shardId = 1; shardId < old.getNumShards(); ++shardId) {
-
-        // We're trying to find the largest shard other than the shard from which we
-        // are removing an address.
-        if (shardId == addressShardId.value())
-            continue;
-
-        size_t size = old.getShardInfo(shardId).getNumNodes();
-
-        if (size > largestOtherSize) {
-            largestOtherId = shardId;
-            largestOtherSize = size;
-        }
-    }
-
-    ShardScheme newScheme(old.version() + 1);
-
-    vector<ShardInfo> newShards;
-
-    for (size_t shardId = 0; shardId < old.getNumShards(); ++shardId)
-        newShards.push_back(old.getShardInfo(shardId));
-
-    ShardInfo &changedShard = newShards[addressShardId.value()];
-    changedShard.removeNode(address);
-
-    // Always move one node from another shard to this shard. This is a simple (but not very
-    // efficient) way to keep everything balanced.
-    if (largestOtherSize > 0) {
-        ShardInfo &otherShard = newShards[largestOtherId];
-
-        string movedNode = *otherShard.getNodeSet().begin();
-
-        otherShard.removeNode(movedNode);
-        changedShard.addNode(movedNode);
-    }
-
-    return newScheme;
+    return changeMembership(old, {}, {address});
 }
 
 } // namespace ShardSchemeUtility
@@ -8,13 +8,39 @@
 namespace ShardSchemeUtility
 {
 
+/// How keys are placed on shards (see ShardScheme).
+enum class Placement
+{
+    /// Every shard owns an even range of hashes.
+    Range,
+
+    /// Every shard owns many small ranges on a hash ring.
+    Ring
+};
+
+/// Number of tokens each shard of a ring scheme has.
+const size_t TOKENS_PER_SHARD = 128;
+
 /// Creates an initial shard scheme. This function is completely deterministic.
-ShardScheme createInitialShardScheme(size_t numShards, std::vector<std::string> allAddresses);
+ShardScheme createInitialShardScheme(size_t numShards, std::vector<std::string> allAddresses,
+                                     Placement placement = Placement::Range);
 
 /// Creates a new shard scheme so that switching from the old scheme to
-/// the new scheme requires moving only a small amount of data.
+/// the new scheme requires moving only a small amount of data. The new scheme places keys the
+/// way the old one does. A ring scheme keeps the first shards with their tokens and nodes, so
+/// only the keys of added or removed shards move, and nodes only move to even out the shards.
+/// A range scheme recomputes every shard.
 ShardScheme createNewShardScheme(const ShardScheme &old, size_t numShards);
 
+/// Returns a scheme, one version later, with the added nodes in it and the removed nodes out of
+/// it. The shards and their placement stay the same, so no key changes shard; only nodes that
+/// join a shard have to copy its data. Added nodes go to the smallest shards, and nodes that were
+/// already in the scheme are only moved if the shards still differ by more than one node.
+/// Added nodes that are already in the scheme, removed nodes that aren't, and repeated nodes are
+/// ignored.
+ShardScheme changeMembership(const ShardScheme &old, const std::vector<std::string> &added,
+                             const std::vector<std::string> &removed);
+
 /// Returns a scheme with the new address added to a shard in the most
 /// efficient manner.
 ShardScheme addNodeToScheme(const ShardScheme &old, const std::string &address);
@@ -72,6 +72,13 @@ serializeScheme(const ShardScheme &scheme, string avoidChars)
             builder << escapeChars(node, " ");
             builder << " ";
         }
+
+        builder << shard.getTokens().size();
+        builder << " ";
+        for (size_t token : shard.getTokens()) {
+            builder << token;
+            builder << " ";
+        }
     }
 
     string serialized = builder.str();
@@ -107,6 +114,10 @@ deserializeScheme(string_view schemeString, string avoidChars)
             skipWhitespace(schemeString);
         }
 
+        size_t numTokens = svToUl(schemeString);
+        for (size_t tokenIdx = 0; tokenIdx < numTokens; ++tokenIdx)
+            shard.addToken(svToUl(schemeString));
+
         scheme.addShard(shard);
     }
 
@@ -22,6 +22,12 @@ VectorClock::VectorClock(unordered_map<string, int> &&nodeClocks)
 {
 }
 
+VectorClock::VectorClock(unordered_map<string, int> &&nodeClocks, time_t physicalTimeStamp)
+    : mPhysicalTimeStamp(physicalTimeStamp)
+    , mNodeClocks(move(nodeClocks))
+{
+}
+
 VectorClock::CompareValue
 VectorClock::compare(const VectorClock &other) const
 {
@@ -157,3 +163,16 @@ bool VectorClock::isMax(const VectorClock &a, const VectorClock &b)
     if (b.mPhysicalTimeStamp > a.mPhysicalTimeStamp) return false;
     return true;
 }
+
+bool VectorClock::covers(const VectorClock &a, const VectorClock &b)
+{
+    for (auto it = b.mNodeClocks.cbegin(); it != b.mNodeClocks.cend(); ++it) {
+        auto ita = a.mNodeClocks.find(it->first);
+
+        int aV = ita == a.mNodeClocks.end() ? 0 : ita->second;
+
+        if (aV < it->second) return false;
+    }
+
+    return true;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include <time.h>
 #include <unordered_map>
 
@@ -12,6 +13,8 @@ public:
     VectorClock(const std::unordered_map<std::string, int> &nodeClocks);
     // move construct
     VectorClock(std::unordered_map<std::string, int> &&nodeClocks);
+    // move construct with a given time stamp
+    VectorClock(std::unordered_map<std::string, int> &&nodeClocks, time_t physicalTimeStamp);
 
     enum CompareValue
     {
@@ -27,6 +30,9 @@ public:
 
     std::string toString() const;
 
+    const std::unordered_map<std::string, int> &nodeClocks() const { return mNodeClocks; }
+    time_t physicalTimeStamp() const { return mPhysicalTimeStamp; }
+
     // both ops make a new VectorClock, with a new time stamp
     static VectorClock merge(const VectorClock &a, const VectorClock &b);
     static VectorClock add(const VectorClock &a, const std::string &index, int value);
@@ -37,6 +43,9 @@ public:
     // This breaks concurrency with the time stamp
     static bool isMax(const VectorClock &a, const VectorClock &b);
 
+    // does a know about every event b knows about (ignores the time stamp)
+    static bool covers(const VectorClock &a, const VectorClock &b);
+
 private:
     std::unordered_map<std::string, int> mNodeClocks;
     time_t mPhysicalTimeStamp;
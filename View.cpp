@@ -7,18 +7,8 @@ View::View(const string &address, const ShardScheme &shardScheme)
     , mShardScheme(shardScheme)
     , mShardId(mShardScheme.getShardIdForAddress(address))
 {
-    // clang-format off
-    auto opts = Pistache::Http::Client::options()
-                    .threads(1)
-                    .keepAlive(true)
-                    .maxConnectionsPerHost(8);
-    // clang-format on
-
-    mClient.init(opts);
 }
 
-View::~View() { mClient.shutdown(); }
-
 const string &
 View::getAddress() const
 {
@@ -74,20 +64,3 @@ View::getAddressesInShard() const
     else
         return {mAddress};
 }
-
-Pistache::Async::Promise<Pistache::Http::Response>
-View::sendMsg(const string &address, const string &resource, const string &msg,
-              chrono::milliseconds timeout) const
-{
-    Pistache::Http::RequestBuilder requestBuilder = mClient.get("");
-
-    // clang-format off
-    requestBuilder
-        .method(Pistache::Http::Method::Patch)
-        .resource(address + "/inter_server/" + resource)
-        .body(msg)
-        .timeout(timeout);
-    // clang-format on
-
-    return requestBuilder.send();
-}
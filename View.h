@@ -3,8 +3,6 @@
 #include "ShardScheme.h"
 
 #include <optional>
-#include <pistache/client.h>
-#include <pistache/http.h>
 #include <set>
 #include <string>
 
@@ -12,14 +10,15 @@
 /// about the node's shard, the total number of shards in the system, the
 /// addresses of all other nodes in the system, and which shard each of the other
 /// nodes belongs to.
+///
+/// A view is only metadata. Messages to other nodes go through the node's PeerTransport, which
+/// outlives views.
 class View
 {
 public:
     /// Creates a view with a sharding scheme.
     View(const std::string &address, const ShardScheme &shardScheme = ShardScheme());
 
-    ~View();
-
     /// Returns this node's address.
     const std::string &getAddress() const;
 
@@ -43,20 +42,8 @@ public:
     /// Returns all addresses in the same shard as this node, including the address of this node.
     std::set<std::string> getAddressesInShard() const;
 
-    /// Sends a message to another node. The message is sent with the PATCH method
-    /// to inter_server/$resource, with $msg being sent in the body.
-    ///
-    /// Thread-safe.
-    Pistache::Async::Promise<Pistache::Http::Response>
-    sendMsg(const std::string &address, const std::string &resource, const std::string &msg,
-            std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()) const;
-
-    Pistache::Http::RequestBuilder requestBuilder() { return mClient.get(""); }
-
 private:
     const std::string mAddress;
     const ShardScheme mShardScheme;
     const std::optional<size_t> mShardId;
-
-    mutable Pistache::Http::Client mClient;
 };
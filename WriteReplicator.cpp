@@ -0,0 +1,199 @@
+#include "WriteReplicator.h"
+
+using namespace std;
+
+bool
+WriteReplicator::Ack::wait(chrono::milliseconds timeout)
+{
+    unique_lock<mutex> lock(mMutex);
+    return mConditionVariable.wait_for(lock, timeout, [this]() { return mCount >= mRequired; });
+}
+
+void
+WriteReplicator::Ack::acknowledge()
+{
+    lock_guard<mutex> lock(mMutex);
+
+    ++mCount;
+    if (mCount >= mRequired)
+        mConditionVariable.notify_all();
+}
+
+WriteReplicator::WriteReplicator(SendFunction send, RetryFunction retry, size_t maxBatchesInFlight,
+                                 size_t maxBatchSize, size_t maxPending)
+    : mSend(send)
+    , mRetry(retry)
+    , mMaxBatchesInFlight(maxBatchesInFlight)
+    , mMaxBatchSize(maxBatchSize)
+    , mMaxPending(maxPending)
+{
+}
+
+WriteReplicator::AckPtr
+WriteReplicator::replicate(const vector<string> &addresses, const string &key,
+                           const DataVersion &version, size_t required)
+{
+    AckPtr ack = make_shared<Ack>(required);
+
+    {
+        lock_guard<mutex> lock(mPeersMut);
+        for (const string &address : addresses) {
+            Peer &peer = mPeers[address];
+            if (peer.pending.size() >= mMaxPending) {
+                ++mNumDropped;
+                continue;
+            }
+            peer.pending.push_back({key, version, ack});
+        }
+    }
+
+    for (const string &address : addresses)
+        flush(address);
+
+    return ack;
+}
+
+void
+WriteReplicator::flush(const string &address)
+{
+    auto batch = make_shared<DataStore>();
+    vector<AckPtr> acks;
+
+    // Take the batch under the lock, but send it outside of it: a send that fails right away
+    // runs onBatchDone() on this thread.
+    {
+        lock_guard<mutex> lock(mPeersMut);
+        Peer &peer = mPeers[address];
+
+        if (peer.pending.empty() || peer.batchesInFlight >= mMaxBatchesInFlight || peer.retrying)
+            return;
+
+        size_t batchSize = min(peer.pending.size(), mMaxBatchSize);
+        for (size_t idx = 0; idx < batchSize; ++idx) {
+            PendingWrite &write = peer.pending[idx];
+
+            auto it = batch->find(write.key);
+            if (it == batch->end())
+                batch->emplace(write.key, write.version);
+            else if (VectorClock::isMax(write.version.clock, it->second.clock))
+                it->second = write.version;
+
+            acks.push_back(move(write.ack));
+        }
+        peer.pending.erase(peer.pending.begin(), peer.pending.begin() + batchSize);
+
+        ++peer.batchesInFlight;
+    }
+
+    mSend(address, *batch, [this, address, batch, acks](bool success) {
+        onBatchDone(address, batch, acks, success);
+    });
+}
+
+void
+WriteReplicator::onBatchDone(const string &address, shared_ptr<const DataStore> batch,
+                             const vector<AckPtr> &acks, bool success)
+{
+    if (success) {
+        {
+            lock_guard<mutex> lock(mPeersMut);
+            --mPeers[address].batchesInFlight;
+        }
+
+        for (const AckPtr &ack : acks)
+            ack->acknowledge();
+
+        flush(address);
+        return;
+    }
+
+    // A failed batch is resent on the side, merged with the others that fail meanwhile, so a
+    // peer that is down has one retry going instead of one per batch. Receivers keep the newest
+    // version of each key, so the order batches land in doesn't matter. Nothing more is sent to
+    // the peer until the retry is done.
+    shared_ptr<DataStore> toRetry;
+    vector<AckPtr> toRetryAcks;
+
+    {
+        lock_guard<mutex> lock(mPeersMut);
+        Peer &peer = mPeers[address];
+        --peer.batchesInFlight;
+
+        mergeBatch(peer.failed, *batch);
+        peer.failedAcks.insert(peer.failedAcks.end(), acks.begin(), acks.end());
+
+        if (peer.retrying)
+            return;
+
+        peer.retrying = true;
+        toRetry = make_shared<DataStore>(move(peer.failed));
+        toRetryAcks.swap(peer.failedAcks);
+        peer.failed = DataStore();
+    }
+
+    retry(address, move(toRetry), move(toRetryAcks));
+}
+
+void
+WriteReplicator::retry(const string &address, shared_ptr<const DataStore> batch,
+                       vector<AckPtr> acks)
+{
+    mRetry(address, batch, [this, address, batch, acks](bool delivered) {
+        onRetryDone(address, batch, acks, delivered);
+    });
+}
+
+void
+WriteReplicator::onRetryDone(const string &address, shared_ptr<const DataStore> batch,
+                             const vector<AckPtr> &acks, bool delivered)
+{
+    if (delivered) {
+        for (const AckPtr &ack : acks)
+            ack->acknowledge();
+    } else {
+        mNumDropped += batch->size();
+    }
+
+    shared_ptr<DataStore> toRetry;
+    vector<AckPtr> toRetryAcks;
+
+    {
+        lock_guard<mutex> lock(mPeersMut);
+        Peer &peer = mPeers[address];
+
+        // A retry that gave up leaves the rest to the sync thread. The next write to the peer
+        // tries it again, rather than this looping on a peer that is down.
+        if (!delivered) {
+            mNumDropped += peer.failed.size();
+            peer.failed = DataStore();
+            peer.failedAcks.clear();
+            peer.retrying = false;
+            return;
+        }
+
+        if (!peer.failed.empty()) {
+            toRetry = make_shared<DataStore>(move(peer.failed));
+            toRetryAcks.swap(peer.failedAcks);
+            peer.failed = DataStore();
+        } else {
+            peer.retrying = false;
+        }
+    }
+
+    if (toRetry)
+        retry(address, move(toRetry), move(toRetryAcks));
+    else
+        flush(address);
+}
+
+void
+WriteReplicator::mergeBatch(DataStore &into, const DataStore &batch)
+{
+    for (const auto &entry : batch) {
+        auto it = into.find(entry.first);
+        if (it == into.end())
+            into.emplace(entry.first, entry.second);
+        else if (VectorClock::isMax(entry.second.clock, it->second.clock))
+            it->second = entry.second;
+    }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "DataVersion.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Pushes writes to other replicas in batches. Each peer has a queue of pending writes; whenever
+/// fewer than maxBatchesInFlight batches are outstanding to the peer, everything queued for it is
+/// sent as one message. Writes queued while the pipeline is full ride along in the next batch, so
+/// a burst of writes turns into a few large messages instead of many small ones.
+///
+/// A batch is sent as a DataStore, the same thing the sync thread pushes. If a key was written
+/// more than once since the last batch, only its newest version is sent.
+///
+/// A batch that fails is handed to the retry function, and its writes are acknowledged if that
+/// gets it through. Each peer has at most one batch being retried: batches that fail meanwhile
+/// are merged into the next one, and nothing new is sent to the peer until the retry is done. If
+/// the retry gives up, its writes are dropped. A peer that falls behind by more than maxPending
+/// writes also misses the newer ones until it catches up. Either way, the sync thread gets the
+/// writes there, and writers waiting on them time out.
+class WriteReplicator
+{
+public:
+    /// Sends the batch to the address and calls done() with whether it was accepted.
+    using SendFunction = std::function<void(const std::string &address, const DataStore &batch,
+                                            std::function<void(bool success)> done)>;
+
+    /// Resends a batch that failed until the address accepts it or the function gives up, then
+    /// calls done() once, with whether it was accepted.
+    using RetryFunction =
+        std::function<void(const std::string &address, std::shared_ptr<const DataStore> batch,
+                           std::function<void(bool delivered)> done)>;
+
+    /// Counts the replicas that have acknowledged a write.
+    class Ack
+    {
+    public:
+        Ack(size_t required)
+            : mRequired(required)
+            , mCount(0)
+        {
+        }
+
+        /// Waits until the required number of replicas have acknowledged the write. Returns false
+        /// on timeout.
+        bool wait(std::chrono::milliseconds timeout);
+
+        void acknowledge();
+
+    private:
+        std::mutex mMutex;
+        std::condition_variable mConditionVariable;
+        const size_t mRequired;
+        size_t mCount;
+    };
+
+    using AckPtr = std::shared_ptr<Ack>;
+
+    WriteReplicator(SendFunction send, RetryFunction retry, size_t maxBatchesInFlight = 4,
+                    size_t maxBatchSize = 512, size_t maxPending = 65536);
+
+    /// Queues the write to every address. The returned Ack is satisfied once `required` of them
+    /// have acknowledged it.
+    AckPtr replicate(const std::vector<std::string> &addresses, const std::string &key,
+                     const DataVersion &version, size_t required);
+
+    /// Number of writes not delivered to a peer because its queue was full or their retry gave
+    /// up. Thread-safe.
+    uint64_t numDropped() const { return mNumDropped; }
+
+private:
+    struct PendingWrite
+    {
+        std::string key;
+        DataVersion version;
+        AckPtr ack;
+    };
+
+    struct Peer
+    {
+        std::vector<PendingWrite> pending;
+        size_t batchesInFlight = 0;
+
+        /// Whether a batch is being retried, and the writes of the batches that failed since it
+        /// was handed to the retry function.
+        bool retrying = false;
+        DataStore failed;
+        std::vector<AckPtr> failedAcks;
+    };
+
+    /// Sends the next batch to the address if there is anything pending, room in the pipeline,
+    /// and no batch being retried.
+    void flush(const std::string &address);
+
+    /// Called when a batch has been answered (or has failed).
+    void onBatchDone(const std::string &address, std::shared_ptr<const DataStore> batch,
+                     const std::vector<AckPtr> &acks, bool success);
+
+    /// Hands the writes that failed to the retry function. Assumes the peer is marked retrying.
+    void retry(const std::string &address, std::shared_ptr<const DataStore> batch,
+               std::vector<AckPtr> acks);
+
+    /// Called when the retry function is done with a batch.
+    void onRetryDone(const std::string &address, std::shared_ptr<const DataStore> batch,
+                     const std::vector<AckPtr> &acks, bool delivered);
+
+    /// Merges the batch into the store, keeping the newest version of each key.
+    static void mergeBatch(DataStore &into, const DataStore &batch);
+
+    SendFunction mSend;
+    RetryFunction mRetry;
+    const size_t mMaxBatchesInFlight;
+    const size_t mMaxBatchSize;
+    const size_t mMaxPending;
+
+    std::atomic<uint64_t> mNumDropped{0};
+
+    /// Used to protect mPeers.
+    std::mutex mPeersMut;
+    std::unordered_map<std::string, Peer> mPeers;
+};
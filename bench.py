@@ -0,0 +1,144 @@
+import os
+import sys
+import requests
+import time
+import json
+
+# Same cluster layout as test.py: four nodes, two shards of two.
+IPs = ['20', '21', '22', '23']
+buildTag = "ptest"
+ip_pref = '10.0.0.'
+sudo = 'sudo'
+port_pref = '808'
+subnet = 'mynet'
+num_shards = '2'
+sleep_time = 3
+
+num_ops = 500
+
+def startCluster():
+    for idx, ip in enumerate(IPs):
+        dock_run = f'docker run -d --ip={ip_pref}{ip} -p {port_pref}{idx+1}:{port_pref}0 --net={subnet}'
+        view = ''
+        for _ip in IPs:
+            view += ip_pref+_ip+':'+port_pref+'0'+','
+        view = view[:-1]
+        env_view = f'-e VIEW=\"{view}\"'
+        env_ip = f'-e IP_PORT=\"{ip_pref}{ip}:{port_pref}0\"'
+        env_shard = f'-e S=\"{num_shards}\"'
+        cmd = " ".join([sudo, dock_run, env_view, env_ip, env_shard, buildTag])
+        os.system(cmd)
+    time.sleep(sleep_time)
+
+def stopCluster():
+    os.system(" ".join([sudo, './build.sh rm']))
+
+def percentiles(samples):
+    samples = sorted(samples)
+    pick = lambda p: samples[min(len(samples) - 1, int(p * len(samples)))]
+    return 'p50 %.2f ms, p99 %.2f ms' % (pick(0.50) * 1000, pick(0.99) * 1000)
+
+def shardPair(ipPort):
+    # Returns two members of the same shard so reads hit a different replica than the write.
+    members = requests.get('http://%s/shard/members/0' % ipPort).json()['members'].split(',')
+    return members[0], members[1]
+
+def benchWriteMode(mode):
+    writer, reader = shardPair('10.0.0.20:8080')
+    writeTimes = []
+    readTimes = []
+    payload = ''
+    for i in range(num_ops):
+        key = 'bench_%s_%d' % (mode, i)
+
+        start = time.time()
+        rsp = requests.put('http://%s/keyValue-store/%s' % (writer, key),
+                           data={'val': 'v%d' % i, 'payload': payload, 'w': mode})
+        writeTimes.append(time.time() - start)
+        payload = rsp.json()['payload']
+
+        # A causally dependent read on the other replica; it only fans out if the write hasn't
+        # reached it yet.
+        start = time.time()
+        rsp = requests.get('http://%s/keyValue-store/%s' % (reader, key), data={'payload': payload})
+        readTimes.append(time.time() - start)
+        payload = rsp.json()['payload']
+
+    print('W=%-6s write: %s; dependent read: %s' %
+          (mode, percentiles(writeTimes), percentiles(readTimes)))
+
+def benchBatchLoad(batchSize):
+    # Loads the same number of keys one request per key, then batchSize keys per request.
+    node = '10.0.0.20:8080'
+
+    start = time.time()
+    for i in range(num_ops):
+        requests.put('http://%s/keyValue-store/single_%d' % (node, i), data={'val': 'v%d' % i})
+    single = num_ops / (time.time() - start)
+
+    start = time.time()
+    for first in range(0, num_ops, batchSize):
+        keys = range(first, min(first + batchSize, num_ops))
+        data = []
+        for i in keys:
+            data += [('key', 'batch_%d' % i), ('val', 'v%d' % i)]
+        requests.put('http://%s/batch/keyValue-store' % node, data=data)
+    batched = num_ops / (time.time() - start)
+
+    print('bulk load: %.0f keys/s one per request, %.0f keys/s %d per batch (%.1fx)' %
+          (single, batched, batchSize, batched / single))
+
+def loadKeys(node, first, last, batchSize=500):
+    for start in range(first, last, batchSize):
+        data = []
+        for i in range(start, min(start + batchSize, last)):
+            data += [('key', 'reshard_%d' % i), ('val', 'v%d' % i)]
+        requests.put('http://%s/batch/keyValue-store' % node, data=data)
+
+def migrationMetrics():
+    # Returns the number of batches migrations have sent, and the longest reshard stall, over all
+    # nodes.
+    batches = 0
+    stallUs = 0
+    for ip in IPs:
+        metrics = requests.get('http://%s%s:%s0/metrics' % (ip_pref, ip, port_pref)).json()
+        batches += metrics['migrationBatches']
+        stallUs = max(stallUs, metrics['reshardStallUs'])
+    return batches, stallUs
+
+def benchReshard(keyCounts):
+    # Times a reshard from two shards to one and back with more and more keys in the store.
+    node = '10.0.0.20:8080'
+    loaded = 0
+    for numKeys in keyCounts:
+        loadKeys(node, loaded, numKeys)
+        loaded = numKeys
+
+        times = []
+        stalls = []
+        etas = []
+        batches = migrationMetrics()[0]
+        for numShards in [1, 2]:
+            plan = requests.get('http://%s/shard/plan/%d' % (node, numShards)).json()
+            etas.append(plan['etaSeconds'])
+
+            start = time.time()
+            requests.put('http://%s/shard/changeShardNumber' % node, data={'num': numShards})
+            times.append(time.time() - start)
+            stalls.append(migrationMetrics()[1] / 1000.0)
+        batches = migrationMetrics()[0] - batches
+
+        print('reshard with %7d keys: 2->1 %.2f s (stall %.1f ms), 1->2 %.2f s (stall %.1f ms), '
+              '%d batches' % (numKeys, times[0], stalls[0], times[1], stalls[1], batches))
+        print('  planned copy time: 2->1 %.2f s, 1->2 %.2f s (-1 before a copy has been measured)'
+              % (etas[0], etas[1]))
+
+if __name__ == '__main__':
+    startCluster()
+    try:
+        for mode in ['1', 'quorum', 'all']:
+            benchWriteMode(mode)
+        benchBatchLoad(100)
+        benchReshard([1000, 10000, 100000])
+    finally:
+        stopCluster()
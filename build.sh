@@ -25,6 +25,31 @@ elif [[ $1 = "sec" ]]; then
     -e MAINIP=10.0.0.20:8080 \
     ptest
 
+elif [[ $1 = "rpcbench" ]]; then
+  #build and run the loopback benchmark of the inter-server RPC client backends
+  #arguments after rpcbench are passed on: [seconds per backend] [messages in flight] [body bytes]
+  g++ -std=c++17 -O2 -o rpcbench RpcBench.cpp RpcProtocol.cpp RpcClient.cpp RpcServer.cpp \
+    IoUring.cpp VectorClock.cpp ShardScheme.cpp -pthread && ./rpcbench "${@:2}"
+
+elif [[ $1 = "replicabench" ]]; then
+  #build and run the simulation of random against latency-aware replica selection
+  #arguments after replicabench are passed on: [requests per run] [requests per second]
+  g++ -std=c++17 -O2 -o replicabench ReplicaBench.cpp ReplicaSelector.cpp \
+    PeerLatencyTracker.cpp PeerCircuitBreakers.cpp -pthread && ./replicabench "${@:2}"
+
+elif [[ $1 = "placementbench" ]]; then
+  #build and run the measurement of data moved by reshards with range and ring placement
+  #the argument after placementbench is passed on: [number of keys]
+  g++ -std=c++17 -O2 -o placementbench PlacementBench.cpp ShardScheme.cpp ShardSchemeUtility.cpp \
+    RpcProtocol.cpp VectorClock.cpp -pthread && ./placementbench "${@:2}"
+
+elif [[ $1 = "clientsmoke" ]]; then
+  #build the client library and run its smoke test against running nodes
+  #arguments after clientsmoke are passed on: [node IP:port ...], by default the main container
+  g++ -std=c++17 -O2 -o clientsmoke KvsClientSmoke.cpp KvsClient.cpp ShardScheme.cpp \
+    ShardSchemeUtility.cpp ShardSchemeUtilitySerialization.cpp ParsingHelpers.cpp VectorClock.cpp \
+    -lpistache -pthread && ./clientsmoke "${@:2}"
+
 elif [[ $1 = "rm" ]]; then
   #kill all running containers
   docker kill $(docker ps -a -q)
@@ -34,5 +59,5 @@ elif [[ $1 = "rm" ]]; then
   docker rmi $(docker images -f "dangling=true" -q)
 
 else
-  echo Usage: ./build.sh main or ./build.sh sec or ./build.sh rm
+  echo Usage: ./build.sh main or ./build.sh sec or ./build.sh rm or ./build.sh rpcbench or ./build.sh replicabench or ./build.sh placementbench or ./build.sh clientsmoke
 fi
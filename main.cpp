@@ -1,10 +1,13 @@
 #include "Node.h"
 #include "ParseServer.h"
 #include "ParsingHelpers.h"
+#include "PeerTransport.h"
+#include "RpcServer.h"
 #include "ShardSchemeUtility.h"
 #include "VectorClock.h"
 #include "View.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <pistache/async.h>
@@ -73,6 +76,110 @@ getNumShards()
     }
 }
 
+/// Gets how keys are placed on shards from the PLACEMENT environment variable ("range" or "ring").
+/// Defaults to range. Every node must be started with the same placement; reshards keep it.
+ShardSchemeUtility::Placement
+getPlacement()
+{
+    char *placementStr = getenv("PLACEMENT");
+
+    if (placementStr && string(placementStr) == "ring")
+        return ShardSchemeUtility::Placement::Ring;
+    else
+        return ShardSchemeUtility::Placement::Range;
+}
+
+/// Gets the default write mode from the W environment variable ("1", "quorum" or "all").
+/// Defaults to "1".
+Node::WriteMode
+getWriteMode()
+{
+    char *writeModeStr = getenv("W");
+
+    if (writeModeStr)
+        return stringToWriteMode(writeModeStr).value_or(Node::WriteMode::One);
+    else
+        return Node::WriteMode::One;
+}
+
+/// Gets the number of threads that read answers from other nodes from the IO_THREADS
+/// environment variable. Defaults to 2.
+size_t
+getNumIoThreads()
+{
+    char *numThreadsStr = getenv("IO_THREADS");
+
+    if (numThreadsStr)
+        return max(strtoul(numThreadsStr, nullptr, 10), 1ul);
+    else
+        return 2;
+}
+
+/// Gets the number of connections to keep open to each other node from the PEER_CONNECTIONS
+/// environment variable. Defaults to 2.
+size_t
+getConnectionsPerPeer()
+{
+    char *numConnectionsStr = getenv("PEER_CONNECTIONS");
+
+    if (numConnectionsStr)
+        return max(strtoul(numConnectionsStr, nullptr, 10), 1ul);
+    else
+        return 2;
+}
+
+/// Gets how many bytes per second the background copy of a reshard may send from the
+/// MIGRATION_BYTES_PER_SEC environment variable. Defaults to 0, for no limit.
+size_t
+getMigrationBytesPerSecond()
+{
+    char *bytesStr = getenv("MIGRATION_BYTES_PER_SEC");
+
+    if (bytesStr)
+        return strtoul(bytesStr, nullptr, 10);
+    else
+        return 0;
+}
+
+/// Gets the percentage of the time the background copy of a reshard may keep its thread busy
+/// from the MIGRATION_CPU_PERCENT environment variable (1 to 100). Defaults to 100.
+int
+getMigrationCpuPercent()
+{
+    char *percentStr = getenv("MIGRATION_CPU_PERCENT");
+
+    if (percentStr)
+        return min(max(atoi(percentStr), 1), 100);
+    else
+        return 100;
+}
+
+/// Gets the backend of the inter-server RPC client from the RPC_BACKEND environment variable
+/// ("epoll" or "io_uring"). Defaults to epoll.
+RpcClient::Backend
+getRpcBackend()
+{
+    char *backendStr = getenv("RPC_BACKEND");
+
+    if (backendStr && string(backendStr) == "io_uring")
+        return RpcClient::Backend::IoUring;
+    else
+        return RpcClient::Backend::Epoll;
+}
+
+/// Gets the port every node listens for inter-server RPC on from the RPC_PORT environment
+/// variable. Defaults to 8081. Every node must be started with the same port.
+uint16_t
+getRpcPort()
+{
+    char *portStr = getenv("RPC_PORT");
+
+    if (portStr)
+        return (uint16_t)atoi(portStr);
+    else
+        return DEFAULT_RPC_PORT;
+}
+
 int
 main()
 {
@@ -80,13 +187,29 @@ main()
     vector<string> allAddresses = getView();
 
     shared_ptr<View> view = make_shared<View>(
-        myAddr, ShardSchemeUtility::createInitialShardScheme(getNumShards(), allAddresses));
+        myAddr,
+        ShardSchemeUtility::createInitialShardScheme(getNumShards(), allAddresses, getPlacement()));
 
-    std::shared_ptr<Node> node = make_shared<Node>(view);
+    shared_ptr<PeerTransport> transport = make_shared<PeerTransport>(
+        getNumIoThreads(), getConnectionsPerPeer(), getRpcBackend(), getRpcPort());
+    if (getRpcBackend() != transport->rpcBackend())
+        cerr << "io_uring is not supported here; using epoll for RPC" << endl;
+
+    std::shared_ptr<Node> node = make_shared<Node>(view, transport, getWriteMode(),
+                                                   getMigrationBytesPerSecond(),
+                                                   getMigrationCpuPercent());
 
     std::unique_ptr<ParseServer> server = std::make_unique<ParseServer>(node);
 
-    // Always listen on port 8080. The address from getMyAddress() is external.
+    // Other nodes send inter-server messages to the RPC port. If it can't be bound, they fall back
+    // to the HTTP routes.
+    RpcServer rpcServer(getRpcPort(), [&server](RpcOp op, RpcReader &request, RpcWriter &reply) {
+        return server->handleRpc(op, request, reply);
+    });
+    if (!rpcServer.start())
+        cerr << "Could not listen for RPC on port " << getRpcPort() << "; using HTTP only" << endl;
+
+    // Always listen on port 8080 for clients. The address from getMyAddress() is external.
     Pistache::Http::Endpoint endpoint("*:8080");
     endpoint.init(Pistache::Http::Endpoint::options().threads(10));
     endpoint.setHandler(server->handler());
@@ -4,6 +4,7 @@ import requests
 import time
 import unittest
 import json
+import threading
 
 IPs = ['20', '21', '22', '23']
 buildTag = "ptest"
@@ -22,6 +23,24 @@ def getKeyValue(ipPort, key, payload):
     #print('GET: http://%s/keyValue-store/%s'%(str(ipPort), key))
     return requests.get( 'http://%s/keyValue-store/%s'%(str(ipPort), key), data={'payload': payload} )
 
+def deleteKeyValue(ipPort, key, payload):
+    return requests.delete( 'http://%s/keyValue-store/%s'%(str(ipPort), key), data={'payload': payload} )
+
+def putBatch(ipPort, keyValues, payload):
+    data = [('payload', payload)]
+    for key, value in keyValues:
+        data += [('key', key), ('val', value)]
+    return requests.put( 'http://%s/batch/keyValue-store'%str(ipPort), data=data )
+
+def getBatch(ipPort, keys, payload):
+    data = [('payload', payload)] + [('key', key) for key in keys]
+    return requests.get( 'http://%s/batch/keyValue-store'%str(ipPort), data=data )
+
+def stopNode(ipPort):
+    # Containers publish port 808<n+1> for IPs[n].
+    idx = IPs.index(ipPort.split(':')[0].split('.')[-1])
+    os.system(f'{sudo} docker stop $({sudo} docker ps -q --filter publish={port_pref}{idx+1})')
+
 def getAllShardIds(ipPort):
     return requests.get( 'http://%s/shard/all_ids'%str(ipPort) )
 
@@ -31,6 +50,15 @@ def getMembers(ipPort, ID):
 def changeShardNumber(ipPort, newNumber):
     return requests.put( 'http://%s/shard/changeShardNumber'%str(ipPort), data={'num' : newNumber} )
 
+def getView(ipPort):
+    return requests.get( 'http://%s/view'%str(ipPort) )
+
+def changeView(ipPort, added, removed):
+    return requests.patch( 'http://%s/view'%str(ipPort), data={'add': ','.join(added), 'remove': ','.join(removed)} )
+
+def getMigration(ipPort):
+    return requests.get( 'http://%s/shard/migration'%str(ipPort) )
+
 class Tests(unittest.TestCase):
 
 
@@ -85,5 +113,119 @@ class Tests(unittest.TestCase):
         rsp = changeShardNumber('10.0.0.21:8080', 1)
         print(rsp.json())
 
+        rsp_json = getMigration('10.0.0.21:8080').json()
+        print(rsp_json)
+        self.assertEqual(rsp_json["phase"], "switched")
+        self.assertEqual(rsp_json["etaSeconds"], 0)
+
+    def test_4_batch_across_shards(self):
+        keyValues = [('batch%d'%i, 'value%d'%i) for i in range(20)]
+        rsp = putBatch('10.0.0.20:8080', keyValues, '')
+        rsp_json = rsp.json()
+        print(rsp_json)
+        self.assertEqual(int(rsp.status_code), 200)
+        self.assertEqual([r["key"] for r in rsp_json["results"]], [k for k, v in keyValues])
+        for result in rsp_json["results"]:
+            self.assertEqual(result["result"], "Success")
+            self.assertEqual(result["replaced"], False)
+        payload = rsp_json["payload"]
+
+        rsp = deleteKeyValue('10.0.0.21:8080', 'batch0', payload)
+        self.assertEqual(int(rsp.status_code), 200)
+        payload = rsp.json()["payload"]
+
+        keys = [k for k, v in keyValues] + ['missing']
+        rsp = getBatch('10.0.0.22:8080', keys, payload)
+        rsp_json = rsp.json()
+        print(rsp_json)
+        self.assertEqual(int(rsp.status_code), 200)
+        results = rsp_json["results"]
+        self.assertEqual(results[0]["msg"], "Key does not exist")
+        for (key, value), result in zip(keyValues[1:], results[1:-1]):
+            self.assertEqual(result["result"], "Success")
+            self.assertEqual(result["value"], value)
+        self.assertEqual(results[-1]["msg"], "Key does not exist")
+
+    def test_5_batch_with_failed_part(self):
+        keyValues = [('part%d'%i, 'value%d'%i) for i in range(20)]
+        rsp = putBatch('10.0.0.20:8080', keyValues, '')
+        self.assertEqual(int(rsp.status_code), 200)
+        payload = rsp.json()["payload"]
+
+        # Stop every node of one shard; its keys fail, the other shard's are still read.
+        shard_ids = getAllShardIds('10.0.0.20:8080').json()["shard_ids"].split(',')
+        members = getMembers('10.0.0.20:8080', shard_ids[0]).json()['members'].split(',')
+        for member in members:
+            stopNode(member)
+        asked = [ip_pref + ip + ':' + port_pref + '0' for ip in IPs]
+        asked = [ipPort for ipPort in asked if ipPort not in members][0]
+
+        rsp = getBatch(asked, [k for k, v in keyValues], payload)
+        rsp_json = rsp.json()
+        print(rsp_json)
+        self.assertEqual(int(rsp.status_code), 200)
+        found = [r for r in rsp_json["results"] if r["result"] == "Success"]
+        failed = [r for r in rsp_json["results"] if r.get("msg") == "Owner did not answer"]
+        self.assertTrue(len(found) > 0 and len(failed) > 0)
+        self.assertEqual(len(found) + len(failed), len(keyValues))
+
+    def test_6_remove_several_nodes(self):
+        rsp = storeKeyValue('10.0.0.20:8080', 'stays', 'here', '')
+        self.assertEqual(int(rsp.status_code), 200)
+        payload = rsp.json()["payload"]
+
+        # Two shards of one node each, or one shard left empty, are refused.
+        others = ['10.0.0.21:8080', '10.0.0.22:8080', '10.0.0.23:8080']
+        rsp = changeView('10.0.0.20:8080', [], others)
+        print(rsp.json())
+        self.assertEqual(int(rsp.status_code), 400)
+        rsp = changeView('10.0.0.20:8080', [], others[1:])
+        self.assertEqual(int(rsp.status_code), 400)
+        self.assertEqual(len(getView('10.0.0.20:8080').json()["view"].split(',')), 4)
+
+        rsp = changeShardNumber('10.0.0.20:8080', 1)
+        self.assertEqual(int(rsp.status_code), 200)
+
+        rsp = changeView('10.0.0.20:8080', [], others[1:])
+        print(rsp.json())
+        self.assertEqual(int(rsp.status_code), 200)
+        view = getView('10.0.0.21:8080').json()["view"].split(',')
+        self.assertEqual(sorted(view), ['10.0.0.20:8080', '10.0.0.21:8080'])
+
+        rsp = getKeyValue('10.0.0.21:8080', 'stays', payload)
+        self.assertEqual(int(rsp.status_code), 200)
+        self.assertEqual(rsp.json()["value"], "here")
+
+    def test_7_delete_during_reshard(self):
+        # Enough keys that the reshard copy is still running while some of them are deleted.
+        payload = ''
+        for start in range(0, 2000, 100):
+            keyValues = [('moving%d'%i, 'value%d'%i) for i in range(start, start + 100)]
+            rsp = putBatch('10.0.0.20:8080', keyValues, payload)
+            self.assertEqual(int(rsp.status_code), 200)
+            payload = rsp.json()["payload"]
+
+        reshard = threading.Thread(target=changeShardNumber, args=('10.0.0.21:8080', 1))
+        reshard.start()
+        for _ in range(100):
+            if getMigration('10.0.0.20:8080').json()["phase"] == "copying":
+                break
+            time.sleep(0.01)
+
+        deleted = ['moving%d'%i for i in range(0, 2000, 50)]
+        for key in deleted:
+            rsp = deleteKeyValue('10.0.0.20:8080', key, payload)
+            self.assertIn(int(rsp.status_code), [200, 202])
+            payload = rsp.json()["payload"]
+        reshard.join()
+
+        # The deletes must have moved with the keys instead of the old values.
+        rsp = getBatch('10.0.0.22:8080', deleted + ['moving1'], payload)
+        rsp_json = rsp.json()
+        print(rsp_json)
+        for result in rsp_json["results"][:-1]:
+            self.assertEqual(result["msg"], "Key does not exist")
+        self.assertEqual(rsp_json["results"][-1]["value"], "value1")
+
 if __name__ == '__main__':
     unittest.main()